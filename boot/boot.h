@@ -28,7 +28,12 @@
 #define BOOT_ENTRY              entry
 #define STAGE1_START            0x7C00
 #define STAGE2_START            0x1000
-#define KERNEL_START_EARLY      0x7E00
+
+/* Where the kernel and initrd are read into before being copied above 1 MiB.
+   64 KiB-aligned, so no single disk read crosses a 64 KiB boundary (which
+   ISA DMA can't do). */
+#define LOAD_BUFFER             0x10000
+#define LOAD_BUFFER_SECTORS     64      /* 32 KiB */
 
 /* Boot sector signature for MBR. */
 #define BOOTSECT_MAGIC          0xAA55
@@ -38,11 +43,13 @@
 
 /* Disk layout information.
    The following symbols are defined during linking and are stored on-disk
-   (see bootloader.ld):
+   (see boot.ld) as 16-bit values:
        STAGE2_SECTOR        -- first sector of stage 2
        STAGE2_NUM_SECTORS   -- number of sectors used by stage 2 code/data
        KERNEL_SECTOR        -- first sector of kernel image
        KERNEL_NUM_SECTORS   -- number of sectors used by kernel image
+       INITRD_NUM_SECTORS   -- number of sectors used by the initrd, which
+                               follows the kernel image on disk
 */
 
 #endif /* __BOOT_H */
@@ -20,7 +20,8 @@
 #ifndef __FLOPPY_H
 #define __FLOPPY_H
 
-/* Properties of a 1.4 MiB, 3.5in floppy disks. */
+/* Properties of a 1.44 MiB, 3.5in floppy disk; used if the BIOS can't tell
+   us the geometry of the boot disk. */
 #define HEAD_COUNT          2
 #define CYL_COUNT           80
 #define SECTOR_COUNT        18
@@ -28,6 +29,9 @@
 
 #define RETRY_COUNT         3
 
+#define BIOS_RESET_DISK     0x00
 #define BIOS_READ_FLOPPY    0x02
+#define BIOS_DISK_PARAMS    0x08
+#define BIOS_MOVE_EXT       0x87    /* int 15h: copy to/from extended memory */
 
 #endif /* __FLOPPY_H */
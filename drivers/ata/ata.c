@@ -0,0 +1,741 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * Copyright (C) 2018 Wes Hampson. All Rights Reserved.                       *
+ *                                                                            *
+ * This file is part of the Lyra operating system.                            *
+ *                                                                            *
+ * Lyra is free software: you can redistribute it and/or modify               *
+ * it under the terms of version 2 of the GNU General Public License          *
+ * as published by the Free Software Foundation.                              *
+ *                                                                            *
+ * See LICENSE in the top-level directory for a copy of the license.          *
+ * You may also visit <https://www.gnu.org/licenses/gpl-2.0.txt>.             *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+/*-----------------------------------------------------------------------------
+ *   File: drivers/ata/ata.c
+ * Author: Wes Hampson
+ *   Desc: ATA (IDE) disk driver.
+ *
+ * Drives are addressed with 28-bit LBAs. Requests are completed from the
+ * channel's interrupt, in one of two ways:
+ *
+ *   - Bus-master DMA: the request's buffers are described to the controller
+ *     in a PRD (physical region descriptor) table and the controller moves
+ *     the data on its own, raising a single interrupt at the end. Used when
+ *     the PCI IDE controller supports it and the buffers can be described
+ *     (see build_prdt()).
+ *   - PIO with READ/WRITE MULTIPLE: the CPU moves the data through the data
+ *     port, one interrupt per block of sectors rather than per sector.
+ *
+ * The two drives on a channel share its registers, so only one of them can
+ * have a command in flight. A drive that gets a request while the other one
+ * is busy parks it until the channel frees up.
+ *
+ * Only the legacy (compatibility mode) I/O ports are used. There are no
+ * command timeouts, and the DMA transfer mode is left as set up by the BIOS.
+ *----------------------------------------------------------------------------*/
+
+#include <string.h>
+#include <lyra/kernel.h>
+#include <lyra/block.h>
+#include <lyra/cpu.h>
+#include <lyra/interrupt.h>
+#include <lyra/io.h>
+#include <lyra/irq.h>
+#include <lyra/memory.h>
+#include <drivers/ata.h>
+#include <drivers/pci.h>
+
+/* Command block registers, relative to the channel's base port. */
+#define REG_DATA            0
+#define REG_ERROR           1
+#define REG_COUNT           2
+#define REG_LBA0            3
+#define REG_LBA1            4
+#define REG_LBA2            5
+#define REG_DRIVE           6
+#define REG_STATUS          7       /* read */
+#define REG_COMMAND         7       /* write */
+
+/* Control block register (alternate status on read). */
+#define REG_DEVCTRL         0
+#define DEVCTRL_NIEN        0x02    /* interrupts disabled */
+
+/* Status bits. */
+#define ST_ERR              0x01
+#define ST_DRQ              0x08
+#define ST_DF               0x20
+#define ST_BSY              0x80
+
+/* Drive/head register. */
+#define DRIVE_LBA           0xE0
+#define DRIVE_SLAVE         0x10
+
+/* Commands. */
+#define CMD_READ_SECTORS    0x20
+#define CMD_WRITE_SECTORS   0x30
+#define CMD_READ_MULTIPLE   0xC4
+#define CMD_WRITE_MULTIPLE  0xC5
+#define CMD_SET_MULTIPLE    0xC6
+#define CMD_READ_DMA        0xC8
+#define CMD_WRITE_DMA       0xCA
+#define CMD_IDENTIFY        0xEC
+
+/* IDENTIFY DEVICE words. */
+#define ID_MODEL            27      /* 20 words, byte-swapped */
+#define ID_MULTIPLE         47      /* low byte: max sectors per block */
+#define ID_CAPS             49
+#define ID_LBA_SECTORS      60      /* 2 words */
+#define ID_MWDMA            63
+#define ID_UDMA             88
+#define CAPS_DMA            0x0100
+#define CAPS_LBA            0x0200
+
+/* Bus master IDE registers, relative to the channel's bus master base. */
+#define BM_COMMAND          0
+#define BM_STATUS           2
+#define BM_PRDT             4
+#define BM_CMD_START        0x01
+#define BM_CMD_READ         0x08    /* device to memory */
+#define BM_ST_ERROR         0x02
+#define BM_ST_IRQ           0x04
+#define BM_CHANNEL_OFFSET   8       /* secondary channel's registers */
+
+#define PROGIF_BUSMASTER    0x80    /* PCI IDE controller can bus master */
+
+/* PRD table. A region may not cross a 64 KiB boundary. */
+#define PRDT_LEN            64
+#define PRD_EOT             0x8000  /* last entry in the table */
+#define PRD_BOUNDARY        0x10000
+
+#define ATA_MAX_SECTORS     256     /* per command, with 28-bit LBAs */
+#define SECTOR_WORDS        (SECTOR_SIZE / 2)
+#define POLL_TIMEOUT        1000000
+
+#ifdef __BENCH
+#define BENCH_SECTORS       2048    /* 1 MiB */
+#define BENCH_PAGES         8       /* bio size in ata_bench() */
+#endif
+
+/* Physical region descriptor. */
+struct prd {
+    uint32_t addr;
+    uint16_t len;                   /* 0 means 64 KiB */
+    uint16_t flags;
+};
+
+struct ata_drive;
+
+struct ata_channel {
+    uint16_t base;                  /* command block ports */
+    uint16_t ctrl;                  /* control block port */
+    uint16_t bmide;                 /* bus master ports; 0 if none */
+    unsigned int irq;
+    struct prd *prdt;
+    struct ata_drive *drives[2];
+    struct ata_drive *cur;          /* drive with a command in flight */
+    bool dma;                       /* the command uses DMA */
+
+    /* PIO progress. */
+    uint32_t left;                  /* sectors left to transfer */
+    struct bio *bio;
+    int vec;
+    uint32_t off;
+};
+
+struct ata_drive {
+    struct blkdev dev;
+    struct ata_channel *chan;
+    bool slave;
+    bool dma_ok;
+    uint16_t multiple;              /* sectors per PIO block */
+    struct request *req;            /* in flight or waiting for the channel */
+    char model[41];
+};
+
+static struct ata_channel channels[ATA_NUM_CHANNELS] = {
+    { .base = 0x1F0, .ctrl = 0x3F6, .irq = IRQ_ATA0 },
+    { .base = 0x170, .ctrl = 0x376, .irq = IRQ_ATA1 }
+};
+
+static struct ata_drive drives[ATA_NUM_DRIVES];
+
+static const struct blkdev_ops ata_ops;
+
+static bool use_dma = true;
+
+#ifdef __BENCH
+static uint64_t busy_cycles;        /* spent starting commands and in IRQs */
+#endif
+
+static uint16_t ident[256];
+
+static void bmide_init(void);
+static void probe_channel(struct ata_channel *c);
+static bool probe_drive(struct ata_channel *c, struct ata_drive *d);
+static void ata_transfer(struct blkdev *dev, struct request *req);
+static void start(struct ata_drive *d, struct request *req);
+static void finish(struct ata_channel *c, int status);
+static int build_prdt(struct ata_channel *c, struct request *req);
+static void pio_block(struct ata_channel *c);
+static void select_drive(struct ata_channel *c, uint8_t drive);
+static int poll(struct ata_channel *c, uint8_t mask, uint8_t val);
+
+void ata_init(void)
+{
+    int i;
+
+    bmide_init();
+
+    for (i = 0; i < ATA_NUM_CHANNELS; i++) {
+        probe_channel(&channels[i]);
+    }
+}
+
+#ifdef __BENCH
+void ata_bench(void)
+{
+    static const bool modes[] = { false, true };
+    struct ata_drive *d;
+    struct bio bio;
+    uint32_t pages[BENCH_PAGES];
+    uint32_t sectors;
+    uint32_t sector;
+    uint64_t start;
+    uint64_t elapsed;
+    uint64_t busy;
+    int m, i;
+
+    d = NULL;
+    for (i = 0; i < ATA_NUM_DRIVES; i++) {
+        if (drives[i].chan != NULL) {
+            d = &drives[i];
+            break;
+        }
+    }
+    if (d == NULL) {
+        return;
+    }
+
+    for (i = 0; i < BENCH_PAGES; i++) {
+        pages[i] = frame_alloc(0);
+        if (pages[i] == 0) {
+            while (i-- > 0) {
+                frame_free(pages[i]);
+            }
+            return;
+        }
+    }
+
+    sectors = BENCH_SECTORS;
+    if (sectors > d->dev.nr_sectors) {
+        sectors = d->dev.nr_sectors;
+    }
+    sectors &= ~((BENCH_PAGES * PAGE_SIZE / SECTOR_SIZE) - 1);
+    if (sectors == 0) {
+        goto out;
+    }
+
+    for (m = 0; m < (int) (sizeof(modes) / sizeof(modes[0])); m++) {
+        if (modes[m] && !d->dma_ok) {
+            continue;
+        }
+
+        use_dma = modes[m];
+        busy_cycles = 0;
+        start = rdtsc();
+
+        for (sector = 0; sector < sectors;
+                sector += BENCH_PAGES * PAGE_SIZE / SECTOR_SIZE) {
+            bio_init(&bio, &d->dev, BIO_READ, sector);
+            for (i = 0; i < BENCH_PAGES; i++) {
+                bio_add_buf(&bio, (void *) pages[i], PAGE_SIZE);
+            }
+            if (submit_bio(&bio) != 0 || bio_wait(&bio) != 0) {
+                kprintf("%s bench: read error at sector %lu\n",
+                    d->dev.name, sector);
+                break;
+            }
+        }
+
+        elapsed = rdtsc() - start;
+        busy = busy_cycles;
+        div64(&elapsed, sectors / 2);
+        div64(&busy, sectors / 2);
+        kprintf("%s bench: %s: %lu cycles/KiB elapsed, %lu in the driver\n",
+            d->dev.name, (modes[m]) ? "DMA" : "PIO",
+            (uint32_t) elapsed, (uint32_t) busy);
+    }
+
+    use_dma = true;
+
+out:
+    for (i = 0; i < BENCH_PAGES; i++) {
+        frame_free(pages[i]);
+    }
+}
+#endif
+
+void ata_do_irq(unsigned int irq_num)
+{
+    struct ata_channel *c;
+    uint8_t status;
+    uint8_t bm_status;
+#ifdef __BENCH
+    uint64_t t0;
+
+    t0 = rdtsc();
+#endif
+
+    c = &channels[(irq_num == IRQ_ATA0) ? 0 : 1];
+    if (c->cur == NULL) {
+        inb(c->base + REG_STATUS);      /* nothing to do; just ack it */
+        goto done;
+    }
+
+    if (c->dma) {
+        bm_status = inb(c->bmide + BM_STATUS);
+        if (!(bm_status & BM_ST_IRQ)) {
+            goto done;                  /* not from this channel */
+        }
+
+        outb(0, c->bmide + BM_COMMAND);
+        status = inb(c->base + REG_STATUS);
+        outb(BM_ST_ERROR | BM_ST_IRQ, c->bmide + BM_STATUS);
+        finish(c, ((status & (ST_ERR | ST_DF)) || (bm_status & BM_ST_ERROR))
+            ? -1 : 0);
+        goto done;
+    }
+
+    status = inb(c->base + REG_STATUS);
+    if (status & (ST_ERR | ST_DF)) {
+        finish(c, -1);
+        goto done;
+    }
+
+    if (c->cur->req->dir == BIO_READ) {
+        if (!(status & ST_DRQ)) {
+            finish(c, -1);
+            goto done;
+        }
+        pio_block(c);
+        if (c->left == 0) {
+            finish(c, 0);
+        }
+    }
+    else {
+        /* One interrupt per block written, plus one when it's all done. */
+        if (c->left == 0) {
+            finish(c, 0);
+        }
+        else {
+            pio_block(c);
+        }
+    }
+
+done:
+#ifdef __BENCH
+    busy_cycles += rdtsc() - t0;
+#endif
+    return;
+}
+
+/**
+ * Looks for a PCI IDE controller that can bus master, and enables it.
+ */
+static void bmide_init(void)
+{
+    struct pci_addr addr;
+    uint32_t bar4;
+    uint32_t cmd;
+    int i;
+
+    if (!pci_find_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, &addr)) {
+        return;
+    }
+    if (!((pci_read(&addr, PCI_CLASS_REV) >> 8) & PROGIF_BUSMASTER)) {
+        return;
+    }
+
+    bar4 = pci_read(&addr, PCI_BAR4);
+    if (!(bar4 & PCI_BAR_IO) || (bar4 & PCI_BAR_IO_MASK) == 0) {
+        return;
+    }
+
+    /* The upper half is the status register, whose bits are cleared by
+       writing 1s; leave it be. */
+    cmd = pci_read(&addr, PCI_COMMAND) & 0xFFFF;
+    pci_write(&addr, PCI_COMMAND, cmd | PCI_CMD_IO | PCI_CMD_MASTER);
+
+    for (i = 0; i < ATA_NUM_CHANNELS; i++) {
+        channels[i].prdt = (struct prd *) frame_alloc(0);
+        if (channels[i].prdt != NULL) {
+            channels[i].bmide = (bar4 & PCI_BAR_IO_MASK)
+                + i * BM_CHANNEL_OFFSET;
+        }
+    }
+}
+
+static void probe_channel(struct ata_channel *c)
+{
+    struct ata_drive *d;
+    bool found;
+    int i;
+
+    /* Keep the drives quiet while they're being probed. */
+    outb(DEVCTRL_NIEN, c->ctrl + REG_DEVCTRL);
+    if (inb(c->base + REG_STATUS) == 0xFF) {
+        return;                         /* floating bus; no channel */
+    }
+
+    found = false;
+    for (i = 0; i < 2; i++) {
+        d = &drives[(c - channels) * 2 + i];
+        d->slave = (i == 1);
+        if (!probe_drive(c, d)) {
+            continue;
+        }
+
+        d->chan = c;
+        c->drives[i] = d;
+        found = true;
+
+        d->dev.name[0] = 'h';
+        d->dev.name[1] = 'd';
+        d->dev.name[2] = 'a' + (d - drives);
+        d->dev.name[3] = '\0';
+        d->dev.max_sectors = ATA_MAX_SECTORS;
+        d->dev.ops = &ata_ops;
+        d->dev.private = d;
+
+        kprintf("%s: %s, %s, %u sectors per block\n",
+            d->dev.name, d->model, (d->dma_ok) ? "DMA" : "PIO", d->multiple);
+        blkdev_register(&d->dev);
+    }
+
+    if (found) {
+        outb(0, c->ctrl + REG_DEVCTRL);
+        irq_enable(c->irq);
+    }
+}
+
+static bool probe_drive(struct ata_channel *c, struct ata_drive *d)
+{
+    int i;
+
+    select_drive(c, DRIVE_LBA | ((d->slave) ? DRIVE_SLAVE : 0));
+    outb(0, c->base + REG_COUNT);
+    outb(0, c->base + REG_LBA0);
+    outb(0, c->base + REG_LBA1);
+    outb(0, c->base + REG_LBA2);
+    outb(CMD_IDENTIFY, c->base + REG_COMMAND);
+
+    if (inb(c->base + REG_STATUS) == 0) {
+        return false;                   /* no drive */
+    }
+    if (poll(c, ST_BSY, 0) != 0) {
+        return false;
+    }
+
+    /* ATAPI and SATA devices abort IDENTIFY DEVICE and leave their
+       signature in the LBA registers. */
+    if (inb(c->base + REG_LBA1) != 0 || inb(c->base + REG_LBA2) != 0) {
+        return false;
+    }
+    if (poll(c, ST_DRQ | ST_ERR, ST_DRQ) != 0) {
+        return false;
+    }
+
+    insw(c->base + REG_DATA, ident, 256);
+    if (!(ident[ID_CAPS] & CAPS_LBA)) {
+        return false;
+    }
+
+    d->dev.nr_sectors = ident[ID_LBA_SECTORS]
+        | ((uint32_t) ident[ID_LBA_SECTORS + 1] << 16);
+    if (d->dev.nr_sectors == 0) {
+        return false;
+    }
+
+    for (i = 0; i < 20; i++) {
+        d->model[i * 2] = ident[ID_MODEL + i] >> 8;
+        d->model[i * 2 + 1] = ident[ID_MODEL + i] & 0xFF;
+    }
+    d->model[40] = '\0';
+    for (i = 39; i >= 0 && d->model[i] == ' '; i--) {
+        d->model[i] = '\0';
+    }
+
+    d->dma_ok = c->bmide != 0 && (ident[ID_CAPS] & CAPS_DMA)
+        && ((ident[ID_MWDMA] & 0x07) || (ident[ID_UDMA] & 0x7F));
+
+    /* Use the largest PIO block the drive supports. */
+    d->multiple = ident[ID_MULTIPLE] & 0xFF;
+    if (d->multiple > 1) {
+        outb(d->multiple, c->base + REG_COUNT);
+        outb(CMD_SET_MULTIPLE, c->base + REG_COMMAND);
+        if (poll(c, ST_BSY, 0) != 0
+                || (inb(c->base + REG_STATUS) & ST_ERR)) {
+            d->multiple = 1;
+        }
+    }
+    else {
+        d->multiple = 1;
+    }
+
+    return true;
+}
+
+static const struct blkdev_ops ata_ops = {
+    .transfer = ata_transfer
+};
+
+static void ata_transfer(struct blkdev *dev, struct request *req)
+{
+    struct ata_drive *d;
+    uint32_t eflags;
+
+    d = dev->private;
+
+    cli_save(eflags);
+    d->req = req;
+    if (d->chan->cur == NULL) {
+        start(d, req);
+    }
+    restore_flags(eflags);
+}
+
+/**
+ * Issues the command for a request.
+ * Interrupts must be disabled.
+ */
+static void start(struct ata_drive *d, struct request *req)
+{
+    struct ata_channel *c;
+    bool read;
+    uint8_t cmd;
+#ifdef __BENCH
+    uint64_t t0;
+
+    t0 = rdtsc();
+#endif
+
+    c = d->chan;
+    c->cur = d;
+    c->dma = use_dma && d->dma_ok && build_prdt(c, req) == 0;
+    read = (req->dir == BIO_READ);
+
+    select_drive(c, DRIVE_LBA | ((d->slave) ? DRIVE_SLAVE : 0)
+        | ((req->sector >> 24) & 0x0F));
+    outb(req->nr_sectors & 0xFF, c->base + REG_COUNT);    /* 0 means 256 */
+    outb(req->sector & 0xFF, c->base + REG_LBA0);
+    outb((req->sector >> 8) & 0xFF, c->base + REG_LBA1);
+    outb((req->sector >> 16) & 0xFF, c->base + REG_LBA2);
+
+    if (c->dma) {
+        cmd = (read) ? BM_CMD_READ : 0;
+        outl(virt_to_phys((uint32_t) c->prdt), c->bmide + BM_PRDT);
+        outb(cmd, c->bmide + BM_COMMAND);
+        outb(BM_ST_ERROR | BM_ST_IRQ, c->bmide + BM_STATUS);
+        outb((read) ? CMD_READ_DMA : CMD_WRITE_DMA, c->base + REG_COMMAND);
+        outb(cmd | BM_CMD_START, c->bmide + BM_COMMAND);
+        goto done;
+    }
+
+    c->left = req->nr_sectors;
+    c->bio = req->bio;
+    c->vec = 0;
+    c->off = 0;
+
+    if (d->multiple > 1) {
+        cmd = (read) ? CMD_READ_MULTIPLE : CMD_WRITE_MULTIPLE;
+    }
+    else {
+        cmd = (read) ? CMD_READ_SECTORS : CMD_WRITE_SECTORS;
+    }
+    outb(cmd, c->base + REG_COMMAND);
+
+    /* Writes don't interrupt until the first block is in. */
+    if (!read) {
+        if (poll(c, ST_BSY | ST_DRQ, ST_DRQ) != 0) {
+            finish(c, -1);
+            goto done;
+        }
+        pio_block(c);
+    }
+
+done:
+#ifdef __BENCH
+    busy_cycles += rdtsc() - t0;
+#endif
+    return;
+}
+
+/**
+ * Completes the channel's current request, then gives the channel to the
+ * other drive if it has a request waiting.
+ * Interrupts must be disabled.
+ */
+static void finish(struct ata_channel *c, int status)
+{
+    struct ata_drive *d;
+    struct ata_drive *other;
+    struct request *req;
+
+    d = c->cur;
+    req = d->req;
+    c->cur = NULL;
+    d->req = NULL;
+
+    other = c->drives[(d->slave) ? 0 : 1];
+    if (other != NULL && other->req != NULL) {
+        start(other, other->req);
+    }
+
+    blk_end_request(&d->dev, req, status);
+}
+
+/**
+ * Fills in the PRD table for a request.
+ *
+ * @return 0 on success, -1 if the buffers can't be used for DMA (e.g. an odd
+ *         address or too many pieces), in which case PIO is used instead
+ */
+static int build_prdt(struct ata_channel *c, struct request *req)
+{
+    struct bio *bio;
+    struct prd *prd;
+    uint32_t addr;
+    uint32_t len;
+    uint32_t phys;
+    uint32_t chunk;
+    uint32_t prd_len;
+    int n;
+    int i;
+
+    n = 0;
+    prd = NULL;
+    for (bio = req->bio; bio != NULL; bio = bio->next) {
+        for (i = 0; i < bio->nvecs; i++) {
+            addr = (uint32_t) bio->vecs[i].buf;
+            len = bio->vecs[i].len;
+            if (addr & 1) {
+                return -1;
+            }
+
+            /* Pages needn't be physically contiguous, so go a page at a
+               time, coalescing pages that are. */
+            while (len > 0) {
+                chunk = PAGE_SIZE - (addr & (PAGE_SIZE - 1));
+                if (chunk > len) {
+                    chunk = len;
+                }
+
+                phys = virt_to_phys(addr);
+                if (phys == 0) {
+                    return -1;
+                }
+
+                prd_len = (prd != NULL && prd->len == 0)
+                    ? PRD_BOUNDARY
+                    : (prd != NULL) ? prd->len : 0;
+                if (prd != NULL && prd->addr + prd_len == phys
+                        && (phys & (PRD_BOUNDARY - 1)) != 0) {
+                    prd->len = (prd_len + chunk) & 0xFFFF;
+                }
+                else {
+                    if (n == PRDT_LEN) {
+                        return -1;
+                    }
+                    prd = &c->prdt[n++];
+                    prd->addr = phys;
+                    prd->len = chunk;
+                    prd->flags = 0;
+                }
+
+                addr += chunk;
+                len -= chunk;
+            }
+        }
+    }
+
+    if (prd == NULL) {
+        return -1;
+    }
+    prd->flags = PRD_EOT;
+
+    return 0;
+}
+
+/**
+ * Moves the next block of sectors through the data port.
+ */
+static void pio_block(struct ata_channel *c)
+{
+    struct bio_vec *v;
+    uint32_t n;
+
+    n = c->cur->multiple;
+    if (n > c->left) {
+        n = c->left;
+    }
+    c->left -= n;
+
+    while (n-- > 0) {
+        v = &c->bio->vecs[c->vec];
+        if (c->cur->req->dir == BIO_READ) {
+            insw(c->base + REG_DATA, (uint8_t *) v->buf + c->off,
+                SECTOR_WORDS);
+        }
+        else {
+            outsw(c->base + REG_DATA, (uint8_t *) v->buf + c->off,
+                SECTOR_WORDS);
+        }
+
+        c->off += SECTOR_SIZE;
+        if (c->off == v->len) {
+            c->off = 0;
+            if (++c->vec == c->bio->nvecs) {
+                c->vec = 0;
+                c->bio = c->bio->next;
+            }
+        }
+    }
+}
+
+/**
+ * Writes the drive/head register, then waits the 400ns that the drive needs
+ * to put its status up.
+ */
+static void select_drive(struct ata_channel *c, uint8_t drive)
+{
+    int i;
+
+    outb(drive, c->base + REG_DRIVE);
+    for (i = 0; i < 4; i++) {
+        inb(c->ctrl + REG_DEVCTRL);
+    }
+}
+
+/**
+ * Busy-waits until the masked status bits read 'val'.
+ *
+ * @return 0 on success, -1 on timeout or if the drive reports an error
+ */
+static int poll(struct ata_channel *c, uint8_t mask, uint8_t val)
+{
+    uint8_t status;
+    int i;
+
+    for (i = 0; i < POLL_TIMEOUT; i++) {
+        status = inb(c->ctrl + REG_DEVCTRL);
+        if ((status & mask) == val) {
+            return 0;
+        }
+        if (!(status & ST_BSY) && (status & (ST_ERR | ST_DF))) {
+            return -1;
+        }
+    }
+
+    return -1;
+}
@@ -0,0 +1,201 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * Copyright (C) 2018 Wes Hampson. All Rights Reserved.                       *
+ *                                                                            *
+ * This file is part of the Lyra operating system.                            *
+ *                                                                            *
+ * Lyra is free software: you can redistribute it and/or modify               *
+ * it under the terms of version 2 of the GNU General Public License          *
+ * as published by the Free Software Foundation.                              *
+ *                                                                            *
+ * See LICENSE in the top-level directory for a copy of the license.          *
+ * You may also visit <https://www.gnu.org/licenses/gpl-2.0.txt>.             *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+/*-----------------------------------------------------------------------------
+ *   File: drivers/block/ramdisk.c
+ * Author: Wes Hampson
+ *   Desc: RAM disk block device.
+ *
+ * The disk is an array of pages, which don't need to be physically
+ * contiguous. An initrd is used where the bootloader left it; an empty disk
+ * gets its pages from the frame allocator. Requests are completed on the
+ * spot.
+ *----------------------------------------------------------------------------*/
+
+#include <string.h>
+#include <lyra/kernel.h>
+#include <lyra/block.h>
+#include <lyra/cpu.h>
+#include <lyra/memory.h>
+#include <drivers/ramdisk.h>
+
+#define RAMDISK_MAX_PAGES   (RAMDISK_MAX_SIZE >> PAGE_SHIFT)
+#define RAMDISK_MAX_SECTORS 256     /* per request; 128 KiB */
+
+#ifdef __BENCH
+#define BENCH_BATCH         8       /* pages per plug in ramdisk_bench() */
+#endif
+
+static void ramdisk_transfer(struct blkdev *dev, struct request *req);
+static void copy(uint32_t off, void *buf, uint32_t len, int dir);
+
+static const struct blkdev_ops ramdisk_ops = {
+    .transfer = ramdisk_transfer
+};
+
+static struct blkdev ramdisk = {
+    .name = "ram0",
+    .max_sectors = RAMDISK_MAX_SECTORS,
+    .ops = &ramdisk_ops
+};
+
+static uint32_t pages[RAMDISK_MAX_PAGES];
+
+void ramdisk_init(void)
+{
+    const struct boot_info *bi;
+    uint32_t size;
+    uint32_t npages;
+    uint32_t i;
+
+    bi = &boot_info;
+    size = bi->initrd_size;
+    if (size > INITRD_MAX_SIZE || size > RAMDISK_MAX_SIZE) {
+        kprintf_level(KLOG_WARN, "ram0: initrd too large (%lu bytes)\n", size);
+        size = 0;
+    }
+
+    if (size > 0) {
+        npages = (size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+        for (i = 0; i < npages; i++) {
+            pages[i] = bi->initrd_start + (i << PAGE_SHIFT);
+        }
+    }
+    else {
+        size = RAMDISK_DEFAULT_SIZE;
+        npages = size >> PAGE_SHIFT;
+        for (i = 0; i < npages; i++) {
+            pages[i] = frame_alloc(GFP_ZERO);
+            if (pages[i] == 0) {
+                break;
+            }
+        }
+        size = i << PAGE_SHIFT;
+    }
+
+    ramdisk.nr_sectors = size >> SECTOR_SHIFT;
+    if (ramdisk.nr_sectors > 0) {
+        blkdev_register(&ramdisk);
+    }
+}
+
+#ifdef __BENCH
+void ramdisk_bench(void)
+{
+    static const int batches[] = { 1, BENCH_BATCH };
+    struct bio bios[BENCH_BATCH];
+    uint32_t bufs[BENCH_BATCH];
+    uint32_t sector;
+    uint32_t requests;
+    uint64_t start;
+    uint64_t cycles;
+    int batch;
+    int b, i, n;
+
+    if (ramdisk.nr_sectors < (PAGE_SIZE >> SECTOR_SHIFT)) {
+        return;
+    }
+
+    for (i = 0; i < BENCH_BATCH; i++) {
+        bufs[i] = frame_alloc(0);
+        if (bufs[i] == 0) {
+            kprintf("ram0 bench: out of memory\n");
+            while (i-- > 0) {
+                frame_free(bufs[i]);
+            }
+            return;
+        }
+    }
+
+    for (b = 0; b < (int) (sizeof(batches) / sizeof(batches[0])); b++) {
+        batch = batches[b];
+        requests = ramdisk.stats.requests;
+        start = rdtsc();
+
+        sector = 0;
+        while (sector + (PAGE_SIZE >> SECTOR_SHIFT) <= ramdisk.nr_sectors) {
+            blk_plug(&ramdisk);
+            for (n = 0; n < batch
+                    && sector + (PAGE_SIZE >> SECTOR_SHIFT)
+                        <= ramdisk.nr_sectors; n++) {
+                bio_init(&bios[n], &ramdisk, BIO_READ, sector);
+                bio_add_buf(&bios[n], (void *) bufs[n], PAGE_SIZE);
+                submit_bio(&bios[n]);
+                sector += PAGE_SIZE >> SECTOR_SHIFT;
+            }
+            blk_unplug(&ramdisk);
+
+            for (i = 0; i < n; i++) {
+                bio_wait(&bios[i]);
+            }
+        }
+
+        cycles = rdtsc() - start;
+        div64(&cycles, ramdisk.nr_sectors >> (10 - SECTOR_SHIFT));
+        kprintf("ram0 bench: %d page(s) per plug: %lu requests, "
+            "%lu cycles/KiB\n",
+            batch, ramdisk.stats.requests - requests, (uint32_t) cycles);
+    }
+
+    for (i = 0; i < BENCH_BATCH; i++) {
+        frame_free(bufs[i]);
+    }
+}
+#endif
+
+static void ramdisk_transfer(struct blkdev *dev, struct request *req)
+{
+    struct bio *bio;
+    uint32_t off;
+    int i;
+
+    off = req->sector << SECTOR_SHIFT;
+    for (bio = req->bio; bio != NULL; bio = bio->next) {
+        for (i = 0; i < bio->nvecs; i++) {
+            copy(off, bio->vecs[i].buf, bio->vecs[i].len, req->dir);
+            off += bio->vecs[i].len;
+        }
+    }
+
+    blk_end_request(dev, req, 0);
+}
+
+/**
+ * Copies between a buffer and the disk, a page at a time.
+ */
+static void copy(uint32_t off, void *buf, uint32_t len, int dir)
+{
+    uint8_t *p;
+    uint8_t *page;
+    uint32_t n;
+
+    p = buf;
+    while (len > 0) {
+        page = (uint8_t *) pages[off >> PAGE_SHIFT] + (off & (PAGE_SIZE - 1));
+        n = PAGE_SIZE - (off & (PAGE_SIZE - 1));
+        if (n > len) {
+            n = len;
+        }
+
+        if (dir == BIO_READ) {
+            memcpy(p, page, n);
+        }
+        else {
+            memcpy(page, p, n);
+        }
+
+        p += n;
+        off += n;
+        len -= n;
+    }
+}
@@ -0,0 +1,714 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * Copyright (C) 2018 Wes Hampson. All Rights Reserved.                       *
+ *                                                                            *
+ * This file is part of the Lyra operating system.                            *
+ *                                                                            *
+ * Lyra is free software: you can redistribute it and/or modify               *
+ * it under the terms of version 2 of the GNU General Public License          *
+ * as published by the Free Software Foundation.                              *
+ *                                                                            *
+ * See LICENSE in the top-level directory for a copy of the license.          *
+ * You may also visit <https://www.gnu.org/licenses/gpl-2.0.txt>.             *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+/*-----------------------------------------------------------------------------
+ *   File: drivers/floppy/floppy.c
+ * Author: Wes Hampson
+ *   Desc: Floppy disk driver for the 82077AA (and compatible) controller.
+ *
+ * Data moves over ISA DMA channel 2, through a bounce buffer in low memory.
+ * Reads go a cylinder at a time: a single multi-track READ DATA command
+ * reads both tracks of the cylinder, which takes two revolutions of the
+ * disk no matter where the wanted sectors are, versus up to a revolution
+ * per sector when reading them one by one. The cylinders read are kept in
+ * a small LRU cache, so sequential reads only hit the disk once per
+ * cylinder. Writes go straight to the disk and update the cache.
+ *
+ * Requests are carried out synchronously in the transfer callback, waiting
+ * for the controller's interrupts with hlt, so interrupts must be enabled
+ * when I/O is submitted. Only the first drive is supported.
+ *----------------------------------------------------------------------------*/
+
+#include <string.h>
+#include <lyra/kernel.h>
+#include <lyra/block.h>
+#include <lyra/cpu.h>
+#include <lyra/interrupt.h>
+#include <lyra/io.h>
+#include <lyra/irq.h>
+#include <lyra/memory.h>
+#include <drivers/floppy.h>
+#include <drivers/timer.h>
+
+/* Controller registers. */
+#define PORT_DOR            0x3F2   /* digital output */
+#define PORT_MSR            0x3F4   /* main status (read) */
+#define PORT_FIFO           0x3F5
+#define PORT_CCR            0x3F7   /* configuration control (write) */
+
+#define DOR_NRESET          0x04
+#define DOR_DMA             0x08    /* DMA and IRQ enabled */
+#define DOR_MOTOR0          0x10
+
+#define MSR_DIO             0x40    /* FIFO expects a read */
+#define MSR_RQM             0x80    /* FIFO ready */
+
+/* Commands. */
+#define CMD_SPECIFY         0x03
+#define CMD_WRITE           0x05
+#define CMD_READ            0x06
+#define CMD_RECALIBRATE     0x07
+#define CMD_SENSE_INT       0x08
+#define CMD_SEEK            0x0F
+#define CMD_MT              0x80    /* multi-track: continue onto head 1 */
+#define CMD_MFM             0x40
+#define CMD_SK              0x20    /* skip deleted sectors */
+
+#define ST0_IC              0xC0    /* interrupt code; 0 is success */
+#define ST0_SE              0x20    /* seek end */
+
+#define SECTOR_CODE         2       /* 128 << 2 = 512 bytes */
+#define SPECIFY_SRT_HUT     0xDF    /* 3 ms step rate, 240 ms head unload */
+#define SPECIFY_HLT         0x02    /* 4 ms head load; DMA mode */
+#define NUM_HEADS           2
+
+/* ISA DMA controller (8237), channel 2. */
+#define DMA_ADDR            0x04
+#define DMA_COUNT           0x05
+#define DMA_MASK            0x0A
+#define DMA_MODE            0x0B
+#define DMA_FLIPFLOP        0x0C
+#define DMA_PAGE            0x81
+#define DMA_CHANNEL         2
+#define DMA_MASK_ON         0x04
+#define DMA_MODE_READ       0x44    /* single, increment, device to memory */
+#define DMA_MODE_WRITE      0x48    /* single, increment, memory to device */
+
+#define CMOS_FLOPPY         0x10    /* drive types; first drive in the top */
+
+/* Delays, in timer ticks (ms). */
+#define MOTOR_SPINUP        300
+#define MOTOR_IDLE          2000    /* turn the motor off after this long */
+#define HEAD_SETTLE         15
+#define IRQ_TIMEOUT         2000
+
+#define FIFO_TIMEOUT        100000
+#define RETRIES             3
+
+#define MAX_CYL_SECTORS     (36 * NUM_HEADS)
+#define MAX_TRACK_PAGES     ((MAX_CYL_SECTORS * SECTOR_SIZE + PAGE_SIZE - 1) \
+                             / PAGE_SIZE)
+
+#ifdef __BENCH
+#define BENCH_SECTORS       72
+#endif
+
+/* Drive types, as found in the CMOS. */
+struct fd_type {
+    const char *name;
+    uint8_t cyls;
+    uint8_t spt;                    /* sectors per track */
+    uint8_t rate;                   /* CCR data rate */
+    uint8_t gap;                    /* GAP3 length for reads/writes */
+};
+
+static const struct fd_type fd_types[] = {
+    { NULL,    0,  0,  0, 0    },
+    { "360K",  40, 9,  2, 0x2A },
+    { "1.2M",  80, 15, 0, 0x1B },
+    { "720K",  80, 9,  2, 0x1B },
+    { "1.44M", 80, 18, 0, 0x1B },
+    { "2.88M", 80, 36, 3, 0x1B }
+};
+
+/* A cylinder in the track cache. */
+struct track {
+    int cyl;                        /* -1 if empty */
+    uint32_t used;                  /* LRU clock when last used */
+    uint8_t *pages[MAX_TRACK_PAGES];
+};
+
+/* Where a request's buffers have been copied up to. */
+struct cursor {
+    struct bio *bio;
+    int vec;
+    uint32_t off;
+};
+
+static struct blkdev fd0;
+static const struct fd_type *type;
+static uint32_t cyl_sectors;
+static int cur_cyl;                 /* where the heads are; -1 if unknown */
+static bool need_reset = true;
+
+static volatile bool irq_fired;
+
+/* Ticks until the motor is turned off: -1 while it's in use, 0 if it's
+   off. */
+static volatile int motor_ticks;
+
+static struct track tracks[FLOPPY_CACHE_TRACKS];
+static int num_tracks;
+static uint32_t lru_clock;
+static bool use_cache = true;
+
+static const struct blkdev_ops floppy_ops;
+
+static void floppy_transfer(struct blkdev *dev, struct request *req);
+static struct track * get_track(int cyl);
+static int rw(int dir, int cyl, int head, int sector, uint32_t count);
+static int command(int dir, int cyl, int head, int sector, uint32_t count);
+static int seek(int cyl);
+static int recalibrate(void);
+static int reset(void);
+static void motor_on(void);
+static void motor_release(void);
+static void dma_setup(int dir, uint32_t len);
+static int wait_irq(void);
+static void sleep(uint32_t ticks);
+static int fifo_write(uint8_t data);
+static int fifo_read(uint8_t *data);
+static int sense_interrupt(uint8_t *st0, uint8_t *cyl);
+static void copy(struct cursor *c, uint8_t *buf, uint32_t len, bool to_req);
+
+static inline uint8_t * track_sector(struct track *t, uint32_t idx)
+{
+    return t->pages[idx / (PAGE_SIZE / SECTOR_SIZE)]
+        + (idx % (PAGE_SIZE / SECTOR_SIZE)) * SECTOR_SIZE;
+}
+
+void floppy_init(void)
+{
+    uint8_t drive_type;
+    uint32_t pages;
+    uint32_t i;
+    int t;
+
+    drive_type = cmos_read(CMOS_FLOPPY) >> 4;
+    if (drive_type == 0
+            || drive_type >= sizeof(fd_types) / sizeof(fd_types[0])) {
+        return;
+    }
+
+    type = &fd_types[drive_type];
+    cyl_sectors = type->spt * NUM_HEADS;
+    cur_cyl = -1;
+
+    pages = (cyl_sectors * SECTOR_SIZE + PAGE_SIZE - 1) / PAGE_SIZE;
+    for (t = 0; t < FLOPPY_CACHE_TRACKS; t++) {
+        tracks[t].cyl = -1;
+        for (i = 0; i < pages; i++) {
+            tracks[t].pages[i] = (uint8_t *) frame_alloc(0);
+            if (tracks[t].pages[i] == NULL) {
+                while (i-- > 0) {
+                    frame_free((uint32_t) tracks[t].pages[i]);
+                }
+                break;
+            }
+        }
+        if (i < pages) {
+            break;
+        }
+        num_tracks++;
+    }
+
+    strcpy(fd0.name, "fd0");
+    fd0.nr_sectors = type->cyls * cyl_sectors;
+    fd0.max_sectors = cyl_sectors;
+    fd0.ops = &floppy_ops;
+    blkdev_register(&fd0);
+    irq_enable(IRQ_FLOPPY);
+
+    kprintf("fd0: %s, %d cylinders cached\n", type->name, num_tracks);
+}
+
+#ifdef __BENCH
+void floppy_bench(void)
+{
+    static uint8_t buf[SECTOR_SIZE];
+    uint32_t sector;
+    uint32_t ticks;
+    uint64_t start;
+    uint64_t cycles;
+    int pass;
+    int t;
+
+    if (type == NULL) {
+        return;
+    }
+
+    for (pass = 0; pass < 2; pass++) {
+        use_cache = (pass == 1);
+        for (t = 0; t < num_tracks; t++) {
+            tracks[t].cyl = -1;
+        }
+
+        ticks = timer_ticks;
+        start = rdtsc();
+        for (sector = 0; sector < BENCH_SECTORS; sector++) {
+            if (blk_read(&fd0, sector, buf, 1) != 0) {
+                kprintf("fd0 bench: read error at sector %lu\n", sector);
+                break;
+            }
+        }
+        cycles = rdtsc() - start;
+        div64(&cycles, BENCH_SECTORS);
+        kprintf("fd0 bench: %s: %d sectors in %lu ms, %lu cycles/sector\n",
+            (use_cache) ? "track cache" : "sector at a time", BENCH_SECTORS,
+            timer_ticks - ticks, (uint32_t) cycles);
+    }
+
+    use_cache = true;
+}
+#endif
+
+void floppy_do_irq(void)
+{
+    irq_fired = true;
+}
+
+void floppy_timer(void)
+{
+    if (motor_ticks > 0 && --motor_ticks == 0) {
+        outb(DOR_NRESET | DOR_DMA, PORT_DOR);
+    }
+}
+
+static const struct blkdev_ops floppy_ops = {
+    .transfer = floppy_transfer
+};
+
+static void floppy_transfer(struct blkdev *dev, struct request *req)
+{
+    struct cursor cur;
+    struct track *t;
+    uint32_t sector;
+    uint32_t left;
+    uint32_t idx;
+    uint32_t n;
+    uint32_t i;
+    int cyl;
+    int status;
+
+    cur.bio = req->bio;
+    cur.vec = 0;
+    cur.off = 0;
+    sector = req->sector;
+    left = req->nr_sectors;
+    status = 0;
+
+    motor_on();
+    while (left > 0 && status == 0) {
+        cyl = sector / cyl_sectors;
+        idx = sector % cyl_sectors;
+        n = cyl_sectors - idx;
+        if (n > left) {
+            n = left;
+        }
+
+        /* Without any cache pages, read straight into the DMA buffer. */
+        if (req->dir == BIO_READ && use_cache && num_tracks > 0) {
+            t = get_track(cyl);
+            if (t == NULL) {
+                status = -1;
+                break;
+            }
+            for (i = 0; i < n; i++) {
+                copy(&cur, track_sector(t, idx + i), SECTOR_SIZE, true);
+            }
+        }
+        else if (req->dir == BIO_READ) {
+            status = rw(BIO_READ, cyl, idx / type->spt,
+                idx % type->spt + 1, n);
+            if (status == 0) {
+                copy(&cur, (uint8_t *) ISA_DMA_BUF, n * SECTOR_SIZE, true);
+            }
+        }
+        else {
+            copy(&cur, (uint8_t *) ISA_DMA_BUF, n * SECTOR_SIZE, false);
+            status = rw(BIO_WRITE, cyl, idx / type->spt,
+                idx % type->spt + 1, n);
+
+            /* Keep the cache in step with the disk. */
+            for (t = tracks; t < tracks + num_tracks; t++) {
+                if (t->cyl != cyl) {
+                    continue;
+                }
+                if (status != 0) {
+                    t->cyl = -1;
+                    break;
+                }
+                for (i = 0; i < n; i++) {
+                    memcpy(track_sector(t, idx + i),
+                        (uint8_t *) ISA_DMA_BUF + i * SECTOR_SIZE,
+                        SECTOR_SIZE);
+                }
+            }
+        }
+
+        sector += n;
+        left -= n;
+    }
+    motor_release();
+
+    blk_end_request(dev, req, status);
+}
+
+/**
+ * Finds a cylinder in the track cache, reading it in (over the least
+ * recently used one) if it's not there. The cache must have at least one
+ * track.
+ *
+ * @return the cached cylinder, or NULL on a read error
+ */
+static struct track * get_track(int cyl)
+{
+    struct track *victim;
+    struct track *t;
+    uint32_t i;
+
+    victim = &tracks[0];
+    for (t = tracks; t < tracks + num_tracks; t++) {
+        if (t->cyl == cyl) {
+            t->used = ++lru_clock;
+            return t;
+        }
+        if (t->used < victim->used) {
+            victim = t;
+        }
+    }
+
+    if (rw(BIO_READ, cyl, 0, 1, cyl_sectors) != 0) {
+        return NULL;
+    }
+
+    for (i = 0; i < cyl_sectors; i++) {
+        memcpy(track_sector(victim, i),
+            (uint8_t *) ISA_DMA_BUF + i * SECTOR_SIZE, SECTOR_SIZE);
+    }
+    victim->cyl = cyl;
+    victim->used = ++lru_clock;
+
+    return victim;
+}
+
+/**
+ * Reads or writes sectors of a cylinder, between the disk and the DMA
+ * buffer, retrying on errors.
+ *
+ * @param dir    - BIO_READ or BIO_WRITE
+ * @param cyl    - the cylinder
+ * @param head   - head of the first sector
+ * @param sector - first sector on the track (1-based)
+ * @param count  - number of sectors; may run on to head 1
+ * @return 0 on success, -1 on error
+ */
+static int rw(int dir, int cyl, int head, int sector, uint32_t count)
+{
+    int tries;
+
+    for (tries = 0; tries < RETRIES; tries++) {
+        if (need_reset && reset() != 0) {
+            continue;
+        }
+        if (seek(cyl) == 0 && command(dir, cyl, head, sector, count) == 0) {
+            return 0;
+        }
+
+        /* Start over from a known head position. */
+        if (recalibrate() != 0) {
+            need_reset = true;
+        }
+    }
+
+    kprintf_level(KLOG_ERR, "fd0: %s error at C/H/S %d/%d/%d\n",
+        (dir == BIO_READ) ? "read" : "write", cyl, head, sector);
+    return -1;
+}
+
+/**
+ * Issues a READ DATA or WRITE DATA command and waits for it. The command
+ * ends when the DMA controller reaches the end of the transfer.
+ */
+static int command(int dir, int cyl, int head, int sector, uint32_t count)
+{
+    uint8_t result[7];
+    uint8_t cmd;
+    int i;
+
+    dma_setup(dir, count * SECTOR_SIZE);
+
+    cmd = (dir == BIO_READ) ? (CMD_READ | CMD_SK) : CMD_WRITE;
+    irq_fired = false;
+    if (fifo_write(cmd | CMD_MT | CMD_MFM) != 0
+            || fifo_write(head << 2) != 0
+            || fifo_write(cyl) != 0
+            || fifo_write(head) != 0
+            || fifo_write(sector) != 0
+            || fifo_write(SECTOR_CODE) != 0
+            || fifo_write(type->spt) != 0
+            || fifo_write(type->gap) != 0
+            || fifo_write(0xFF) != 0) {
+        need_reset = true;
+        return -1;
+    }
+
+    if (wait_irq() != 0) {
+        need_reset = true;
+        return -1;
+    }
+
+    for (i = 0; i < 7; i++) {
+        if (fifo_read(&result[i]) != 0) {
+            need_reset = true;
+            return -1;
+        }
+    }
+
+    return (result[0] & ST0_IC) ? -1 : 0;
+}
+
+static int seek(int cyl)
+{
+    uint8_t st0;
+    uint8_t pcn;
+
+    if (cur_cyl == cyl) {
+        return 0;
+    }
+
+    irq_fired = false;
+    if (fifo_write(CMD_SEEK) != 0 || fifo_write(0) != 0
+            || fifo_write(cyl) != 0 || wait_irq() != 0
+            || sense_interrupt(&st0, &pcn) != 0) {
+        need_reset = true;
+        return -1;
+    }
+    if ((st0 & (ST0_IC | ST0_SE)) != ST0_SE || pcn != cyl) {
+        cur_cyl = -1;
+        return -1;
+    }
+
+    cur_cyl = cyl;
+    sleep(HEAD_SETTLE);
+    return 0;
+}
+
+static int recalibrate(void)
+{
+    uint8_t st0;
+    uint8_t pcn;
+    int tries;
+
+    /* The controller gives up after 77 steps, which isn't enough to get
+       back from the last cylinders of an 80-cylinder disk; hence twice. */
+    for (tries = 0; tries < 2; tries++) {
+        irq_fired = false;
+        if (fifo_write(CMD_RECALIBRATE) != 0 || fifo_write(0) != 0
+                || wait_irq() != 0 || sense_interrupt(&st0, &pcn) != 0) {
+            return -1;
+        }
+        if (!(st0 & ST0_IC) && pcn == 0) {
+            cur_cyl = 0;
+            return 0;
+        }
+    }
+
+    cur_cyl = -1;
+    return -1;
+}
+
+static int reset(void)
+{
+    uint8_t st0;
+    uint8_t pcn;
+    int i;
+
+    irq_fired = false;
+    outb_p(0, PORT_DOR);
+    outb(DOR_NRESET | DOR_DMA | ((motor_ticks != 0) ? DOR_MOTOR0 : 0),
+        PORT_DOR);
+    if (wait_irq() != 0) {
+        return -1;
+    }
+
+    /* One for each of the four drives the controller could have. */
+    for (i = 0; i < 4; i++) {
+        sense_interrupt(&st0, &pcn);
+    }
+
+    outb(type->rate, PORT_CCR);
+    if (fifo_write(CMD_SPECIFY) != 0 || fifo_write(SPECIFY_SRT_HUT) != 0
+            || fifo_write(SPECIFY_HLT) != 0) {
+        return -1;
+    }
+
+    need_reset = false;
+    cur_cyl = -1;
+    return recalibrate();
+}
+
+static void motor_on(void)
+{
+    uint32_t eflags;
+    bool off;
+
+    cli_save(eflags);
+    off = (motor_ticks == 0);
+    motor_ticks = -1;
+    restore_flags(eflags);
+
+    if (off) {
+        outb(DOR_NRESET | DOR_DMA | DOR_MOTOR0, PORT_DOR);
+        sleep(MOTOR_SPINUP);
+    }
+}
+
+static void motor_release(void)
+{
+    motor_ticks = MOTOR_IDLE;
+}
+
+/**
+ * Programs DMA channel 2 for a transfer to or from the DMA buffer.
+ */
+static void dma_setup(int dir, uint32_t len)
+{
+    uint32_t eflags;
+
+    cli_save(eflags);
+    outb(DMA_MASK_ON | DMA_CHANNEL, DMA_MASK);
+    outb(0xFF, DMA_FLIPFLOP);
+    outb(ISA_DMA_BUF & 0xFF, DMA_ADDR);
+    outb((ISA_DMA_BUF >> 8) & 0xFF, DMA_ADDR);
+    outb((ISA_DMA_BUF >> 16) & 0xFF, DMA_PAGE);
+    outb(0xFF, DMA_FLIPFLOP);
+    outb((len - 1) & 0xFF, DMA_COUNT);
+    outb(((len - 1) >> 8) & 0xFF, DMA_COUNT);
+    outb(((dir == BIO_READ) ? DMA_MODE_READ : DMA_MODE_WRITE) | DMA_CHANNEL,
+        DMA_MODE);
+    outb(DMA_CHANNEL, DMA_MASK);
+    restore_flags(eflags);
+}
+
+/**
+ * Sleeps until the controller interrupts.
+ *
+ * @return 0 on success, -1 on timeout
+ */
+static int wait_irq(void)
+{
+    uint32_t eflags;
+    uint32_t start;
+    int status;
+
+    start = timer_ticks;
+    status = 0;
+
+    /* sti only takes effect after the next instruction, so an interrupt
+       can't sneak in between the check and the hlt. */
+    cli_save(eflags);
+    while (!irq_fired) {
+        if (timer_ticks - start > IRQ_TIMEOUT) {
+            status = -1;
+            break;
+        }
+        __asm__ volatile ("sti; hlt; cli" : : : "memory");
+    }
+    irq_fired = false;
+    restore_flags(eflags);
+
+    return status;
+}
+
+static void sleep(uint32_t ticks)
+{
+    uint32_t eflags;
+    uint32_t start;
+
+    start = timer_ticks;
+    cli_save(eflags);
+    while (timer_ticks - start < ticks) {
+        __asm__ volatile ("sti; hlt; cli" : : : "memory");
+    }
+    restore_flags(eflags);
+}
+
+static int fifo_write(uint8_t data)
+{
+    int i;
+
+    for (i = 0; i < FIFO_TIMEOUT; i++) {
+        if ((inb(PORT_MSR) & (MSR_RQM | MSR_DIO)) == MSR_RQM) {
+            outb(data, PORT_FIFO);
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+static int fifo_read(uint8_t *data)
+{
+    int i;
+
+    for (i = 0; i < FIFO_TIMEOUT; i++) {
+        if ((inb(PORT_MSR) & (MSR_RQM | MSR_DIO)) == (MSR_RQM | MSR_DIO)) {
+            *data = inb(PORT_FIFO);
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+static int sense_interrupt(uint8_t *st0, uint8_t *cyl)
+{
+    if (fifo_write(CMD_SENSE_INT) != 0 || fifo_read(st0) != 0
+            || fifo_read(cyl) != 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Copies between a request's buffers and a flat buffer, moving the cursor
+ * along.
+ *
+ * @param c      - the cursor
+ * @param buf    - the flat buffer
+ * @param len    - number of bytes
+ * @param to_req - true to copy into the request's buffers
+ */
+static void copy(struct cursor *c, uint8_t *buf, uint32_t len, bool to_req)
+{
+    struct bio_vec *v;
+    uint32_t n;
+
+    while (len > 0 && c->bio != NULL) {
+        v = &c->bio->vecs[c->vec];
+        n = v->len - c->off;
+        if (n > len) {
+            n = len;
+        }
+
+        if (to_req) {
+            memcpy((uint8_t *) v->buf + c->off, buf, n);
+        }
+        else {
+            memcpy(buf, (uint8_t *) v->buf + c->off, n);
+        }
+
+        buf += n;
+        len -= n;
+        c->off += n;
+        if (c->off == v->len) {
+            c->off = 0;
+            if (++c->vec == c->bio->nvecs) {
+                c->vec = 0;
+                c->bio = c->bio->next;
+            }
+        }
+    }
+}
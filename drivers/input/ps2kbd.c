@@ -19,8 +19,11 @@
 
 #include <lyra/kernel.h>
 #include <lyra/input.h>
+#include <lyra/interrupt.h>
 #include <lyra/io.h>
+#include <lyra/irq.h>
 #include <drivers/ps2kbd.h>
+#include <drivers/timer.h>
 
 /* PS/2 keyboard and controller I/O ports. */
 #define PORT_KBD            0x60    /* PS/2 keyboard I/O */
@@ -100,17 +103,82 @@
 #define KBD_CFG_LEDNUM      0x02
 #define KBD_CFG_LEDCAPS     0x04
 
-/* Response codes for kbd_sendcmd() */
-#define SENDCMD_SUCCESS     0
-#define SENDCMD_ERROR       1
-#define SENDCMD_TIMEOUT     2
-
 /* Data sent by keyboard when a key is released. */
 #define SC3_BREAK           0xF0
 
-/* kbd_sendcmd() retry count before SENDCMD_TIMEOUT is returned. */
+/* Resends of a keyboard command before giving up on it. */
 #define NUM_RETRIES         3
 
+/* How many times to poll the controller's status register before giving up
+   on it. Each poll takes about a microsecond on the ISA bus. */
+#define CTL_TIMEOUT         100000
+
+/* How long to wait for the keyboard to respond to a command, in timer ticks
+   (ms). The keyboard's self-test can take the better part of a second. */
+#define ACK_TIMEOUT         100
+#define REPLY_TIMEOUT       1000
+
+/* Keyboard command flags. */
+#define CMD_ARG             0x01    /* argument to the previous command */
+#define CMD_REPLY           0x02    /* a reply byte follows the ACK */
+#define CMD_ABORT           0x04    /* drop the rest of the queue on failure */
+
+/* What the command at the head of the queue is waiting for. */
+#define CMD_IDLE            0
+#define CMD_WAIT_ACK        1
+#define CMD_WAIT_REPLY      2
+
+/* Number of keyboard commands that can be queued; must be a power of 2. */
+#define CMDQ_LEN            16
+
+#define SC3_ERR             "PS/2 keyboard: failed to switch to scancode 3!"
+
+/**
+ * A command (or command argument) for the keyboard, and the response to
+ * expect after the ACK.
+ */
+struct kbd_cmd {
+    uint8_t cmd;
+    uint8_t flags;              /* CMD_* flags */
+    uint8_t reply;              /* expected reply, if CMD_REPLY */
+    const char *err;            /* logged on failure; NULL to ignore it */
+};
+
+/**
+ * Resets the keyboard, then configures it to transmit scancodes from
+ * scancode set 3.
+ */
+static const struct kbd_cmd kbd_setup[] =
+{
+    { KBD_CMD_SELFTEST, CMD_REPLY, KBD_RES_TESTPASS,
+        "PS/2 keyboard self-test failed!" },
+
+    /* set scancode, then read it back for sanity */
+    { KBD_CMD_SCANCODE, CMD_ABORT, 0, SC3_ERR },
+    { KBD_CFG_SC3, CMD_ARG | CMD_ABORT, 0, SC3_ERR },
+    { KBD_CMD_SCANCODE, CMD_ABORT, 0, SC3_ERR },
+    { KBD_CFG_GETSC, CMD_ARG | CMD_REPLY | CMD_ABORT, KBD_CFG_SC3, SC3_ERR },
+
+    /* set make/break/repeat and enable scanning
+       some keyboards (QEMU) don't support the make/break/repeat command... */
+    { KBD_CMD_MKBRKTYPM, 0, 0, NULL },
+    { KBD_CMD_SCANON, 0, 0, NULL },
+};
+
+#define NUM_SETUP_CMDS      (sizeof(kbd_setup) / sizeof(kbd_setup[0]))
+
+/* Keyboard commands waiting to go out. They're sent one at a time; the
+   keyboard's responses are picked up by ps2kbd_do_irq(), and ps2kbd_timer()
+   gives up on a command if the keyboard doesn't respond in time. */
+static struct {
+    struct kbd_cmd q[CMDQ_LEN];
+    uint32_t head;              /* the command in flight, if any */
+    uint32_t tail;              /* where the next command goes */
+    int state;                  /* CMD_* state of the head command */
+    int retries;                /* resends of the head command */
+    uint32_t since;             /* timer_ticks when the wait started */
+} cmdq;
+
 /**
  * Mapping of physical scancodes to virtual scancodes for "scancode set 3", as
  * it's known.
@@ -144,30 +212,35 @@ static const scancode_t SCANCODE3[256] =
 /*F0-FF*/  0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0
 };
 
-static void ctl_outb(uint8_t data);
-static void kbd_outb(uint8_t data);
-static uint8_t kbd_inb(void);
-static int kbd_sendcmd(uint8_t cmd);
+static int ctl_outb(uint8_t data);
+static int kbd_outb(uint8_t data);
+static int kbd_inb(void);
+static int ctl_cmd(uint8_t cmd);
 static void kbd_flush(void);
-static void ctl_test(void);
-static void kbd_test(void);
-static void kbd_cli(void);
+static int kbd_queue(const struct kbd_cmd *cmd);
+static bool cmd_rx(uint8_t data);
+static void cmd_send(void);
+static void cmd_drop(int data);
 static void kbd_sti(void);
-static void kbd_sc3init(void);
 static void kbd_setled(int num, int caps, int scrl);
 
 void ps2kbd_init(void)
 {
-    uint8_t data;
+    int data;
+    uint32_t i;
 
     /* disable ports */
-    ctl_outb(CTL_CMD_P1OFF);
+    if (ctl_outb(CTL_CMD_P1OFF) < 0) {
+        goto ctl_fail;
+    }
     ctl_outb(CTL_CMD_P2OFF);
     kbd_flush();
 
     /* disable interrupts and translation */
-    ctl_outb(CTL_CMD_RDCFG);
-    data = kbd_inb();
+    data = ctl_cmd(CTL_CMD_RDCFG);
+    if (data < 0) {
+        goto ctl_fail;
+    }
     data &= ~CTL_CFG_P1INT;
     data &= ~CTL_CFG_P2INT;
     data &= ~CTL_CFG_P1XLATE;
@@ -176,13 +249,47 @@ void ps2kbd_init(void)
     kbd_outb(data);
 
     /* perform controller tests */
-    ctl_test();
+    if (ctl_cmd(CTL_CMD_SELFTEST) != CTL_RES_TESTPASS) {
+        kprintf_level(KLOG_ERR, "PS/2 controller self-test failed!\n");
+    }
+    if (ctl_cmd(CTL_CMD_P1TEST) != 0x00) {
+        kprintf_level(KLOG_ERR, "PS/2 controller port 1 test failed!\n");
+    }
 
-    /* init keyboard */
+    /* The keyboard is a lot slower than the controller, so the rest is
+       interrupt-driven. */
     ctl_outb(CTL_CMD_P1ON);
-    kbd_test();
-    kbd_sc3init();
-    kbd_setled(0, 0, 0);        /* enables keyboard interrupts */
+    kbd_sti();
+    irq_enable(IRQ_KEYBOARD);
+
+    for (i = 0; i < NUM_SETUP_CMDS; i++) {
+        kbd_queue(&kbd_setup[i]);
+    }
+    kbd_setled(0, 0, 0);
+    return;
+
+ctl_fail:
+    kprintf_level(KLOG_ERR, "PS/2 controller not responding!\n");
+}
+
+bool ps2kbd_poll(void)
+{
+    return cmdq.state == CMD_IDLE;
+}
+
+void ps2kbd_timer(void)
+{
+    uint32_t timeout;
+
+    if (cmdq.state == CMD_IDLE) {
+        return;
+    }
+
+    timeout = (cmdq.state == CMD_WAIT_ACK) ? ACK_TIMEOUT : REPLY_TIMEOUT;
+    if (timer_ticks - cmdq.since > timeout) {
+        cmd_drop(-1);
+        cmd_send();
+    }
 }
 
 void ps2kbd_do_irq(void)
@@ -200,26 +307,28 @@ void ps2kbd_do_irq(void)
     scancode_t sc;
     struct keystroke k = { 0 };
 
-    /* Disable keyboard */
-    ctl_outb(CTL_CMD_P1OFF);
-
-    /* Read raw scancode from keyboard */
+    /* Read raw scancode from keyboard, unless it's a response to a command.
+       The keyboard stays enabled throughout, since the next command may go
+       out from in here. */
     kb_data = inb(PORT_KBD);
+    if (cmd_rx(kb_data)) {
+        return;
+    }
     if (kb_data == KBD_RES_ERROR1 || kb_data == KBD_RES_ERROR2) {
-        kprintf("Keyboard error! (%02x)\n", kb_data);
-        goto irq_cleanup;
+        kprintf_level(KLOG_ERR, "Keyboard error! (%02x)\n", kb_data);
+        return;
     }
     else if (kb_data == SC3_BREAK) {
         /* Key was released.
            Next interrupt will have scancode of released key. */
         evt_keyrelease = 1;
-        goto irq_cleanup;
+        return;
     }
 
     /* Convert to virtual scancode */
     sc = SCANCODE3[kb_data];
     if (sc == 0) {
-        goto irq_cleanup;
+        return;
     }
 
     /* Handle modifier and toggle keys */
@@ -268,91 +377,77 @@ void ps2kbd_do_irq(void)
     sendkey(encode_keystroke(k));
 
     evt_keyrelease = 0;
-
-irq_cleanup:
-    /* Re-enable keyboard. */
-    ctl_outb(CTL_CMD_P1ON);
 }
 
 /**
  * Output a byte to the PS/2 controller.
  * @param data - the byte to output
+ * @return 0 on success, -1 if the controller isn't taking input
  */
-static void ctl_outb(uint8_t data)
+static int ctl_outb(uint8_t data)
 {
+    int i;
+
     /* Poll status register,
        wait until input buffer is empty before writing */
-    while (inb(PORT_CTL) & CTL_STS_INFULL);
-    outb(data, PORT_CTL);
+    for (i = 0; i < CTL_TIMEOUT; i++) {
+        if (!(inb(PORT_CTL) & CTL_STS_INFULL)) {
+            outb(data, PORT_CTL);
+            return 0;
+        }
+    }
+    return -1;
 }
 
 /**
  * Output a byte to the PS/2 keyboard.
  * @param data - the byte to output
+ * @return 0 on success, -1 if the controller isn't taking input
  */
-static void kbd_outb(uint8_t data)
+static int kbd_outb(uint8_t data)
 {
+    int i;
+
     /* Poll status register,
        wait until input buffer is empty before writing */
-    while (inb(PORT_CTL) & CTL_STS_INFULL);
-    outb(data, PORT_KBD);
+    for (i = 0; i < CTL_TIMEOUT; i++) {
+        if (!(inb(PORT_CTL) & CTL_STS_INFULL)) {
+            outb(data, PORT_KBD);
+            return 0;
+        }
+    }
+    return -1;
 }
 
 /**
- * Read a byte from the PS/2 keyboard.
- * @return a byte from the keyboard
+ * Read a byte from the PS/2 controller's output buffer.
+ * @return the byte, or -1 if none arrived in time
  */
-static uint8_t kbd_inb(void)
+static int kbd_inb(void)
 {
+    int i;
+
     /* Poll status register,
        wait until output buffer is full before reading */
-    while (!(inb(PORT_CTL) & CTL_STS_OUTFULL));
-    return inb(PORT_KBD);
+    for (i = 0; i < CTL_TIMEOUT; i++) {
+        if (inb(PORT_CTL) & CTL_STS_OUTFULL) {
+            return inb(PORT_KBD);
+        }
+    }
+    return -1;
 }
 
 /**
- * Send a command to the PS/2 keyboard.
- * @param cmd - the keyboard command word (one of KBD_CMD_*)
- * @return SENDCMD_SUCCESS when a command is successfully issued
- *         SENDCMD_ERROR   if the keyboard responds with an error
- *         SENDCMD_TIMEOUT if the keyboard asks to reissue the command too many times
+ * Send a command to the PS/2 controller and read its response.
+ * @param cmd - the controller command word (one of CTL_CMD_*)
+ * @return the response, or -1 if the controller didn't respond
  */
-static int kbd_sendcmd(uint8_t cmd)
+static int ctl_cmd(uint8_t cmd)
 {
-    int i;
-    int retval;
-    uint8_t data;
-
-    i = 0;
-    retval = SENDCMD_ERROR;
-    do {
-        kbd_outb(cmd);
-        data = kbd_inb();
-
-        switch (data) {
-            case KBD_RES_ACK:
-                retval = SENDCMD_SUCCESS;
-                goto sendcmd_done;
-            case KBD_RES_RESEND:
-                break;
-            case KBD_RES_ERROR1:
-            case KBD_RES_ERROR2:
-                retval = SENDCMD_ERROR;
-                goto sendcmd_done;
-            default:
-                kprintf("Keyboard sent unrecognized response! (%02x)\n", data);
-                retval = SENDCMD_ERROR;
-                goto sendcmd_done;
-        }
-        i++;
-    } while (i < NUM_RETRIES);
-
-    if (i == NUM_RETRIES) {
-        retval = SENDCMD_TIMEOUT;
+    if (ctl_outb(cmd) < 0) {
+        return -1;
     }
-
-sendcmd_done:
-    return retval;
+    return kbd_inb();
 }
 
 /**
@@ -361,138 +456,175 @@ sendcmd_done:
 static void kbd_flush(void)
 {
     while (inb(PORT_CTL) & CTL_STS_OUTFULL) {
-        (void)kbd_inb();
+        (void) inb(PORT_KBD);
     }
 }
 
 /**
- * Perform PS/2 controller self-test and test keyboard port.
+ * Queue a command for the keyboard. It goes out right away if the keyboard
+ * isn't busy with another one.
+ * @param cmd - the command
+ * @return 0 on success, -1 if the queue is full
  */
-static void ctl_test(void)
+static int kbd_queue(const struct kbd_cmd *cmd)
 {
-    uint8_t data;
+    uint32_t flags;
 
-    /* controller self-test */
-    ctl_outb(CTL_CMD_SELFTEST);
-    data = kbd_inb();
-    if (data != CTL_RES_TESTPASS) {
-        kprintf("PS/2 controller self-test failed!\n");
+    cli_save(flags);
+    if (cmdq.tail - cmdq.head == CMDQ_LEN) {
+        restore_flags(flags);
+        return -1;
     }
 
-    /* port tests */
-    ctl_outb(CTL_CMD_P1TEST);
-    data = kbd_inb();
-    if (data != 0x00) {
-        kprintf("PS/2 controller port 1 test failed!\n");
+    cmdq.q[cmdq.tail++ & (CMDQ_LEN - 1)] = *cmd;
+    if (cmdq.state == CMD_IDLE) {
+        cmd_send();
     }
+    restore_flags(flags);
+
+    return 0;
 }
 
 /**
- * Perform keyboard self-test.
+ * Handle a byte from the keyboard if it's a response to the command in
+ * flight. Called with interrupts off.
+ * @param data - the byte from the keyboard
+ * @return true if the byte was a response; false if it's a scancode
  */
-static void kbd_test(void)
+static bool cmd_rx(uint8_t data)
 {
-    uint8_t data;
+    const struct kbd_cmd *cmd;
+
+    cmd = &cmdq.q[cmdq.head & (CMDQ_LEN - 1)];
+    switch (cmdq.state) {
+        case CMD_WAIT_ACK:
+            if (data == KBD_RES_ACK) {
+                if (cmd->flags & CMD_REPLY) {
+                    cmdq.state = CMD_WAIT_REPLY;
+                    cmdq.since = timer_ticks;
+                    return true;
+                }
+                break;
+            }
+            if (data != KBD_RES_RESEND) {
+                return false;
+            }
+            if (++cmdq.retries < NUM_RETRIES && kbd_outb(cmd->cmd) == 0) {
+                cmdq.since = timer_ticks;
+                return true;
+            }
+            cmd_drop(data);
+            cmd_send();
+            return true;
+
+        case CMD_WAIT_REPLY:
+            if (data != cmd->reply) {
+                cmd_drop(data);
+                cmd_send();
+                return true;
+            }
+            break;
 
-    /* keyboard self-test */
-    if (kbd_sendcmd(KBD_CMD_SELFTEST) != SENDCMD_SUCCESS) {
-        kprintf("Failed to start PS/2 keyboard self-test!\n");
+        default:
+            return false;
     }
 
-    data = kbd_inb();
-    if (data != KBD_RES_TESTPASS) {
-        kprintf("PS/2 keyboard self-test failed! (%02x)\n", data);
-    }
+    /* Done with this one. */
+    cmdq.head++;
+    cmd_send();
+    return true;
 }
 
 /**
- * Disable keyboard interrupts.
+ * Send the command at the head of the queue, if there is one. Called with
+ * interrupts off.
  */
-static void kbd_cli(void)
+static void cmd_send(void)
 {
-    uint8_t data;
-
-    ctl_outb(CTL_CMD_RDCFG);
-    data = kbd_inb();
-    data &= ~CTL_CFG_P1INT;
-    ctl_outb(CTL_CMD_WRCFG);
-    kbd_outb(data);
+    cmdq.retries = 0;
+    while (cmdq.head != cmdq.tail) {
+        if (kbd_outb(cmdq.q[cmdq.head & (CMDQ_LEN - 1)].cmd) == 0) {
+            cmdq.state = CMD_WAIT_ACK;
+            cmdq.since = timer_ticks;
+            return;
+        }
+        cmd_drop(-1);
+    }
+    cmdq.state = CMD_IDLE;
 }
 
 /**
- * Enable keyboard interrupts.
+ * Give up on the command at the head of the queue, along with its
+ * arguments; or on the whole queue, if the command says so. Called with
+ * interrupts off.
+ * @param data - the unexpected response, or -1 if there wasn't one
  */
-static void kbd_sti(void)
+static void cmd_drop(int data)
 {
-    uint8_t data;
-
-    ctl_outb(CTL_CMD_RDCFG);
-    data = kbd_inb();
-    data |= CTL_CFG_P1INT;
-    ctl_outb(CTL_CMD_WRCFG);
-    kbd_outb(data);
-}
+    const struct kbd_cmd *cmd;
 
-/**
- * Tell keyboard to send scancodes using scancode set 3.
- */
-static void kbd_sc3init(void)
-{
-    /* set scancode */
-    if (kbd_sendcmd(KBD_CMD_SCANCODE) != SENDCMD_SUCCESS) {
-        goto sc3_fail;
+    cmd = &cmdq.q[cmdq.head & (CMDQ_LEN - 1)];
+    if (cmd->err != NULL && data < 0) {
+        kprintf_level(KLOG_ERR, "%s (timed out)\n", cmd->err);
     }
-    if (kbd_sendcmd(KBD_CFG_SC3) != SENDCMD_SUCCESS) {
-        goto sc3_fail;
+    else if (cmd->err != NULL) {
+        kprintf_level(KLOG_ERR, "%s (%02x)\n", cmd->err, data);
     }
 
-    /* read back scancode for sanity */
-    if (kbd_sendcmd(KBD_CMD_SCANCODE) != SENDCMD_SUCCESS) {
-        goto sc3_fail;
+    if (cmd->flags & CMD_ABORT) {
+        cmdq.head = cmdq.tail;
+        return;
     }
-    if (kbd_sendcmd(KBD_CFG_GETSC) != SENDCMD_SUCCESS) {
-        goto sc3_fail;
-    }
-    if (kbd_inb() != KBD_CFG_SC3) {
-        goto sc3_fail;
+
+    cmdq.head++;
+    while (cmdq.head != cmdq.tail
+            && (cmdq.q[cmdq.head & (CMDQ_LEN - 1)].flags & CMD_ARG)) {
+        cmdq.head++;
     }
+}
 
-    /* set make/break/repeat and enable scanning
-       some keyboards (QEMU) don't support the make/break/repeat command... */
-    kbd_sendcmd(KBD_CMD_MKBRKTYPM);
-    kbd_sendcmd(KBD_CMD_SCANON);
-    return;
+/**
+ * Enable keyboard interrupts.
+ */
+static void kbd_sti(void)
+{
+    int data;
 
-sc3_fail:
-    kprintf("PS/2 keyboard: failed to switch to scancode 3!\n");
+    data = ctl_cmd(CTL_CMD_RDCFG);
+    if (data < 0) {
+        return;
+    }
+    data |= CTL_CFG_P1INT;
+    ctl_outb(CTL_CMD_WRCFG);
+    kbd_outb(data);
 }
 
 /**
- * Set the states of the NUMLOCK, CAPSLOCK, and SCRLOCK lights.
+ * Set the states of the NUMLOCK, CAPSLOCK, and SCRLOCK lights. The update
+ * is queued, so this is safe to call from the keyboard IRQ handler.
  * @param num  - numlock state
  * @param caps - capslock state
  * @param scrl - scrlock state
  */
 static void kbd_setled(int num, int caps, int scrl)
 {
-    uint8_t data;
-
-    kbd_cli();
-    data = 0;
-    data |= (num)  ? KBD_CFG_LEDNUM  : 0;
-    data |= (caps) ? KBD_CFG_LEDCAPS : 0;
-    data |= (scrl) ? KBD_CFG_LEDSCRL : 0;
-
-    if (kbd_sendcmd(KBD_CMD_SETLED) != SENDCMD_SUCCESS) {
-        goto setled_fail;
-    }
-    if (kbd_sendcmd(data) != SENDCMD_SUCCESS) {
-        goto setled_fail;
+    struct kbd_cmd cmd = { KBD_CMD_SETLED, 0, 0,
+        "Failed to set PS/2 keyboard LEDs!" };
+    uint32_t flags;
+
+    /* The command and its argument go in together, or not at all. */
+    cli_save(flags);
+    if (cmdq.tail - cmdq.head > CMDQ_LEN - 2) {
+        restore_flags(flags);
+        return;
     }
-    goto setled_done;
 
-setled_fail:
-    kprintf("Failed to set PS/2 keyboard LEDs!\n");
-setled_done:
-    kbd_sti();
+    kbd_queue(&cmd);
+    cmd.cmd = 0;
+    cmd.cmd |= (num)  ? KBD_CFG_LEDNUM  : 0;
+    cmd.cmd |= (caps) ? KBD_CFG_LEDCAPS : 0;
+    cmd.cmd |= (scrl) ? KBD_CFG_LEDSCRL : 0;
+    cmd.flags = CMD_ARG;
+    kbd_queue(&cmd);
+    restore_flags(flags);
 }
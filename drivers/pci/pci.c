@@ -0,0 +1,104 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * Copyright (C) 2018 Wes Hampson. All Rights Reserved.                       *
+ *                                                                            *
+ * This file is part of the Lyra operating system.                            *
+ *                                                                            *
+ * Lyra is free software: you can redistribute it and/or modify               *
+ * it under the terms of version 2 of the GNU General Public License          *
+ * as published by the Free Software Foundation.                              *
+ *                                                                            *
+ * See LICENSE in the top-level directory for a copy of the license.          *
+ * You may also visit <https://www.gnu.org/licenses/gpl-2.0.txt>.             *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+/*-----------------------------------------------------------------------------
+ *   File: drivers/pci/pci.c
+ * Author: Wes Hampson
+ *   Desc: PCI configuration space access, using configuration mechanism #1.
+ *----------------------------------------------------------------------------*/
+
+#include <lyra/interrupt.h>
+#include <lyra/io.h>
+#include <drivers/pci.h>
+
+#define PORT_CONFIG_ADDR    0xCF8
+#define PORT_CONFIG_DATA    0xCFC
+
+#define CONFIG_ENABLE       0x80000000
+
+#define NUM_BUSES           256
+#define NUM_DEVS            32
+#define NUM_FUNCS           8
+
+#define HEADER_MULTIFUNC    0x80    /* in PCI_HEADER_TYPE */
+
+static inline uint32_t config_addr(const struct pci_addr *addr, uint8_t reg)
+{
+    return CONFIG_ENABLE | (addr->bus << 16) | (addr->dev << 11)
+        | (addr->func << 8) | (reg & 0xFC);
+}
+
+uint32_t pci_read(const struct pci_addr *addr, uint8_t reg)
+{
+    uint32_t eflags;
+    uint32_t val;
+
+    cli_save(eflags);
+    outl(config_addr(addr, reg), PORT_CONFIG_ADDR);
+    val = inl(PORT_CONFIG_DATA);
+    restore_flags(eflags);
+
+    return val;
+}
+
+void pci_write(const struct pci_addr *addr, uint8_t reg, uint32_t val)
+{
+    uint32_t eflags;
+
+    cli_save(eflags);
+    outl(config_addr(addr, reg), PORT_CONFIG_ADDR);
+    outl(val, PORT_CONFIG_DATA);
+    restore_flags(eflags);
+}
+
+bool pci_find_class(uint8_t class, uint8_t subclass, struct pci_addr *addr)
+{
+    uint32_t bus, dev, func;
+    uint32_t nfuncs;
+    uint32_t id;
+    uint32_t class_rev;
+
+    for (bus = 0; bus < NUM_BUSES; bus++) {
+        for (dev = 0; dev < NUM_DEVS; dev++) {
+            addr->bus = bus;
+            addr->dev = dev;
+            addr->func = 0;
+
+            id = pci_read(addr, PCI_VENDOR_ID);
+            if ((id & 0xFFFF) == 0xFFFF) {
+                continue;       /* nothing in this slot */
+            }
+
+            nfuncs = 1;
+            if ((pci_read(addr, PCI_HEADER_TYPE & 0xFC) >> 16)
+                    & HEADER_MULTIFUNC) {
+                nfuncs = NUM_FUNCS;
+            }
+
+            for (func = 0; func < nfuncs; func++) {
+                addr->func = func;
+                if ((pci_read(addr, PCI_VENDOR_ID) & 0xFFFF) == 0xFFFF) {
+                    continue;
+                }
+
+                class_rev = pci_read(addr, PCI_CLASS_REV);
+                if ((class_rev >> 24) == class
+                        && ((class_rev >> 16) & 0xFF) == subclass) {
+                    return true;
+                }
+            }
+        }
+    }
+
+    return false;
+}
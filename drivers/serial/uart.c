@@ -0,0 +1,471 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * Copyright (C) 2018 Wes Hampson. All Rights Reserved.                       *
+ *                                                                            *
+ * This file is part of the Lyra operating system.                            *
+ *                                                                            *
+ * Lyra is free software: you can redistribute it and/or modify               *
+ * it under the terms of version 2 of the GNU General Public License          *
+ * as published by the Free Software Foundation.                              *
+ *                                                                            *
+ * See LICENSE in the top-level directory for a copy of the license.          *
+ * You may also visit <https://www.gnu.org/licenses/gpl-2.0.txt>.             *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+/*-----------------------------------------------------------------------------
+ *   File: drivers/serial/uart.c
+ * Author: Wes Hampson
+ *   Desc: 16550A UART driver for the COM1-COM4 serial ports.
+ *
+ * Transmit and receive are both interrupt-driven. The transmit interrupt is
+ * only enabled while the TTY's write queue has data in it; each time the
+ * transmit FIFO empties, it's refilled with up to a FIFO's worth of
+ * characters, so one interrupt moves 16 bytes instead of one.
+ *
+ * COM1 also mirrors the kernel log. Log text goes through its own transmit
+ * ring rather than the TTY write queue, so the logger never has to wait for
+ * the line; the ring is drained ahead of the TTY queue by the same interrupt.
+ *----------------------------------------------------------------------------*/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <lyra/kernel.h>
+#include <lyra/cpu.h>
+#include <lyra/interrupt.h>
+#include <lyra/io.h>
+#include <lyra/irq.h>
+#include <drivers/timer.h>
+#include <drivers/uart.h>
+
+/* UART input clock divided by 16 */
+#define UART_CLOCK      115200
+
+/* Register offsets from the port base */
+#define REG_RBR         0       /* receive buffer (read, DLAB = 0) */
+#define REG_THR         0       /* transmit holding (write, DLAB = 0) */
+#define REG_DLL         0       /* divisor latch low (DLAB = 1) */
+#define REG_IER         1       /* interrupt enable (DLAB = 0) */
+#define REG_DLM         1       /* divisor latch high (DLAB = 1) */
+#define REG_IIR         2       /* interrupt identification (read) */
+#define REG_FCR         2       /* FIFO control (write) */
+#define REG_LCR         3       /* line control */
+#define REG_MCR         4       /* modem control */
+#define REG_LSR         5       /* line status */
+#define REG_MSR         6       /* modem status */
+#define REG_SCR         7       /* scratch */
+
+/* Interrupt enable register bitfields */
+#define IER_RDA         0x01    /* received data available */
+#define IER_THRE        0x02    /* transmit holding register empty */
+#define IER_RLS         0x04    /* receiver line status */
+
+/* Interrupt identification register bitfields */
+#define IIR_NOINT       0x01    /* no interrupt pending */
+#define IIR_ID          0x0E    /* interrupt ID mask */
+#define IIR_MS          0x00    /* modem status change */
+#define IIR_THRE        0x02    /* transmit holding register empty */
+#define IIR_RDA         0x04    /* received data available */
+#define IIR_RLS         0x06    /* receiver line status */
+#define IIR_TIMEOUT     0x0C    /* character timeout (FIFO mode) */
+#define IIR_FIFO        0xC0    /* FIFOs enabled and working (16550A) */
+
+/* FIFO control register bitfields */
+#define FCR_ENABLE      0x01    /* enable FIFOs */
+#define FCR_CLR_RX      0x02    /* clear receive FIFO */
+#define FCR_CLR_TX      0x04    /* clear transmit FIFO */
+#define FCR_TRIG_14     0xC0    /* receive interrupt at 14 bytes */
+
+/* Line control register bitfields */
+#define LCR_8N1         0x03    /* 8 data bits, no parity, 1 stop bit */
+#define LCR_DLAB        0x80    /* divisor latch access */
+
+/* Modem control register bitfields */
+#define MCR_DTR         0x01    /* data terminal ready */
+#define MCR_RTS         0x02    /* request to send */
+#define MCR_OUT2        0x08    /* connects the UART's IRQ line to the PIC */
+#define MCR_LOOP        0x10    /* loopback mode */
+
+/* Line status register bitfields */
+#define LSR_DR          0x01    /* data ready */
+#define LSR_THRE        0x20    /* transmit FIFO empty */
+#define LSR_TEMT        0x40    /* transmitter idle */
+
+/* Number of LSR polls to wait for the loopback test byte */
+#define PROBE_TIMEOUT   10000
+
+/* FIFO depths */
+#define FIFO_LEN_16550A 16
+#define FIFO_LEN_NONE   1
+
+/* Console transmit ring size; must be a power of 2 */
+#define CONS_RING_LEN   4096
+
+/* Amount of data streamed by uart_bench() */
+#define BENCH_BYTES     (1024 * 1024)
+
+struct uart {
+    uint16_t port;          /* I/O port base */
+    unsigned int irq;       /* IRQ line */
+    int chan;               /* TTY channel */
+    struct tty *tty;        /* TTY for channel */
+    bool present;           /* port detected */
+    int fifo_len;           /* transmit FIFO depth */
+    uint8_t ier;            /* current interrupt enable register value */
+    uint32_t tx_irqs;       /* number of THRE interrupts serviced */
+};
+
+static struct uart uarts[NUM_UART] = {
+    { .port = 0x3F8, .irq = IRQ_COM1, .chan = TTY_COM1 },
+    { .port = 0x2F8, .irq = IRQ_COM2, .chan = TTY_COM2 },
+    { .port = 0x3E8, .irq = IRQ_COM1, .chan = TTY_COM3 },
+    { .port = 0x2E8, .irq = IRQ_COM2, .chan = TTY_COM4 },
+};
+
+/* Console transmit ring; head and tail run freely and wrap on overflow */
+static char cons_ring[CONS_RING_LEN];
+static uint32_t cons_head;
+static uint32_t cons_tail;
+
+#define cons_uart   (&uarts[UART_CONSOLE])
+
+static bool uart_probe(struct uart *u);
+static void set_baud(struct uart *u, uint32_t baud);
+static int tx_fill(struct uart *u);
+static void set_thre_int(struct uart *u);
+#ifdef __BENCH
+static void bench_run(struct uart *u, int fifo_len);
+#endif
+
+static inline bool cons_pending(struct uart *u)
+{
+    return u == cons_uart && cons_head != cons_tail;
+}
+
+void uart_init(void)
+{
+    struct uart *u;
+    int i;
+
+    for (i = 0; i < NUM_UART; i++) {
+        u = &uarts[i];
+        u->tty = tty_get(u->chan);
+
+        if (!uart_probe(u)) {
+            continue;
+        }
+
+        u->present = true;
+        u->ier = IER_RDA | IER_RLS;
+        outb(MCR_DTR | MCR_RTS | MCR_OUT2, u->port + REG_MCR);
+        outb(u->ier, u->port + REG_IER);
+        irq_enable(u->irq);
+
+        kprintf("COM%d: %s at %X, IRQ %u\n", i + 1,
+            (u->fifo_len == FIFO_LEN_16550A) ? "16550A" : "8250/16450",
+            u->port, u->irq);
+    }
+}
+
+int uart_write(struct tty *tty)
+{
+    struct uart *u;
+    uint32_t flags;
+    int count;
+    int room;
+    int i;
+
+    u = NULL;
+    for (i = 0; i < NUM_UART; i++) {
+        if (uarts[i].tty == tty) {
+            u = &uarts[i];
+            break;
+        }
+    }
+
+    if (u == NULL || !u->present) {
+        /* Nowhere to send it. */
+        tty_queue_init(&tty->wr_q);
+        return 0;
+    }
+
+    count = 0;
+    for (;;) {
+        cli_save(flags);
+        count += tx_fill(u);
+        set_thre_int(u);
+        room = TTY_QUEUE_BUFLEN - tty->wr_q.len;
+        restore_flags(flags);
+
+        /* If the queue is full, spin until the transmitter frees up some
+           space; otherwise the interrupt handler takes it from here. */
+        if (room >= TTY_WRITE_ROOM) {
+            break;
+        }
+    }
+
+    return count;
+}
+
+int uart_console_write(const char *buf, int n)
+{
+    struct uart *u;
+    uint32_t flags;
+    int need;
+    int i;
+
+    u = cons_uart;
+    if (!u->present) {
+        return n;
+    }
+
+    need = n;
+    for (i = 0; i < n; i++) {
+        if (buf[i] == '\n') {
+            need++;
+        }
+    }
+
+    cli_save(flags);
+    if (CONS_RING_LEN - (cons_head - cons_tail) < (uint32_t) need) {
+        restore_flags(flags);
+        return -1;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (buf[i] == '\n') {
+            cons_ring[cons_head++ & (CONS_RING_LEN - 1)] = '\r';
+        }
+        cons_ring[cons_head++ & (CONS_RING_LEN - 1)] = buf[i];
+    }
+
+    /* Get things going if the transmitter is idle. */
+    tx_fill(u);
+    set_thre_int(u);
+    restore_flags(flags);
+
+    return n;
+}
+
+void uart_console_sync(void)
+{
+    struct uart *u;
+    uint32_t flags;
+
+    u = cons_uart;
+    if (!u->present) {
+        return;
+    }
+
+    cli_save(flags);
+    while (cons_pending(u)) {
+        while (!(inb(u->port + REG_LSR) & LSR_THRE)) { }
+        outb(cons_ring[cons_tail++ & (CONS_RING_LEN - 1)], u->port + REG_THR);
+    }
+    set_thre_int(u);
+    restore_flags(flags);
+}
+
+#ifdef __BENCH
+void uart_bench(void)
+{
+    struct uart *u;
+
+    u = cons_uart;
+    if (!u->present) {
+        kprintf("uart bench: COM%d not present\n", UART_CONSOLE + 1);
+        return;
+    }
+
+    if (u->fifo_len > FIFO_LEN_NONE) {
+        bench_run(u, u->fifo_len);
+    }
+    bench_run(u, FIFO_LEN_NONE);
+}
+#endif
+
+void uart_do_irq(unsigned int irq_num)
+{
+    struct uart *u;
+    uint8_t iir;
+    int i;
+
+    for (i = 0; i < NUM_UART; i++) {
+        u = &uarts[i];
+        if (!u->present || u->irq != irq_num) {
+            continue;
+        }
+
+        while (!((iir = inb(u->port + REG_IIR)) & IIR_NOINT)) {
+            switch (iir & IIR_ID) {
+                case IIR_RLS:
+                    inb(u->port + REG_LSR);
+                    break;
+                case IIR_RDA:
+                case IIR_TIMEOUT:
+                    while (inb(u->port + REG_LSR) & LSR_DR) {
+                        tty_recv(u->chan, (char) inb(u->port + REG_RBR));
+                    }
+                    break;
+                case IIR_THRE:
+                    u->tx_irqs++;
+                    tx_fill(u);
+                    set_thre_int(u);
+                    break;
+                case IIR_MS:
+                    inb(u->port + REG_MSR);
+                    break;
+            }
+        }
+    }
+}
+
+/**
+ * Checks for a UART at the given port and configures it for 8N1 at the
+ * default baud rate with the FIFOs enabled. Interrupts are left disabled.
+ */
+static bool uart_probe(struct uart *u)
+{
+    uint8_t iir;
+    int i;
+
+    /* Quick check for something that behaves like a register. */
+    outb(0x55, u->port + REG_SCR);
+    if (inb(u->port + REG_SCR) != 0x55) {
+        return false;
+    }
+
+    outb(0x00, u->port + REG_IER);
+    set_baud(u, UART_DEFAULT_BAUD);
+    outb(LCR_8N1, u->port + REG_LCR);
+    outb(FCR_ENABLE | FCR_CLR_RX | FCR_CLR_TX | FCR_TRIG_14,
+        u->port + REG_FCR);
+
+    /* The FIFO bits only read back as set on a 16550A; the original 16550
+       had a broken FIFO and older parts don't have one at all. */
+    iir = inb(u->port + REG_IIR);
+    if ((iir & IIR_FIFO) == IIR_FIFO) {
+        u->fifo_len = FIFO_LEN_16550A;
+    }
+    else {
+        outb(0x00, u->port + REG_FCR);
+        u->fifo_len = FIFO_LEN_NONE;
+    }
+
+    /* Make sure a byte actually makes it through the chip. */
+    outb(MCR_LOOP | MCR_RTS | MCR_DTR, u->port + REG_MCR);
+    outb(0xAE, u->port + REG_THR);
+    for (i = 0; i < PROBE_TIMEOUT; i++) {
+        if (inb(u->port + REG_LSR) & LSR_DR) {
+            break;
+        }
+    }
+    if (inb(u->port + REG_RBR) != 0xAE) {
+        outb(0x00, u->port + REG_MCR);
+        return false;
+    }
+
+    return true;
+}
+
+static void set_baud(struct uart *u, uint32_t baud)
+{
+    uint16_t divisor;
+    uint8_t lcr;
+
+    divisor = (uint16_t) (UART_CLOCK / baud);
+
+    lcr = inb(u->port + REG_LCR);
+    outb(lcr | LCR_DLAB, u->port + REG_LCR);
+    outb((uint8_t) divisor, u->port + REG_DLL);
+    outb((uint8_t) (divisor >> 8), u->port + REG_DLM);
+    outb(lcr & ~LCR_DLAB, u->port + REG_LCR);
+}
+
+/**
+ * Refills the transmit FIFO if it is empty; log output first, then the TTY's
+ * write queue. Must be called with interrupts disabled.
+ */
+static int tx_fill(struct uart *u)
+{
+    struct tty_queue *q;
+    int n;
+
+    if (!(inb(u->port + REG_LSR) & LSR_THRE)) {
+        return 0;
+    }
+
+    n = 0;
+    while (n < u->fifo_len && cons_pending(u)) {
+        outb(cons_ring[cons_tail++ & (CONS_RING_LEN - 1)], u->port + REG_THR);
+        n++;
+    }
+
+    q = &u->tty->wr_q;
+    while (n < u->fifo_len && !q->empty) {
+        outb(tty_queue_get(q), u->port + REG_THR);
+        n++;
+    }
+
+    return n;
+}
+
+/**
+ * Enables the transmit interrupt while there is data left to send.
+ * Must be called with interrupts disabled.
+ */
+static void set_thre_int(struct uart *u)
+{
+    uint8_t ier;
+
+    ier = u->ier;
+    if (u->tty->wr_q.empty && !cons_pending(u)) {
+        ier &= ~IER_THRE;
+    }
+    else {
+        ier |= IER_THRE;
+    }
+
+    if (ier != u->ier) {
+        u->ier = ier;
+        outb(ier, u->port + REG_IER);
+    }
+}
+
+#ifdef __BENCH
+static void bench_run(struct uart *u, int fifo_len)
+{
+    static const char line[] =
+        "uart bench: the quick brown fox jumps over the lazy dog 0123456\n";
+    uint32_t start_ticks;
+    uint32_t start_irqs;
+    uint64_t start_tsc;
+    uint64_t cycles;
+    uint32_t sent;
+    int saved_fifo_len;
+
+    saved_fifo_len = u->fifo_len;
+    u->fifo_len = fifo_len;
+
+    start_irqs = u->tx_irqs;
+    start_ticks = timer_ticks;
+    start_tsc = rdtsc();
+
+    for (sent = 0; sent < BENCH_BYTES; sent += sizeof(line) - 1) {
+        while (uart_console_write(line, sizeof(line) - 1) < 0) {
+            __asm__ volatile ("hlt" : : : "memory");
+        }
+    }
+
+    /* Wait for the last byte to leave the wire. */
+    while (cons_pending(u) || !(inb(u->port + REG_LSR) & LSR_TEMT)) {
+        __asm__ volatile ("hlt" : : : "memory");
+    }
+
+    cycles = rdtsc() - start_tsc;
+    u->fifo_len = saved_fifo_len;
+
+    kprintf("uart bench: %lu bytes, %d-byte batches: %lu ticks, "
+        "%lu THRE interrupts, %llu cycles\n",
+        sent, fifo_len, timer_ticks - start_ticks,
+        u->tx_irqs - start_irqs, cycles);
+}
+#endif
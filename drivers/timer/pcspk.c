@@ -25,7 +25,7 @@
 #define PCSPK_ENABLE    0x03
 #define PORT_PCSPK      0x61
 
-int beep_ticks;
+extern int beep_ticks;
 
 void pcspk_set_freq(int hz)
 {
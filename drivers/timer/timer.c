@@ -20,6 +20,8 @@
 #include <stdint.h>
 #include <lyra/io.h>
 #include <drivers/timer.h>
+#include <drivers/floppy.h>
+#include <drivers/ps2kbd.h>
 #include <drivers/pcspk.h>
 
 /* PIT clock rate */
@@ -47,6 +49,8 @@
 
 int beep_ticks = -1;
 
+volatile uint32_t timer_ticks = 0;
+
 void timer_set_rate(int ch, unsigned int hz)
 {
     uint16_t timer_port;
@@ -86,6 +90,8 @@ void timer_set_rate(int ch, unsigned int hz)
 
 void timer_do_irq(void)
 {
+    timer_ticks++;
+
     if (beep_ticks >= 0) {
         beep_ticks--;
     }
@@ -93,4 +99,7 @@ void timer_do_irq(void)
     if (beep_ticks == 0) {
         pcspk_off();
     }
+
+    floppy_timer();
+    ps2kbd_timer();
 }
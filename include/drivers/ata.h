@@ -0,0 +1,51 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * Copyright (C) 2018 Wes Hampson. All Rights Reserved.                       *
+ *                                                                            *
+ * This file is part of the Lyra operating system.                            *
+ *                                                                            *
+ * Lyra is free software: you can redistribute it and/or modify               *
+ * it under the terms of version 2 of the GNU General Public License          *
+ * as published by the Free Software Foundation.                              *
+ *                                                                            *
+ * See LICENSE in the top-level directory for a copy of the license.          *
+ * You may also visit <https://www.gnu.org/licenses/gpl-2.0.txt>.             *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+/*-----------------------------------------------------------------------------
+ *   File: include/drivers/ata.h
+ * Author: Wes Hampson
+ *   Desc: ATA (IDE) disk driver.
+ *----------------------------------------------------------------------------*/
+
+#ifndef __DRIVERS_ATA_H
+#define __DRIVERS_ATA_H
+
+#define ATA_NUM_CHANNELS    2
+#define ATA_NUM_DRIVES      (ATA_NUM_CHANNELS * 2)
+
+/**
+ * Probes both IDE channels and registers a block device for every ATA disk
+ * found: "hda" and "hdb" on the primary channel, "hdc" and "hdd" on the
+ * secondary. Bus-master DMA is used if there's a PCI IDE controller that
+ * supports it, and multi-sector PIO otherwise.
+ * Must be called after mem_init().
+ */
+void ata_init(void);
+
+#ifdef __BENCH
+/**
+ * Reads the start of the first disk, once using PIO and once using DMA, and
+ * logs the elapsed time and how much of it was spent in the driver.
+ * Interrupts must be enabled.
+ */
+void ata_bench(void);
+#endif
+
+/**
+ * IRQ handler for the IDE channels.
+ *
+ * @param irq_num - the IRQ that fired; IRQ_ATA0 or IRQ_ATA1
+ */
+void ata_do_irq(unsigned int irq_num);
+
+#endif /* __DRIVERS_ATA_H */
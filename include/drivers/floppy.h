@@ -0,0 +1,53 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * Copyright (C) 2018 Wes Hampson. All Rights Reserved.                       *
+ *                                                                            *
+ * This file is part of the Lyra operating system.                            *
+ *                                                                            *
+ * Lyra is free software: you can redistribute it and/or modify               *
+ * it under the terms of version 2 of the GNU General Public License          *
+ * as published by the Free Software Foundation.                              *
+ *                                                                            *
+ * See LICENSE in the top-level directory for a copy of the license.          *
+ * You may also visit <https://www.gnu.org/licenses/gpl-2.0.txt>.             *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+/*-----------------------------------------------------------------------------
+ *   File: include/drivers/floppy.h
+ * Author: Wes Hampson
+ *   Desc: Floppy disk driver.
+ *----------------------------------------------------------------------------*/
+
+#ifndef __DRIVERS_FLOPPY_H
+#define __DRIVERS_FLOPPY_H
+
+#define FLOPPY_CACHE_TRACKS     8   /* cylinders kept in the track cache */
+
+/**
+ * Looks up the first floppy drive in the CMOS and, if there is one,
+ * registers it as "fd0". The controller isn't touched until the first
+ * request, as it needs interrupts and the timer.
+ * Must be called after mem_init().
+ */
+void floppy_init(void);
+
+#ifdef __BENCH
+/**
+ * Reads the start of the disk a sector at a time, once straight from the
+ * disk and once through the track cache, and logs how long each took.
+ * Interrupts must be enabled.
+ */
+void floppy_bench(void);
+#endif
+
+/**
+ * IRQ handler for the floppy disk controller.
+ */
+void floppy_do_irq(void);
+
+/**
+ * Turns the drive motor off once it's been idle for a while. Called on
+ * every timer tick.
+ */
+void floppy_timer(void);
+
+#endif /* __DRIVERS_FLOPPY_H */
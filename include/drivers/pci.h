@@ -0,0 +1,84 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * Copyright (C) 2018 Wes Hampson. All Rights Reserved.                       *
+ *                                                                            *
+ * This file is part of the Lyra operating system.                            *
+ *                                                                            *
+ * Lyra is free software: you can redistribute it and/or modify               *
+ * it under the terms of version 2 of the GNU General Public License          *
+ * as published by the Free Software Foundation.                              *
+ *                                                                            *
+ * See LICENSE in the top-level directory for a copy of the license.          *
+ * You may also visit <https://www.gnu.org/licenses/gpl-2.0.txt>.             *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+/*-----------------------------------------------------------------------------
+ *   File: include/drivers/pci.h
+ * Author: Wes Hampson
+ *   Desc: PCI configuration space access.
+ *----------------------------------------------------------------------------*/
+
+#ifndef __DRIVERS_PCI_H
+#define __DRIVERS_PCI_H
+
+/* Configuration space registers (header type 0). */
+#define PCI_VENDOR_ID       0x00
+#define PCI_COMMAND         0x04
+#define PCI_CLASS_REV       0x08    /* class, subclass, prog IF, revision */
+#define PCI_HEADER_TYPE     0x0E
+#define PCI_BAR0            0x10
+#define PCI_BAR4            0x20
+
+/* Command register bits. */
+#define PCI_CMD_IO          0x0001  /* respond to I/O space accesses */
+#define PCI_CMD_MASTER      0x0004  /* bus mastering */
+
+/* I/O space BARs have bit 0 set; the address is in the bits above bit 1. */
+#define PCI_BAR_IO          0x01
+#define PCI_BAR_IO_MASK     0xFFFFFFFC
+
+/* Device classes. */
+#define PCI_CLASS_STORAGE   0x01
+#define PCI_SUBCLASS_IDE    0x01
+
+#ifndef __ASM
+#include <stdbool.h>
+#include <stdint.h>
+
+/* A function's address on the bus. */
+struct pci_addr {
+    uint8_t bus;
+    uint8_t dev;
+    uint8_t func;
+};
+
+/**
+ * Reads a doubleword from a function's configuration space.
+ *
+ * @param addr - the function
+ * @param reg  - register offset; must be doubleword-aligned
+ * @return the register's value
+ */
+uint32_t pci_read(const struct pci_addr *addr, uint8_t reg);
+
+/**
+ * Writes a doubleword to a function's configuration space.
+ *
+ * @param addr - the function
+ * @param reg  - register offset; must be doubleword-aligned
+ * @param val  - the value to write
+ */
+void pci_write(const struct pci_addr *addr, uint8_t reg, uint32_t val);
+
+/**
+ * Finds the first function of a given class by scanning every bus.
+ *
+ * @param class    - the base class (PCI_CLASS_*)
+ * @param subclass - the subclass
+ * @param addr     - where to store the function's address
+ * @return true if a function was found
+ */
+bool pci_find_class(uint8_t class, uint8_t subclass, struct pci_addr *addr);
+
+#endif /* __ASM */
+
+#endif /* __DRIVERS_PCI_H */
@@ -20,12 +20,28 @@
 #ifndef __DRIVERS_PS2KBD_H
 #define __DRIVERS_PS2KBD_H
 
+#include <stdbool.h>
+
 /**
- * Test PS/2 controller and keyboard, then configure keyboard to transmit
- * scancodes from scancode set 3.
+ * Test the PS/2 controller and turn on keyboard interrupts, then start
+ * resetting the keyboard and configuring it to transmit scancodes from
+ * scancode set 3. The keyboard commands complete in the background, as the
+ * keyboard responds to them.
  */
 void ps2kbd_init(void);
 
+/**
+ * Check whether the keyboard is done with the commands queued for it.
+ * @return true once every command has completed, failed or timed out
+ */
+bool ps2kbd_poll(void);
+
+/**
+ * Give up on a keyboard command that's taking too long. Called on every
+ * timer tick.
+ */
+void ps2kbd_timer(void);
+
 /**
  * IRQ handler for keyboard interrupts.
  * Sends virtual keystrokes to the terminal.
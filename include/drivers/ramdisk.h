@@ -0,0 +1,43 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * Copyright (C) 2018 Wes Hampson. All Rights Reserved.                       *
+ *                                                                            *
+ * This file is part of the Lyra operating system.                            *
+ *                                                                            *
+ * Lyra is free software: you can redistribute it and/or modify               *
+ * it under the terms of version 2 of the GNU General Public License          *
+ * as published by the Free Software Foundation.                              *
+ *                                                                            *
+ * See LICENSE in the top-level directory for a copy of the license.          *
+ * You may also visit <https://www.gnu.org/licenses/gpl-2.0.txt>.             *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+/*-----------------------------------------------------------------------------
+ *   File: include/drivers/ramdisk.h
+ * Author: Wes Hampson
+ *   Desc: RAM disk block device.
+ *----------------------------------------------------------------------------*/
+
+#ifndef __DRIVERS_RAMDISK_H
+#define __DRIVERS_RAMDISK_H
+
+#define RAMDISK_MAX_SIZE        0x400000    /* 4 MiB */
+#define RAMDISK_DEFAULT_SIZE    0x100000    /* 1 MiB; when there's no initrd */
+
+/**
+ * Sets up the RAM disk, "ram0". If the bootloader loaded an initrd, the disk
+ * holds the initrd, in place; otherwise it's an empty disk of
+ * RAMDISK_DEFAULT_SIZE bytes, backed by page frames.
+ * Must be called after mem_init().
+ */
+void ramdisk_init(void);
+
+#ifdef __BENCH
+/**
+ * Reads the whole RAM disk a page at a time, once submitting each page as it
+ * goes and once in plugged batches that get merged into larger requests, and
+ * logs how long each took.
+ */
+void ramdisk_bench(void);
+#endif
+
+#endif /* __DRIVERS_RAMDISK_H */
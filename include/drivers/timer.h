@@ -20,12 +20,17 @@
 #ifndef __DRIVERS_TIMER_H
 #define __DRIVERS_TIMER_H
 
+#include <stdint.h>
+
 #define TIMER_MIN_FREQ  19
 #define TIMER_MAX_FREQ  596591
 
 #define TIMER_CH_INTR   0
 #define TIMER_CH_PCSPK  2
 
+/* Number of channel 0 interrupts since boot. */
+extern volatile uint32_t timer_ticks;
+
 /**
  * Sets the tick rate of the timer on the specified channel.
  *
@@ -0,0 +1,84 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * Copyright (C) 2018 Wes Hampson. All Rights Reserved.                       *
+ *                                                                            *
+ * This file is part of the Lyra operating system.                            *
+ *                                                                            *
+ * Lyra is free software: you can redistribute it and/or modify               *
+ * it under the terms of version 2 of the GNU General Public License          *
+ * as published by the Free Software Foundation.                              *
+ *                                                                            *
+ * See LICENSE in the top-level directory for a copy of the license.          *
+ * You may also visit <https://www.gnu.org/licenses/gpl-2.0.txt>.             *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+/*-----------------------------------------------------------------------------
+ *   File: include/drivers/uart.h
+ * Author: Wes Hampson
+ *   Desc: 16550A UART driver for the COM1-COM4 serial ports.
+ *----------------------------------------------------------------------------*/
+
+#ifndef __DRIVERS_UART_H
+#define __DRIVERS_UART_H
+
+#include <lyra/tty.h>
+
+#define NUM_UART            4
+#define UART_DEFAULT_BAUD   115200
+
+/* Port that mirrors the kernel log (COM1) */
+#define UART_CONSOLE        0
+
+/**
+ * Detects and configures the serial ports, then enables their interrupts.
+ * Ports that aren't present are skipped; output written to them is discarded.
+ */
+void uart_init(void);
+
+/**
+ * TTY write callback for the COM channels.
+ * Moves characters from the TTY's write queue into the transmit FIFO. If the
+ * queue is full, waits until there's room in it again; otherwise the rest of
+ * the queue is sent by the transmit interrupt.
+ *
+ * @param tty - the TTY to flush
+ * @return the number of characters moved to the UART
+ */
+int uart_write(struct tty *tty);
+
+/**
+ * Queues kernel log output for transmission on the console port.
+ * The text goes into a dedicated transmit ring that the THRE interrupt drains,
+ * so this never waits on the UART. LF is sent as CR/LF.
+ *
+ * @param buf - the text to send
+ * @param n   - the number of characters to send
+ * @return n if the text was queued (or the port isn't present),
+ *         -1 if there isn't enough room in the ring for all of it
+ */
+int uart_console_write(const char *buf, int n);
+
+/**
+ * Sends everything in the console transmit ring, polling the UART rather
+ * than waiting for interrupts. For when interrupts won't come anymore, e.g.
+ * on the way to halting after a fatal exception.
+ */
+void uart_console_sync(void);
+
+#ifdef __BENCH
+/**
+ * Streams 1 MiB through the console transmit ring, once using the full FIFO
+ * and once a byte at a time, and logs how long each took.
+ * Interrupts must be enabled.
+ */
+void uart_bench(void);
+#endif
+
+/**
+ * IRQ handler for serial port interrupts.
+ * COM1 and COM3 share IRQ 4; COM2 and COM4 share IRQ 3.
+ *
+ * @param irq_num - the IRQ that fired
+ */
+void uart_do_irq(unsigned int irq_num);
+
+#endif /* __DRIVERS_UART_H */
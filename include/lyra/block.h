@@ -0,0 +1,225 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * Copyright (C) 2018 Wes Hampson. All Rights Reserved.                       *
+ *                                                                            *
+ * This file is part of the Lyra operating system.                            *
+ *                                                                            *
+ * Lyra is free software: you can redistribute it and/or modify               *
+ * it under the terms of version 2 of the GNU General Public License          *
+ * as published by the Free Software Foundation.                              *
+ *                                                                            *
+ * See LICENSE in the top-level directory for a copy of the license.          *
+ * You may also visit <https://www.gnu.org/licenses/gpl-2.0.txt>.             *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+/*-----------------------------------------------------------------------------
+ *   File: include/lyra/block.h
+ * Author: Wes Hampson
+ *   Desc: Generic block device layer.
+ *----------------------------------------------------------------------------*/
+
+#ifndef __LYRA_BLOCK_H
+#define __LYRA_BLOCK_H
+
+#define SECTOR_SHIFT        9
+#define SECTOR_SIZE         (1 << SECTOR_SHIFT)     /* 512 bytes */
+
+#define MAX_BLKDEVS         4
+#define BLKDEV_NAME_LEN     8
+#define BIO_MAX_VECS        8
+#define MAX_REQUESTS        32      /* request pool, shared by all devices */
+
+/* Transfer directions. */
+#define BIO_READ            0
+#define BIO_WRITE           1
+
+/* Bio status, besides 0 (success) and -1 (I/O error). */
+#define BIO_PENDING         1
+
+#ifndef __ASM
+#include <stdbool.h>
+#include <stdint.h>
+
+struct blkdev;
+
+/* A contiguous piece of memory to transfer to or from. */
+struct bio_vec {
+    void *buf;
+    uint32_t len;               /* bytes; a multiple of SECTOR_SIZE */
+};
+
+/* A single I/O: a run of consecutive sectors on a device, scattered across
+   (or gathered from) up to BIO_MAX_VECS buffers. */
+struct bio {
+    struct blkdev *dev;
+    int dir;                    /* BIO_READ or BIO_WRITE */
+    uint32_t sector;            /* first sector */
+    uint32_t nr_sectors;        /* total length of the vecs, in sectors */
+    int nvecs;
+    struct bio_vec vecs[BIO_MAX_VECS];
+    volatile int status;        /* BIO_PENDING until completed */
+    void (*end_io)(struct bio *bio);    /* completion callback; may be NULL */
+    void *private;              /* for the submitter */
+    struct bio *next;           /* next bio in the same request */
+};
+
+/* What drivers see: one or more bios for adjacent sectors, merged into a
+   single transfer. Bios are chained in sector order. */
+struct request {
+    int dir;
+    uint32_t sector;
+    uint32_t nr_sectors;
+    struct bio *bio;
+    struct bio *biotail;
+    struct request *next;       /* next request in the queue */
+};
+
+struct blkdev_ops {
+    /**
+     * Starts a transfer. The driver calls blk_end_request() once the request
+     * is done, either before returning or later from its interrupt handler.
+     * Only one request is handed to the driver at a time.
+     */
+    void (*transfer)(struct blkdev *dev, struct request *req);
+};
+
+struct blkdev_stats {
+    uint32_t bios;              /* bios submitted */
+    uint32_t merges;            /* bios merged into an existing request */
+    uint32_t requests;          /* requests handed to the driver */
+    uint32_t sectors_read;
+    uint32_t sectors_written;
+    uint32_t errors;            /* bios completed with an error */
+};
+
+struct blkdev {
+    char name[BLKDEV_NAME_LEN];
+    uint32_t nr_sectors;        /* capacity */
+    uint32_t max_sectors;       /* largest request the driver accepts */
+    const struct blkdev_ops *ops;
+    void *private;              /* for the driver */
+
+    /* Managed by the block layer. */
+    struct request *queue;      /* pending requests, in sector order */
+    struct request *active;     /* request owned by the driver */
+    int plugged;                /* nesting depth of blk_plug() */
+    bool running;               /* dispatching requests */
+    struct blkdev_stats stats;
+};
+
+/**
+ * Makes a block device available to the rest of the kernel. The driver fills
+ * in the name, capacity, max_sectors and ops; the rest is set up here.
+ *
+ * @param dev - the device
+ * @return 0 on success, -1 if the device table is full
+ */
+int blkdev_register(struct blkdev *dev);
+
+/**
+ * Looks up a block device by name.
+ *
+ * @param name - the device's name, e.g. "ram0"
+ * @return the device, or NULL if there's no such device
+ */
+struct blkdev * blkdev_get(const char *name);
+
+/**
+ * Sets up an empty bio.
+ *
+ * @param bio    - the bio
+ * @param dev    - the device to transfer to or from
+ * @param dir    - BIO_READ or BIO_WRITE
+ * @param sector - first sector of the transfer
+ */
+void bio_init(struct bio *bio, struct blkdev *dev, int dir, uint32_t sector);
+
+/**
+ * Adds a buffer to the end of a bio. The buffer must be in kernel memory,
+ * since the transfer may take place while another address space is active.
+ *
+ * @param bio - the bio
+ * @param buf - the buffer
+ * @param len - length of the buffer; must be a multiple of SECTOR_SIZE
+ * @return 0 on success, -1 if the bio is full or the length is invalid
+ */
+int bio_add_buf(struct bio *bio, void *buf, uint32_t len);
+
+/**
+ * Queues a bio. If the device isn't plugged, the queue is started right
+ * away; otherwise the bio sits in the queue, where later bios for adjacent
+ * sectors can be merged with it, until the device is unplugged.
+ * The bio must stay around until it completes.
+ *
+ * @param bio - the bio
+ * @return 0 if the bio was queued, -1 if it's empty or out of range (in
+ *         which case it's completed with an error)
+ */
+int submit_bio(struct bio *bio);
+
+/**
+ * Holds back the device's queue so that bios submitted from now on can be
+ * merged. Calls nest.
+ *
+ * @param dev - the device
+ */
+void blk_plug(struct blkdev *dev);
+
+/**
+ * Undoes a blk_plug() and starts the queue once the outermost plug is
+ * removed.
+ *
+ * @param dev - the device
+ */
+void blk_unplug(struct blkdev *dev);
+
+/**
+ * Waits for a bio to complete. Other tasks get to run in the meantime.
+ * Interrupts must be enabled unless the bio is known to complete
+ * synchronously.
+ *
+ * @param bio - the bio
+ * @return 0 on success, -1 on an I/O error
+ */
+int bio_wait(struct bio *bio);
+
+/**
+ * Reads consecutive sectors into a buffer and waits for the data.
+ *
+ * @param dev    - the device
+ * @param sector - first sector
+ * @param buf    - where to put the data
+ * @param count  - number of sectors
+ * @return 0 on success, -1 on error
+ */
+int blk_read(struct blkdev *dev, uint32_t sector, void *buf, uint32_t count);
+
+/**
+ * Writes consecutive sectors from a buffer and waits for the write to finish.
+ *
+ * @param dev    - the device
+ * @param sector - first sector
+ * @param buf    - the data
+ * @param count  - number of sectors
+ * @return 0 on success, -1 on error
+ */
+int blk_write(struct blkdev *dev, uint32_t sector, const void *buf,
+              uint32_t count);
+
+/**
+ * Completes the driver's current request, then starts the next one.
+ * Called by drivers; safe to call from an interrupt handler.
+ *
+ * @param dev    - the device
+ * @param req    - the request, as passed to the driver's transfer()
+ * @param status - 0 on success, -1 on error
+ */
+void blk_end_request(struct blkdev *dev, struct request *req, int status);
+
+/**
+ * Prints the I/O statistics of every block device.
+ */
+void blk_print_stats(void);
+
+#endif /* __ASM */
+
+#endif /* __LYRA_BLOCK_H */
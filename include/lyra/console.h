@@ -31,8 +31,8 @@
 struct tty;
 
 /**
- * Initializes keyboard and VGA drivers, creates virtual consoles,
- * and switches to console 0.
+ * Initializes the VGA driver, creates virtual consoles, and switches to
+ * console 0. The keyboard is brought up separately; see ps2kbd_init().
  */
 void console_init(void);
 
@@ -0,0 +1,150 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * Copyright (C) 2018 Wes Hampson. All Rights Reserved.                       *
+ *                                                                            *
+ * This file is part of the Lyra operating system.                            *
+ *                                                                            *
+ * Lyra is free software: you can redistribute it and/or modify               *
+ * it under the terms of version 2 of the GNU General Public License          *
+ * as published by the Free Software Foundation.                              *
+ *                                                                            *
+ * See LICENSE in the top-level directory for a copy of the license.          *
+ * You may also visit <https://www.gnu.org/licenses/gpl-2.0.txt>.             *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+/*-----------------------------------------------------------------------------
+ *   File: include/lyra/cpu.h
+ * Author: Wes Hampson
+ *   Desc: CPU feature detection and model-specific instructions.
+ *----------------------------------------------------------------------------*/
+
+#ifndef __LYRA_CPU_H
+#define __LYRA_CPU_H
+
+/* CPUID leaf 1 feature flags (EDX).
+   See the CPUID instruction reference in Volume 2 of the Intel Software
+   Developers Manual for more information. */
+#define CPU_FEAT_FPU    (1 << 0)    /* x87 FPU on chip */
+#define CPU_FEAT_PSE    (1 << 3)    /* 4 MiB pages */
+#define CPU_FEAT_TSC    (1 << 4)    /* time stamp counter (RDTSC) */
+#define CPU_FEAT_MSR    (1 << 5)    /* RDMSR/WRMSR */
+#define CPU_FEAT_SEP    (1 << 11)   /* SYSENTER/SYSEXIT */
+#define CPU_FEAT_PGE    (1 << 13)   /* global pages */
+#define CPU_FEAT_SSE2   (1 << 26)   /* SSE2 (MOVNTI) */
+
+/* Model-specific registers */
+#define MSR_SYSENTER_CS     0x174   /* ring 0 CS for SYSENTER */
+#define MSR_SYSENTER_ESP    0x175   /* ring 0 ESP for SYSENTER */
+#define MSR_SYSENTER_EIP    0x176   /* ring 0 EIP for SYSENTER */
+
+#ifndef __ASM
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Feature flags of the boot CPU; valid after cpu_init(). */
+extern uint32_t cpu_features;
+
+/* Family/model/stepping of the boot CPU (CPUID leaf 1 EAX); valid after
+   cpu_init(). */
+extern uint32_t cpu_signature;
+
+#define cpu_family(sig)     (((sig) >> 8) & 0x0F)
+#define cpu_model(sig)      (((sig) >> 4) & 0x0F)
+#define cpu_stepping(sig)   ((sig) & 0x0F)
+
+/**
+ * Detects the features supported by the CPU.
+ * Must be called before any of the helpers below which depend on an optional
+ * feature (e.g. rdtsc()).
+ */
+void cpu_init(void);
+
+/**
+ * Checks whether the CPU supports a feature.
+ *
+ * @param feat - one of the CPU_FEAT_* flags
+ * @return true if the feature is supported
+ */
+static inline bool cpu_has(uint32_t feat)
+{
+    return (cpu_features & feat) == feat;
+}
+
+/**
+ * Executes the CPUID instruction.
+ *
+ * @param leaf - the CPUID leaf (EAX input)
+ * @param a    - pointer to store EAX
+ * @param b    - pointer to store EBX
+ * @param c    - pointer to store ECX
+ * @param d    - pointer to store EDX
+ */
+static inline void cpuid(uint32_t leaf,
+                         uint32_t *a, uint32_t *b, uint32_t *c, uint32_t *d)
+{
+    __asm__ volatile (
+        "cpuid"
+        : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d)
+        : "a"(leaf), "c"(0)
+    );
+}
+
+/**
+ * Reads the time stamp counter.
+ *
+ * @return the number of cycles since reset, or 0 if the CPU does not have a
+ *         time stamp counter
+ */
+static inline uint64_t rdtsc(void)
+{
+    uint64_t tsc;
+
+    if (!cpu_has(CPU_FEAT_TSC)) {
+        return 0;
+    }
+
+    __asm__ volatile (
+        "rdtsc"
+        : "=A"(tsc)
+    );
+    return tsc;
+}
+
+/**
+ * Reads a model-specific register.
+ * Requires CPU_FEAT_MSR.
+ *
+ * @param msr - the register number
+ * @return the register's value
+ */
+static inline uint64_t rdmsr(uint32_t msr)
+{
+    uint64_t val;
+
+    __asm__ volatile (
+        "rdmsr"
+        : "=A"(val)
+        : "c"(msr)
+    );
+    return val;
+}
+
+/**
+ * Writes a model-specific register.
+ * Requires CPU_FEAT_MSR.
+ *
+ * @param msr - the register number
+ * @param val - the value to write
+ */
+static inline void wrmsr(uint32_t msr, uint64_t val)
+{
+    __asm__ volatile (
+        "wrmsr"
+        :
+        : "c"(msr), "A"(val)
+        : "memory"
+    );
+}
+
+#endif /* __ASM */
+
+#endif /* __LYRA_CPU_H */
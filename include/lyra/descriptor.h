@@ -27,6 +27,7 @@
 #define USER_DS     0x2B
 #define KERNEL_TSS  0x30
 #define KERNEL_LDT  0x38
+#define DF_TSS      0x40        /* double fault handler task */
 
 /* Code/data segment descriptor types.
    See section 3.4.3 of the Intel Software Developers Manual, Volume 3
@@ -102,6 +103,10 @@ typedef union seg_desc {
     uint64_t value;
 } seg_desc_t;
 
+/* The GDT and IDT, at GDT_BASE and IDT_BASE; placed by the linker script. */
+extern seg_desc_t gdt[];
+extern idt_gate_t idt[];
+
 /* Task State Segment (TSS) structure. */
 struct tss_struct {
     uint16_t prev_task;
@@ -157,6 +162,9 @@ struct tss_struct {
     uint16_t io_base_addr;
 };
 
+/* The TSS that every task runs under; defined in init.c. */
+extern struct tss_struct kernel_tss;
+
 /**
  * Load the Interrupt Descriptor Table Register.
  *
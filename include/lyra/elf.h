@@ -0,0 +1,107 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * Copyright (C) 2018 Wes Hampson. All Rights Reserved.                       *
+ *                                                                            *
+ * This file is part of the Lyra operating system.                            *
+ *                                                                            *
+ * Lyra is free software: you can redistribute it and/or modify               *
+ * it under the terms of version 2 of the GNU General Public License          *
+ * as published by the Free Software Foundation.                              *
+ *                                                                            *
+ * See LICENSE in the top-level directory for a copy of the license.          *
+ * You may also visit <https://www.gnu.org/licenses/gpl-2.0.txt>.             *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+/*-----------------------------------------------------------------------------
+ *   File: include/lyra/elf.h
+ * Author: Wes Hampson
+ *   Desc: ELF32 executable format structures and the program loader.
+ *
+ * See the System V ABI (and its Intel386 supplement) for more information
+ * about the ELF format.
+ *----------------------------------------------------------------------------*/
+
+#ifndef __LYRA_ELF_H
+#define __LYRA_ELF_H
+
+#include <stdint.h>
+#include <lyra/mm.h>
+
+/* e_ident[] indices and values. */
+#define EI_MAG0         0
+#define EI_MAG1         1
+#define EI_MAG2         2
+#define EI_MAG3         3
+#define EI_CLASS        4
+#define EI_DATA         5
+#define EI_VERSION      6
+#define EI_NIDENT       16
+
+#define ELFMAG0         0x7F
+#define ELFMAG1         'E'
+#define ELFMAG2         'L'
+#define ELFMAG3         'F'
+#define ELFCLASS32      1
+#define ELFDATA2LSB     1
+#define EV_CURRENT      1
+
+/* e_type */
+#define ET_EXEC         2
+
+/* e_machine */
+#define EM_386          3
+
+/* p_type */
+#define PT_NULL         0
+#define PT_LOAD         1
+
+/* p_flags */
+#define PF_X            0x1
+#define PF_W            0x2
+#define PF_R            0x4
+
+/* ELF file header. */
+typedef struct {
+    uint8_t  e_ident[EI_NIDENT];
+    uint16_t e_type;
+    uint16_t e_machine;
+    uint32_t e_version;
+    uint32_t e_entry;           /* entry point */
+    uint32_t e_phoff;           /* program header table offset */
+    uint32_t e_shoff;
+    uint32_t e_flags;
+    uint16_t e_ehsize;
+    uint16_t e_phentsize;       /* size of a program header */
+    uint16_t e_phnum;           /* number of program headers */
+    uint16_t e_shentsize;
+    uint16_t e_shnum;
+    uint16_t e_shstrndx;
+} Elf32_Ehdr;
+
+/* ELF program header. */
+typedef struct {
+    uint32_t p_type;
+    uint32_t p_offset;          /* segment's offset in the file */
+    uint32_t p_vaddr;           /* segment's virtual address */
+    uint32_t p_paddr;
+    uint32_t p_filesz;          /* bytes of the segment stored in the file */
+    uint32_t p_memsz;           /* size of the segment in memory */
+    uint32_t p_flags;
+    uint32_t p_align;
+} Elf32_Phdr;
+
+/**
+ * Sets up an address space for an ELF32 executable. Each PT_LOAD segment
+ * becomes a VMA backed by the image; nothing is copied or mapped until the
+ * program touches it.
+ *
+ * @param mm    - the address space
+ * @param image - the executable; must be page-aligned and outlive the
+ *                address space
+ * @param size  - size of the executable in bytes
+ * @param entry - where to store the program's entry point
+ * @return 0 on success, -1 if the image is not a valid i386 executable or a
+ *         segment can't be placed
+ */
+int elf_load(struct mm *mm, const void *image, uint32_t size, uint32_t *entry);
+
+#endif /* __LYRA_ELF_H */
@@ -53,6 +53,14 @@
 __attribute__((fastcall))
 void do_exception(struct interrupt_frame *regs);
 
+/**
+ * Double fault handler. Runs as a separate task, reached through a task gate
+ * (see DF_TSS), so it has a stack of its own even if the double fault was
+ * caused by a kernel stack overflow. Reports the fault and halts.
+ */
+__attribute__((noreturn))
+void double_fault_task(void);
+
 #endif /* __ASM */
 
 #endif /* __LYRA_EXCEPTION_H */
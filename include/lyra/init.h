@@ -23,8 +23,81 @@
 
 #define KERNEL_ENTRY        kernel_init
 #define KERNEL_START        0x100000    /* 1 MiB */
+#define KERNEL_LIMIT        (INITRD_START - 0x2000)
 #define KERNEL_STACK_BASE   0x400000    /* 4 MiB */
+#define KERNEL_STACK_SIZE   0x4000      /* 16 KiB; a guard page sits below */
 #define GDT_BASE            0x0500
 #define IDT_BASE            0x0600
 
+/* Stage 2 of the bootloader (or the Multiboot entry point) leaves a
+   'struct boot_info' here for the kernel, right after the IDT. */
+#define BOOT_INFO           0x0E00
+#define BI_INITRD_START     0x00
+#define BI_INITRD_SIZE      0x04
+#define BI_TSC_START        0x08
+#define BI_TSC_LOADED       0x10
+#define BI_TSC_KERNEL       0x18
+#define BI_MEM_SIZE         0x20
+#define BI_CMDLINE          0x24
+#define BOOT_CMDLINE_SIZE   256
+
+/* Where stage 1 puts the initrd, if there is one. Anything up to the boot
+   stack's guard page is fair game.
+   The compressed kernel is loaded just below it, and decompressed in place
+   to KERNEL_START; the decompressed kernel must end a little short of the
+   compressed one (KERNEL_LIMIT) for that to work. */
+#define INITRD_START        0x200000    /* 2 MiB */
+
+/* Bounce buffer for ISA DMA, which can only reach the low 16 MiB and can't
+   cross a 64 KiB boundary. The bootloader is done with low memory by the
+   time the kernel runs. */
+#define ISA_DMA_BUF         0x10000     /* 64 KiB */
+#define ISA_DMA_BUF_SIZE    0x10000
+
+#ifndef __ASM
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Bit for an initcall in the dependency masks of the others. */
+#define INIT_DEP(id)        (1UL << (id))
+
+/**
+ * One step of kernel initialization, and the steps it has to wait for.
+ *
+ * A slow probe can return from 'init' as soon as it has kicked things off,
+ * and finish the job a bit at a time in 'poll'. Pending initcalls are polled
+ * in between starting the others, so everything that doesn't depend on them
+ * carries on in the meantime.
+ */
+struct initcall {
+    const char *name;
+    void (*init)(void);
+    bool (*poll)(void);         /* returns true when done; NULL if 'init'
+                                   does the whole job */
+    uint32_t deps;              /* INIT_DEP() mask of initcalls to wait for */
+};
+
+/**
+ * Runs a table of (at most 32) initcalls, each as soon as everything it
+ * depends on is done, and in table order otherwise. Returns once all of them
+ * are done.
+ *
+ * @param calls - the initcalls; dependencies refer to indices in this table
+ * @param count - number of initcalls
+ */
+void run_initcalls(const struct initcall *calls, int count);
+
+#ifdef __BENCH
+/**
+ * Marks the end of a boot phase. Benchmark builds log how long each phase
+ * took, along with the bootloader's stages, just before the idle loop.
+ *
+ * @param phase - name of the phase that just finished
+ */
+void boot_trace(const char *phase);
+#else
+#define boot_trace(phase)
+#endif
+#endif /* __ASM */
+
 #endif /* __LYRA_INIT_H */
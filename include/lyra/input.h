@@ -182,17 +182,29 @@ typedef uint32_t keystroke_t;
 #define FLAG_CAPSLK     (1 << 21)
 #define FLAG_SCRLK      (1 << 21)
 
+/* Both views of a keystroke; punning through a union is well-defined. */
+union keystroke_pun {
+    struct keystroke ks;
+    keystroke_t val;
+};
+
 /**
  * Convert 'struct keystroke' to 'keystroke_t'.
  */
-#define encode_keystroke(keystroke_struct)   \
-*((keystroke_t *) &keystroke_struct)
+static inline keystroke_t encode_keystroke(struct keystroke ks)
+{
+    union keystroke_pun u = { .ks = ks };
+    return u.val;
+}
 
 /**
  * Convert 'keystroke_t' to 'struct keystroke'.
  */
-#define decode_keystroke(keystroke_val)     \
-*((struct keystroke *) &keystroke_val)
+static inline struct keystroke decode_keystroke(keystroke_t val)
+{
+    union keystroke_pun u = { .val = val };
+    return u.ks;
+}
 
 static inline bool is_ctrl_down(keystroke_t k)
 {
@@ -137,6 +137,13 @@ struct interrupt_frame {
     uint32_t ecx;
     uint32_t eax;
 
+    /* Data segment registers.
+       Pushed by interrupt handler, which then loads the kernel's own. */
+    uint32_t gs;
+    uint32_t fs;
+    uint32_t es;
+    uint32_t ds;
+
     /* Exception number when an exception raised.
        One's compliment of IRQ number when IRQ raised.
        0x80 when executing system call. */
@@ -109,6 +109,108 @@ static inline void outb_p(uint8_t data, uint16_t port)
     );
 }
 
+/**
+ * Read a word from an I/O port.
+ *
+ * @param port - the port to read from
+ * @return the word read
+ */
+static inline uint16_t inw(uint16_t port)
+{
+    uint16_t data;
+    __asm__ volatile (
+        "inw    %w1, %w0"
+        : "=a"(data)
+        : "d"(port)
+        : "memory", "cc"
+    );
+    return data;
+}
+
+/**
+ * Write a word to an I/O port.
+ *
+ * @param data - the word to write
+ * @param port - the port to write to
+ */
+static inline void outw(uint16_t data, uint16_t port)
+{
+    __asm__ volatile (
+        "outw   %w0, %w1"
+        :
+        : "a"(data), "d"(port)
+        : "memory", "cc"
+    );
+}
+
+/**
+ * Read a doubleword from an I/O port.
+ *
+ * @param port - the port to read from
+ * @return the doubleword read
+ */
+static inline uint32_t inl(uint16_t port)
+{
+    uint32_t data;
+    __asm__ volatile (
+        "inl    %w1, %0"
+        : "=a"(data)
+        : "d"(port)
+        : "memory", "cc"
+    );
+    return data;
+}
+
+/**
+ * Write a doubleword to an I/O port.
+ *
+ * @param data - the doubleword to write
+ * @param port - the port to write to
+ */
+static inline void outl(uint32_t data, uint16_t port)
+{
+    __asm__ volatile (
+        "outl   %0, %w1"
+        :
+        : "a"(data), "d"(port)
+        : "memory", "cc"
+    );
+}
+
+/**
+ * Read a string of words from an I/O port.
+ *
+ * @param port  - the port to read from
+ * @param buf   - where to store the words
+ * @param count - the number of words to read
+ */
+static inline void insw(uint16_t port, void *buf, uint32_t count)
+{
+    __asm__ volatile (
+        "rep insw"
+        : "+D"(buf), "+c"(count)
+        : "d"(port)
+        : "memory"
+    );
+}
+
+/**
+ * Write a string of words to an I/O port.
+ *
+ * @param port  - the port to write to
+ * @param buf   - the words to write
+ * @param count - the number of words to write
+ */
+static inline void outsw(uint16_t port, const void *buf, uint32_t count)
+{
+    __asm__ volatile (
+        "rep outsw"
+        : "+S"(buf), "+c"(count)
+        : "d"(port)
+        : "memory"
+    );
+}
+
 #endif /* __ASM */
 
 #endif /* __LYRA_IO_H */
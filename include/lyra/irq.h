@@ -33,7 +33,12 @@
 #define IRQ_TIMER       0
 #define IRQ_KEYBOARD    1
 #define IRQ_SLAVE_PIC   2
+#define IRQ_COM2        3       /* also COM4 */
+#define IRQ_COM1        4       /* also COM3 */
+#define IRQ_FLOPPY      6
 #define IRQ_RTC         8
+#define IRQ_ATA0        14      /* primary IDE channel */
+#define IRQ_ATA1        15      /* secondary IDE channel */
 
 #ifndef __ASM
 
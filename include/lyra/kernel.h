@@ -25,12 +25,28 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <lyra/init.h>
+#include <lyra/klog.h>
 
 extern const char * const OS_NAME;
 
 #define PRIVL_KERNEL 0
 #define PRIVL_USER   3
 
+/* What the bootloader passes on to the kernel; found at BOOT_INFO. */
+struct boot_info {
+    uint32_t initrd_start;      /* physical address of the initrd */
+    uint32_t initrd_size;       /* size of the initrd in bytes; 0 if none */
+    uint64_t tsc_start;         /* BENCH builds: time stamp when stage 1 */
+    uint64_t tsc_loaded;        /*   started, when it was done loading,   */
+    uint64_t tsc_kernel;        /*   and when the kernel was unpacked     */
+    uint32_t mem_size;          /* end of usable memory; 0 if not known */
+    char cmdline[BOOT_CMDLINE_SIZE];    /* kernel command line, if any */
+};
+
+/* The boot info; placed at BOOT_INFO by the linker script. Going through a
+   real object keeps the compiler from complaining about fixed addresses. */
+extern struct boot_info boot_info;
+
 /**
  * Returns the greater value.
  *
@@ -79,7 +95,60 @@ static inline int negate(int x)
     return ~x + 1;
 }
 
-#define kprintf printf  /* Probably going to be removed later... */
+/**
+ * Divides a 64-bit unsigned integer by a 32-bit unsigned integer in place.
+ * The kernel isn't linked against libgcc, so 64-bit division must go through
+ * here instead of the '/' and '%' operators.
+ *
+ * @param n    - pointer to the dividend; receives the quotient
+ * @param base - the divisor
+ * @return the remainder
+ */
+static inline uint32_t div64(uint64_t *n, uint32_t base)
+{
+    uint32_t hi;
+    uint32_t lo;
+    uint32_t qhi;
+    uint32_t rem;
+
+    hi = (uint32_t) (*n >> 32);
+    lo = (uint32_t) *n;
+    qhi = 0;
+
+    /* Divide the upper half first so the quotient of 'divl' fits in 32-bits */
+    if (hi >= base) {
+        qhi = hi / base;
+        hi = hi % base;
+    }
+
+    __asm__ (
+        "divl   %2"
+        : "=a"(lo), "=d"(rem)
+        : "rm"(base), "0"(lo), "1"(hi)
+        : "cc"
+    );
+
+    *n = ((uint64_t) qhi << 32) | lo;
+    return rem;
+}
+
+/**
+ * Writes a formatted message to the kernel log at the given level. The
+ * message shows up on the console the next time the log is flushed.
+ *
+ * Each call site gets its own precompiled copy of the format string, so the
+ * format is only parsed the first time the call site is reached.
+ */
+#define kprintf_level(level, ...)                   \
+__extension__ ({                                    \
+    static struct printf_fmt __pf;                  \
+    klog_fmt(level, &__pf, __VA_ARGS__);            \
+})
+
+/**
+ * Writes a formatted message to the kernel log.
+ */
+#define kprintf(...)    kprintf_level(KLOG_INFO, __VA_ARGS__)
 
 
 
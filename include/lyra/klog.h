@@ -0,0 +1,85 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * Copyright (C) 2018 Wes Hampson. All Rights Reserved.                       *
+ *                                                                            *
+ * This file is part of the Lyra operating system.                            *
+ *                                                                            *
+ * Lyra is free software: you can redistribute it and/or modify               *
+ * it under the terms of version 2 of the GNU General Public License          *
+ * as published by the Free Software Foundation.                              *
+ *                                                                            *
+ * See LICENSE in the top-level directory for a copy of the license.          *
+ * You may also visit <https://www.gnu.org/licenses/gpl-2.0.txt>.             *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+/*-----------------------------------------------------------------------------
+ *   File: include/lyra/klog.h
+ * Author: Wes Hampson
+ *   Desc: Kernel log.
+ *----------------------------------------------------------------------------*/
+
+#ifndef __LYRA_KLOG_H
+#define __LYRA_KLOG_H
+
+/* Log levels, most severe first. */
+#define KLOG_ERR        0
+#define KLOG_WARN       1
+#define KLOG_INFO       2
+#define KLOG_DEBUG      3
+
+/* Messages at or above this level (i.e. numerically less than or equal) are
+   echoed to the console. */
+#define KLOG_CONSOLE_LEVEL  KLOG_INFO
+
+#ifndef __ASM
+#include <stdarg.h>
+#include <stdio.h>
+
+/**
+ * Appends a formatted message to the kernel log.
+ *
+ * The message is formatted into the log and nothing more; it reaches the
+ * consoles later, when klog_flush() is called. This makes it safe (and cheap)
+ * to log from interrupt handlers. Long messages are truncated.
+ *
+ * @param level - message severity (one of KLOG_*)
+ * @param fmt   - printf-style format string
+ * @return the length of the formatted message
+ */
+int klog(int level, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/**
+ * Like klog(), but uses a precompiled format (see cprintf()).
+ */
+int klog_fmt(int level, struct printf_fmt *pf, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+/**
+ * Like klog_fmt(), but takes a va_list. 'pf' may be NULL.
+ */
+int vklog(int level, struct printf_fmt *pf, const char *fmt, va_list args)
+    __attribute__((format(printf, 3, 0)));
+
+/**
+ * Writes any messages that haven't been seen yet to the console, and queues
+ * them for transmission on the serial console. If the serial transmit ring is
+ * full, the serial console picks up where it left off on the next call.
+ *
+ * @return the number of messages consumed
+ */
+int klog_flush(void);
+
+/**
+ * Like klog_flush(), but doesn't return until every message has gone out on
+ * the serial console too. Doesn't need interrupts; meant for fatal errors.
+ */
+void klog_sync(void);
+
+/**
+ * Prints the entire contents of the kernel log to the console.
+ */
+void dmesg(void);
+
+#endif /* __ASM */
+
+#endif /* __LYRA_KLOG_H */
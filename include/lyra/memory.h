@@ -20,7 +20,280 @@
 #ifndef __LYRA_MEMORY_H
 #define __LYRA_MEMORY_H
 
+#include <lyra/init.h>
+
+#define PAGE_SHIFT          12
+#define PAGE_SIZE           (1 << PAGE_SHIFT)           /* 4 KiB */
+#define LARGE_PAGE_SHIFT    22
+#define LARGE_PAGE_SIZE     (1 << LARGE_PAGE_SHIFT)     /* 4 MiB */
+
+/* Physical memory above the boot stack is handed out by the frame allocator.
+   All physical memory up to MEM_MAP_LIMIT is identity-mapped for the kernel,
+   so a frame's physical address is also its kernel virtual address. */
+#define FRAME_BASE          KERNEL_STACK_BASE
+#define MEM_MAP_LIMIT       0x10000000                  /* 256 MiB */
+
+/* User address space. Anything outside of this range belongs to the kernel. */
+#define USER_BASE           0x40000000                  /* 1 GiB */
+#define USER_LIMIT          0xC0000000                  /* 3 GiB */
+
+/* Task kernel stacks live in the 4 MiB just below user space. Unlike the rest
+   of the kernel, this area is mapped with 4 KiB pages, so that every stack
+   can have an unmapped guard page below it. The page table is shared by all
+   page directories. */
+#define KSTACK_AREA         (USER_BASE - LARGE_PAGE_SIZE)
+
+/* The boot stack's guard page. The first 4 MiB are mapped with 4 KiB pages
+   to make room for it. */
+#define KERNEL_STACK_GUARD  (KERNEL_STACK_BASE - KERNEL_STACK_SIZE - PAGE_SIZE)
+
+/* The initrd has to fit below the boot stack's guard page. */
+#define INITRD_MAX_SIZE     (KERNEL_STACK_GUARD - INITRD_START)
+
+/* Physical address of the kernel page directory. Every page directory maps
+   the kernel the same way; see pgdir_create(). */
+#define KERNEL_PGDIR        0x1000
+
+/* Page mapping flags; these line up with the low bits of a PDE/PTE. */
+#define PG_PRESENT          0x001   /* page is mapped */
+#define PG_RW               0x002   /* page is writable */
+#define PG_USER             0x004   /* page is accessible from ring 3 */
+#define PG_GLOBAL           0x100   /* kept in the TLB across CR3 loads */
+#define PG_COW              0x200   /* copy-on-write (first 'avail' bit) */
+
+/* Frame allocation flags. */
+#define GFP_ZERO            0x01    /* frame must be zero-filled */
+
+#ifndef __ASM
+#include <stdbool.h>
+#include <stdint.h>
+
+/* ===== Intel i386 Paging Structures ===== */
+/* See Chapter 3 of the Intel Software Developers Manual, Volume 3 for more
+   information about i386 memory paging structures.
+*/
+
+/* Page Directory Entry (PDE) for a 4 MiB page. */
+typedef union {
+    struct {
+        uint32_t p          : 1;  /* present */
+        uint32_t rw         : 1;  /* read/write; 1 = r/w, 0 = read only */
+        uint32_t us         : 1;  /* user/supervisor; 1 = user */
+        uint32_t pwt        : 1;  /* page-level write policy; 1 = WT, 0 = WB */
+        uint32_t pcd        : 1;  /* page-level cache disabled */
+        uint32_t a          : 1;  /* accessed; has been read or written */
+        uint32_t d          : 1;  /* dirty; has been written to */
+        uint32_t ps         : 1;  /* page size; 1 = 4 MiB */
+        uint32_t g          : 1;  /* global; don't flush from TLB */
+        uint32_t avail      : 3;  /* available for misc. use */
+        uint32_t pat        : 1;  /* page attr. table index */
+        uint32_t reserved   : 9;  /* reserved bits; set to 0 */
+        uint32_t base_addr  : 10; /* page base address (4 MiB aligned) */
+    } fields;
+    uint32_t value;
+} pde4m_t;
+
+/* Page Directory Entry (PDE) for a page table of 4 KiB pages. */
+typedef union {
+    struct {
+        uint32_t p          : 1;  /* (same descriptions as above) */
+        uint32_t rw         : 1;
+        uint32_t us         : 1;
+        uint32_t pwt        : 1;
+        uint32_t pcd        : 1;
+        uint32_t a          : 1;
+        uint32_t d          : 1;
+        uint32_t ps         : 1;
+        uint32_t g          : 1;
+        uint32_t avail      : 3;
+        uint32_t base_addr  : 20; /* page table base address (4 KiB aligned) */
+    } fields;
+    uint32_t value;
+} pde4k_t;
+
+/* Page Table Entry (PTE) for a 4 KiB page. */
+typedef union {
+    struct {
+        uint32_t p          : 1;  /* (same descriptions as above) */
+        uint32_t rw         : 1;
+        uint32_t us         : 1;
+        uint32_t pwt        : 1;
+        uint32_t pcd        : 1;
+        uint32_t a          : 1;
+        uint32_t d          : 1;
+        uint32_t pat        : 1;
+        uint32_t g          : 1;
+        uint32_t avail      : 3;
+        uint32_t base_addr  : 20; /* page base address (4 KiB aligned) */
+    } fields;
+    uint32_t value;
+} pte_t;
+
+/* Total amount of physical memory in bytes; valid after mem_init(). */
+extern uint32_t mem_size;
+
+/**
+ * Detects physical memory, sets up the kernel page directory, enables paging,
+ * and initializes the frame allocator.
+ */
 void mem_init(void);
+
 void flush_tlb(void);
 
+/**
+ * Reads a CMOS register.
+ *
+ * @param reg - register index
+ * @return the register's value
+ */
+uint8_t cmos_read(uint8_t reg);
+
+/**
+ * Creates a new page directory. The kernel's mappings are shared with the
+ * kernel page directory; the user portion of the address space starts out
+ * empty.
+ *
+ * @return the physical address of the page directory, or 0 if out of memory
+ */
+uint32_t pgdir_create(void);
+
+/**
+ * Destroys a page directory, freeing every frame mapped into the user
+ * portion of the address space along with the page tables themselves.
+ * The page directory must not be in use.
+ *
+ * @param pgdir - physical address of the page directory
+ */
+void pgdir_destroy(uint32_t pgdir);
+
+/**
+ * Loads a page directory into CR3.
+ *
+ * @param pgdir - physical address of the page directory
+ */
+void pgdir_switch(uint32_t pgdir);
+
+/**
+ * Copies the user portion of an address space for fork(). Pages are shared
+ * rather than copied: writable pages become read-only copy-on-write pages in
+ * both address spaces, and every shared frame gains a reference.
+ *
+ * @param dst - physical address of the new (empty) page directory
+ * @param src - physical address of the page directory to copy
+ * @return 0 on success, -1 if out of memory for page tables; dst must be
+ *         destroyed in that case
+ */
+int pgdir_clone(uint32_t dst, uint32_t src);
+
+/**
+ * Maps a 4 KiB page into the kernel stack area. The mapping is visible in
+ * every address space.
+ *
+ * @param vaddr - virtual address of the page, within KSTACK_AREA
+ * @param paddr - physical address of the frame to map
+ * @return 0 on success, -1 if vaddr is outside of the kernel stack area
+ */
+int kmap_page(uint32_t vaddr, uint32_t paddr);
+
+/**
+ * Unmaps a page from the kernel stack area.
+ *
+ * @param vaddr - virtual address of the page, within KSTACK_AREA
+ * @return the physical address of the frame that was mapped there, or 0 if
+ *         nothing was
+ */
+uint32_t kunmap_page(uint32_t vaddr);
+
+/**
+ * Translates a kernel virtual address into a physical address, e.g. for
+ * setting up DMA. Kernel memory is mapped the same way in every address
+ * space, so this works no matter which page directory is loaded.
+ *
+ * @param vaddr - the virtual address
+ * @return the physical address, or 0 if vaddr isn't mapped
+ */
+uint32_t virt_to_phys(uint32_t vaddr);
+
+/**
+ * Finds the page table entry for a virtual address in an area mapped with
+ * 4 KiB pages (i.e. user space or the kernel stack area).
+ *
+ * @param pgdir - physical address of the page directory
+ * @param vaddr - the virtual address
+ * @param alloc - allocate the page table if it doesn't exist yet
+ * @return a pointer to the PTE, or NULL if there is no page table
+ */
+pte_t * get_pte(uint32_t pgdir, uint32_t vaddr, bool alloc);
+
+/**
+ * Maps a 4 KiB page into the user portion of an address space, allocating a
+ * page table if necessary. Any existing mapping for the page is replaced.
+ *
+ * @param pgdir - physical address of the page directory
+ * @param vaddr - virtual address of the page
+ * @param paddr - physical address of the frame to map
+ * @param flags - PG_* flags
+ * @return 0 on success, -1 if vaddr is outside of user space or there's no
+ *         memory for a page table
+ */
+int map_page(uint32_t pgdir, uint32_t vaddr, uint32_t paddr, int flags);
+
+/**
+ * Initializes the page frame allocator.
+ *
+ * @param base  - physical address of the first frame to manage
+ * @param limit - physical address just past the last frame to manage
+ */
+void frame_init(uint32_t base, uint32_t limit);
+
+/**
+ * Allocates a 4 KiB page frame.
+ *
+ * @param flags - allocation flags (GFP_*)
+ * @return the physical address of the frame, or 0 if out of memory
+ */
+uint32_t frame_alloc(int flags);
+
+/**
+ * Drops a reference to a page frame, returning it to the allocator once the
+ * last reference is gone.
+ *
+ * @param addr - physical address of the frame
+ */
+void frame_free(uint32_t addr);
+
+/**
+ * Takes another reference to an allocated page frame, e.g. when it gets
+ * mapped into a second address space. Frames that don't belong to the
+ * allocator are ignored.
+ *
+ * @param addr - physical address of the frame
+ */
+void frame_ref(uint32_t addr);
+
+/**
+ * Gets the number of references to a page frame.
+ *
+ * @param addr - physical address of the frame
+ * @return the reference count, or -1 if the frame doesn't belong to the
+ *         allocator
+ */
+int frame_refcount(uint32_t addr);
+
+/**
+ * Zeroes a small batch of free frames and moves them to the pre-zeroed pool.
+ * Meant to be called from the idle loop with interrupts enabled.
+ *
+ * @return the number of frames zeroed; 0 when the pool is full or there are
+ *         no free frames left to zero
+ */
+int zero_pool_refill(void);
+
+/**
+ * Prints frame allocator and zero pool statistics.
+ */
+void frame_print_stats(void);
+
+#endif /* __ASM */
+
 #endif /* __LYRA_MEMORY_H */
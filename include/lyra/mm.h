@@ -0,0 +1,141 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * Copyright (C) 2018 Wes Hampson. All Rights Reserved.                       *
+ *                                                                            *
+ * This file is part of the Lyra operating system.                            *
+ *                                                                            *
+ * Lyra is free software: you can redistribute it and/or modify               *
+ * it under the terms of version 2 of the GNU General Public License          *
+ * as published by the Free Software Foundation.                              *
+ *                                                                            *
+ * See LICENSE in the top-level directory for a copy of the license.          *
+ * You may also visit <https://www.gnu.org/licenses/gpl-2.0.txt>.             *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+/*-----------------------------------------------------------------------------
+ *   File: include/lyra/mm.h
+ * Author: Wes Hampson
+ *   Desc: User address spaces.
+ *
+ * An address space is a page directory plus a short list of virtual memory
+ * areas (VMAs) describing what's supposed to be mapped where. Pages are only
+ * mapped on first touch, by the page fault handler, using the VMA to find out
+ * what should go there: part of a program image, or zeros.
+ *----------------------------------------------------------------------------*/
+
+#ifndef __LYRA_MM_H
+#define __LYRA_MM_H
+
+#include <lyra/memory.h>
+
+#define MAX_VMAS        8
+
+/* VMA flags. */
+#define VMA_READ        0x01
+#define VMA_WRITE       0x02
+#define VMA_EXEC        0x04
+#define VMA_GROWSDOWN   0x08    /* stack; grows down on demand */
+
+/* Page fault classes. */
+#define FAULT_DEMAND_ZERO   0   /* first touch of an anonymous page */
+#define FAULT_FILE          1   /* first touch of an image-backed page */
+#define FAULT_COW           2   /* write to a copy-on-write page */
+#define FAULT_STACK         3   /* stack growth */
+#define FAULT_INVALID       4   /* bad access; not resolved */
+#define NUM_FAULT_CLASSES   5
+
+/* Page fault error code bits. */
+#define PF_PRESENT      0x01    /* protection violation (page was present) */
+#define PF_WRITE        0x02    /* fault was caused by a write */
+#define PF_USER         0x04    /* fault happened in user mode */
+
+#ifndef __ASM
+#include <stdint.h>
+#include <lyra/interrupt.h>
+
+struct vma {
+    uint32_t start;             /* first address (page-aligned) */
+    uint32_t end;               /* address just past the end (page-aligned) */
+    int flags;                  /* VMA_* flags */
+    const char *image;          /* data backing 'start', or NULL if none */
+    uint32_t image_size;        /* bytes of backing data; the rest is zero */
+};
+
+struct mm {
+    uint32_t pgdir;             /* physical address of page directory */
+    int nvmas;
+    struct vma vmas[MAX_VMAS];  /* sorted by address, non-overlapping */
+};
+
+/**
+ * Initializes an empty address space with a fresh page directory.
+ *
+ * @param mm - the address space
+ * @return 0 on success, -1 if out of memory
+ */
+int mm_init(struct mm *mm);
+
+/**
+ * Tears down an address space, freeing everything that was mapped into it.
+ * The address space must not be in use.
+ *
+ * @param mm - the address space
+ */
+void mm_destroy(struct mm *mm);
+
+/**
+ * Makes a copy-on-write duplicate of an address space.
+ *
+ * @param dst - the new address space; initialized by this function
+ * @param src - the address space to duplicate
+ * @return 0 on success, -1 if out of memory
+ */
+int mm_fork(struct mm *dst, struct mm *src);
+
+/**
+ * Adds a VMA to an address space. Nothing gets mapped until the pages are
+ * touched.
+ *
+ * If 'image' is not NULL, the first 'image_size' bytes of the area are
+ * backed by that data. Image pages which are fully backed and never written
+ * may be mapped directly rather than copied, so the image must be
+ * page-aligned and must outlive the address space.
+ *
+ * @param mm         - the address space
+ * @param start      - first address of the area (page-aligned)
+ * @param end        - address just past the end of the area (page-aligned)
+ * @param flags      - VMA_* flags
+ * @param image      - backing data, or NULL
+ * @param image_size - number of bytes of backing data
+ * @return 0 on success, -1 if the area is outside of user space, overlaps
+ *         another area, or there are too many areas
+ */
+int vma_add(struct mm *mm, uint32_t start, uint32_t end, int flags,
+            const char *image, uint32_t image_size);
+
+/**
+ * Finds the VMA containing an address.
+ *
+ * @param mm   - the address space
+ * @param addr - a virtual address
+ * @return the VMA, or NULL if the address isn't part of any area
+ */
+struct vma * vma_find(struct mm *mm, uint32_t addr);
+
+/**
+ * Page fault handler. Reads the faulting address from CR2, classifies the
+ * fault (see FAULT_*), and resolves it if the access is allowed. A user
+ * process making an invalid access is killed.
+ *
+ * @param regs - the faulting context
+ * @return 0 if the fault was resolved, -1 if it's a kernel bug
+ */
+int do_page_fault(struct interrupt_frame *regs);
+
+/**
+ * Prints page fault counts and resolution latency for each fault class.
+ */
+void fault_print_stats(void);
+
+#endif /* __ASM */
+
+#endif /* __LYRA_MM_H */
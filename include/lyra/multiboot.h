@@ -0,0 +1,93 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * Copyright (C) 2018 Wes Hampson. All Rights Reserved.                       *
+ *                                                                            *
+ * This file is part of the Lyra operating system.                            *
+ *                                                                            *
+ * Lyra is free software: you can redistribute it and/or modify               *
+ * it under the terms of version 2 of the GNU General Public License          *
+ * as published by the Free Software Foundation.                              *
+ *                                                                            *
+ * See LICENSE in the top-level directory for a copy of the license.          *
+ * You may also visit <https://www.gnu.org/licenses/gpl-2.0.txt>.             *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+/*-----------------------------------------------------------------------------
+ *   File: include/lyra/multiboot.h
+ * Author: Wes Hampson
+ *   Desc: Multiboot (version 1) header and boot information structures.
+ *
+ * The kernel carries a Multiboot header (see lyra.ld), so any compliant
+ * loader (GRUB, or 'qemu -kernel') can start it directly, bypassing the
+ * floppy bootloader. See the Multiboot Specification, version 0.6.96, for
+ * more information.
+ *----------------------------------------------------------------------------*/
+
+#ifndef __LYRA_MULTIBOOT_H
+#define __LYRA_MULTIBOOT_H
+
+/* Multiboot header. */
+#define MB_HEADER_MAGIC     0x1BADB002
+#define MB_PAGE_ALIGN       0x00000001  /* load modules on page boundaries */
+#define MB_MEMORY_INFO      0x00000002  /* pass mem_* and mmap_* fields */
+#define MB_AOUT_KLUDGE      0x00010000  /* use the load addresses in the header */
+#define MB_HEADER_FLAGS     (MB_PAGE_ALIGN | MB_MEMORY_INFO | MB_AOUT_KLUDGE)
+#define MB_HEADER_CHECKSUM  (-(MB_HEADER_MAGIC + MB_HEADER_FLAGS))
+
+/* What the loader leaves in EAX. */
+#define MB_BOOT_MAGIC       0x2BADB002
+
+/* Boot information flags; which fields of 'struct multiboot_info' are valid. */
+#define MBI_MEMORY          0x00000001  /* mem_lower, mem_upper */
+#define MBI_CMDLINE         0x00000004  /* cmdline */
+#define MBI_MODS            0x00000008  /* mods_count, mods_addr */
+#define MBI_MMAP            0x00000040  /* mmap_length, mmap_addr */
+
+/* Memory map entry types. */
+#define MB_MMAP_AVAILABLE   1
+
+#ifndef __ASM
+#include <stdint.h>
+
+/* Boot information, as passed by the loader in EBX. */
+struct multiboot_info {
+    uint32_t flags;             /* MBI_* flags */
+    uint32_t mem_lower;         /* KiB of memory below 1 MiB */
+    uint32_t mem_upper;         /* KiB of memory above 1 MiB, up to the
+                                   first hole */
+    uint32_t boot_device;
+    uint32_t cmdline;           /* physical address of the command line */
+    uint32_t mods_count;        /* number of modules */
+    uint32_t mods_addr;         /* physical address of the module list */
+    uint32_t syms[4];
+    uint32_t mmap_length;       /* size of the memory map in bytes */
+    uint32_t mmap_addr;         /* physical address of the memory map */
+} __attribute__((packed));
+
+/* A module loaded alongside the kernel. */
+struct multiboot_module {
+    uint32_t mod_start;         /* physical address of the first byte */
+    uint32_t mod_end;           /* physical address of the last byte + 1 */
+    uint32_t string;            /* physical address of the module's string */
+    uint32_t reserved;
+} __attribute__((packed));
+
+/* Memory map entry. 'size' doesn't count itself, so the next entry is at
+   ((uint32_t) entry + entry->size + 4). */
+struct multiboot_mmap {
+    uint32_t size;
+    uint64_t base_addr;
+    uint64_t length;
+    uint32_t type;              /* MB_MMAP_* type */
+} __attribute__((packed));
+
+/**
+ * Fills in the boot info from the Multiboot information structure and moves
+ * the first module (the initrd) to INITRD_START. Called by the Multiboot entry
+ * point (see kernel/multiboot.S), before kernel_init().
+ *
+ * @param mbi - the Multiboot information structure
+ */
+void multiboot_init(const struct multiboot_info *mbi);
+
+#endif /* __ASM */
+
+#endif /* __LYRA_MULTIBOOT_H */
@@ -0,0 +1,200 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * Copyright (C) 2018 Wes Hampson. All Rights Reserved.                       *
+ *                                                                            *
+ * This file is part of the Lyra operating system.                            *
+ *                                                                            *
+ * Lyra is free software: you can redistribute it and/or modify               *
+ * it under the terms of version 2 of the GNU General Public License          *
+ * as published by the Free Software Foundation.                              *
+ *                                                                            *
+ * See LICENSE in the top-level directory for a copy of the license.          *
+ * You may also visit <https://www.gnu.org/licenses/gpl-2.0.txt>.             *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+/*-----------------------------------------------------------------------------
+ *   File: include/lyra/pcache.h
+ * Author: Wes Hampson
+ *   Desc: Page cache for block devices.
+ *----------------------------------------------------------------------------*/
+
+#ifndef __LYRA_PCACHE_H
+#define __LYRA_PCACHE_H
+
+#include <lyra/block.h>
+#include <lyra/memory.h>
+
+#define PCACHE_PAGES        512     /* cache size (2 MiB) */
+#define SECTORS_PER_PAGE    (PAGE_SIZE / SECTOR_SIZE)
+
+/* Cached page flags. */
+#define CP_VALID            0x01    /* holds the block's data */
+#define CP_DIRTY            0x02    /* modified; needs writing back */
+#define CP_BUSY             0x04    /* I/O in flight */
+#define CP_ERROR            0x08    /* last I/O failed */
+#define CP_READAHEAD        0x10    /* read ahead and not yet used */
+#define CP_RA_MARK          0x20    /* start the next read-ahead window when
+                                       this page is used */
+
+/* Read-ahead window sizes, in pages. */
+#define RA_MIN_PAGES        4
+#define RA_MAX_PAGES        32
+
+#ifndef __ASM
+#include <stdint.h>
+
+/* A page-sized block of a device, i.e. SECTORS_PER_PAGE sectors starting at
+   sector 'block * SECTORS_PER_PAGE'. */
+struct cpage {
+    struct blkdev *dev;
+    uint32_t block;
+    void *data;                 /* PAGE_SIZE bytes */
+    volatile int flags;         /* CP_* */
+    int queue;                  /* which 2Q queue the page is on */
+    int refcount;               /* users; pinned while nonzero */
+    uint32_t dirtied;           /* timer_ticks when it became dirty */
+    struct cpage *hash_next;
+    struct cpage *prev;         /* queue links */
+    struct cpage *next;
+    struct bio bio;             /* for reading/writing the page */
+};
+
+/* Read-ahead state of a sequential reader (e.g. an open file). Once a
+   stream is found to be sequential, each window of blocks read ahead is
+   twice the size of the previous one, up to RA_MAX_PAGES. The next window is
+   read when the reader gets to the first block of the current one that it
+   didn't ask for, so the I/O overlaps with the reader using the rest. */
+struct ra_state {
+    uint32_t start;             /* first block of the current window */
+    uint32_t size;              /* size of the current window */
+    uint32_t async_size;        /* blocks of it read ahead of the reader */
+    uint32_t next;              /* block expected next if sequential */
+};
+
+/**
+ * Sets up the page cache. Must be called after mem_init().
+ */
+void pcache_init(void);
+
+/**
+ * Gets a block from the cache, reading it in if it isn't there. The page is
+ * pinned until it's released with pcache_put().
+ *
+ * @param dev   - the device
+ * @param block - the block number (in pages)
+ * @return the page, or NULL on an I/O error or if the cache is full of
+ *         pinned and dirty pages
+ */
+struct cpage * pcache_get(struct blkdev *dev, uint32_t block);
+
+/**
+ * Gets a block from the cache on behalf of a sequential reader, reading
+ * ahead as it sees fit.
+ *
+ * @param ra    - the reader's read-ahead state
+ * @param dev   - the device
+ * @param block - the block number (in pages)
+ * @param req   - number of blocks the reader is after, including this one
+ * @return the page, or NULL on failure; see pcache_get()
+ */
+struct cpage * pcache_get_ra(struct ra_state *ra, struct blkdev *dev,
+                             uint32_t block, uint32_t req);
+
+/**
+ * Releases a page obtained with pcache_get().
+ *
+ * @param pg - the page
+ */
+void pcache_put(struct cpage *pg);
+
+/**
+ * Marks a pinned page as modified. It's written back by pcache_flush() once
+ * it's been dirty for a while, or by pcache_sync().
+ *
+ * @param pg - the page
+ */
+void pcache_mark_dirty(struct cpage *pg);
+
+/**
+ * Initializes the read-ahead state of a new reader.
+ *
+ * @param ra - the read-ahead state
+ */
+void pcache_ra_init(struct ra_state *ra);
+
+/**
+ * Reads sectors through the cache. Each call is treated as a new reader;
+ * see pcache_read_ra().
+ *
+ * @param dev    - the device
+ * @param sector - first sector
+ * @param buf    - where to put the data
+ * @param count  - number of sectors
+ * @return 0 on success, -1 on error
+ */
+int pcache_read(struct blkdev *dev, uint32_t sector, void *buf,
+                uint32_t count);
+
+/**
+ * Reads sectors through the cache on behalf of a sequential reader.
+ *
+ * @param ra     - the reader's read-ahead state
+ * @param dev    - the device
+ * @param sector - first sector
+ * @param buf    - where to put the data
+ * @param count  - number of sectors
+ * @return 0 on success, -1 on error
+ */
+int pcache_read_ra(struct ra_state *ra, struct blkdev *dev, uint32_t sector,
+                   void *buf, uint32_t count);
+
+/**
+ * Writes sectors through the cache. The data reaches the device later; see
+ * pcache_mark_dirty().
+ *
+ * @param dev    - the device
+ * @param sector - first sector
+ * @param buf    - the data
+ * @param count  - number of sectors
+ * @return 0 on success, -1 on error
+ */
+int pcache_write(struct blkdev *dev, uint32_t sector, const void *buf,
+                 uint32_t count);
+
+/**
+ * Starts writing back pages that have been dirty for a while, a batch at a
+ * time. Meant to be called from the idle loop.
+ *
+ * @return the number of pages written back
+ */
+int pcache_flush(void);
+
+/**
+ * Writes back every dirty page of a device and waits for the writes.
+ * Pages that are pinned are skipped. Interrupts must be enabled.
+ *
+ * @param dev - the device, or NULL for all devices
+ * @return 0 on success, -1 if a write failed or a dirty page was pinned
+ */
+int pcache_sync(struct blkdev *dev);
+
+/**
+ * Prints the hit rate, read-ahead and eviction statistics.
+ */
+void pcache_print_stats(void);
+
+#ifdef __BENCH
+/**
+ * Runs a few access patterns against a device through the cache: a cold
+ * sequential pass without and then with read-ahead, then a small hot set
+ * mixed with a long scan. Logs the cache statistics after each. Finally
+ * writes a few blocks back through pcache_sync() and checks them; their
+ * original contents are restored afterwards.
+ *
+ * @param dev - the device
+ */
+void pcache_bench(struct blkdev *dev);
+#endif
+
+#endif /* __ASM */
+
+#endif /* __LYRA_PCACHE_H */
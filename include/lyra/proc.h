@@ -20,7 +20,27 @@
 #ifndef __LYRA_PROC_H
 #define __LYRA_PROC_H
 
+#include <lyra/mm.h>
+
+#define NUM_TASKS       16
+#define TASK_NAME_LEN   16
+#define KSTACK_SIZE     PAGE_SIZE
+#define TIME_SLICE      10                  /* timer ticks */
+
+/* The user stack sits at the top of user space. It starts out one page
+   big and grows on demand, up to USER_STACK_MAX. */
+#define USER_STACK_TOP  USER_LIMIT
+#define USER_STACK_MAX  0x100000                /* 1 MiB */
+
+/* Task states. */
+#define TASK_UNUSED     0
+#define TASK_NEW        1       /* being created */
+#define TASK_RUNNABLE   2
+#define TASK_ZOMBIE     3       /* exited, waiting to be reaped */
+
+#ifndef __ASM
 #include <stdint.h>
+#include <lyra/interrupt.h>
 
 struct proc_ctx {
     uint32_t edi;
@@ -32,4 +52,141 @@ struct proc_ctx {
     uint32_t eax;
 };
 
+struct task {
+    int pid;
+    int state;                  /* TASK_* */
+    char name[TASK_NAME_LEN];
+    struct mm mm;               /* user address space */
+    uint32_t kstack;            /* base of kernel stack, in KSTACK_AREA;
+                                   0 for the idle task */
+    uint32_t esp;               /* saved kernel ESP while switched out */
+    int slice;                  /* timer ticks left before preemption */
+    int exit_code;
+};
+
+/* The task that currently owns the CPU. */
+extern struct task *current_task;
+
+/**
+ * Turns the running kernel thread into the idle task (PID 0) and sets up the
+ * task table. Must be called after mem_init().
+ */
+void proc_init(void);
+
+/**
+ * Creates a user process running an ELF executable. The program is paged in
+ * on demand straight from the image (see elf_load()), and gets a stack
+ * below USER_STACK_TOP. The process becomes runnable right away.
+ *
+ * @param name  - name of the process, for diagnostics
+ * @param image - the executable; must be page-aligned and outlive the
+ *                process
+ * @param size  - size of the executable in bytes
+ * @return the PID of the new process, or -1 if the image is invalid or no
+ *         task slot or memory is available
+ */
+int proc_create(const char *name, const void *image, uint32_t size);
+
+/**
+ * Duplicates the current process. The child gets a copy-on-write copy of the
+ * parent's address space and resumes from the same system call, with a
+ * return value of 0.
+ *
+ * @param regs - the parent's system call frame
+ * @return the PID of the child, or -1 if no task slot or memory is available
+ */
+int proc_fork(struct interrupt_frame *regs);
+
+/**
+ * Terminates the current task. Its resources are released later by
+ * proc_reap(), since the task is still running on its kernel stack.
+ *
+ * @param code - exit status
+ */
+__attribute__((noreturn))
+void proc_exit(int code);
+
+/**
+ * Frees the resources of tasks that have exited.
+ * Meant to be called from the idle loop.
+ *
+ * @return the number of tasks reaped
+ */
+int proc_reap(void);
+
+/**
+ * Checks whether a process is still around, i.e. hasn't been reaped yet.
+ *
+ * @param pid - the process ID
+ * @return true if the process exists
+ */
+bool proc_alive(int pid);
+
+/**
+ * Switches to the next runnable task in round-robin order, if there is one
+ * other than the current task.
+ *
+ * @return 1 if another task ran before this returned, 0 otherwise
+ */
+int schedule(void);
+
+/**
+ * Charges a timer tick to the current task, preempting it once its time
+ * slice runs out. Tasks are only preempted while running in user mode.
+ * Called from the timer interrupt after the EOI.
+ *
+ * @param regs - the interrupted context
+ */
+void sched_tick(const struct interrupt_frame *regs);
+
+/**
+ * Finds the task whose kernel stack guard page contains an address, i.e. the
+ * task that overflowed its kernel stack if the address faulted.
+ *
+ * @param addr - the faulting address
+ * @return the task, or NULL if the address isn't in a guard page
+ */
+struct task * kstack_guard_owner(uint32_t addr);
+
+/**
+ * Prints how deep the kernel stacks have gone so far: the idle task's, and
+ * the deepest of all other tasks, live or exited.
+ */
+void kstack_print_stats(void);
+
+/**
+ * Sets the kernel stack that ring 3 code lands on when it enters the kernel,
+ * both through the TSS and SYSENTER.
+ *
+ * @param esp - top of the kernel stack
+ */
+void set_kernel_stack(uint32_t esp);
+
+/**
+ * Switches kernel stacks. Saves the callee-saved registers on the current
+ * stack, stores the stack pointer to *prev_esp, then loads next_esp and
+ * restores the callee-saved registers from there.
+ * Defined in switch.S.
+ *
+ * @param prev_esp - where to save the current stack pointer
+ * @param next_esp - the stack to switch to
+ */
+void switch_context(uint32_t *prev_esp, uint32_t next_esp);
+
+/**
+ * Returns from an interrupt or system call using the frame on top of the
+ * stack. A forked child starts here.
+ * Defined in interrupt.S.
+ */
+void interrupt_return(void);
+
+/**
+ * Entry point of a freshly-created user task; loads the user data segments
+ * and irets into ring 3 using the frame on top of the stack.
+ * Defined in switch.S.
+ */
+void enter_user(void);
+
+#endif /* __ASM */
+
 #endif /* __LYRA_PROC_H */
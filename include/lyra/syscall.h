@@ -0,0 +1,120 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * Copyright (C) 2018 Wes Hampson. All Rights Reserved.                       *
+ *                                                                            *
+ * This file is part of the Lyra operating system.                            *
+ *                                                                            *
+ * Lyra is free software: you can redistribute it and/or modify               *
+ * it under the terms of version 2 of the GNU General Public License          *
+ * as published by the Free Software Foundation.                              *
+ *                                                                            *
+ * See LICENSE in the top-level directory for a copy of the license.          *
+ * You may also visit <https://www.gnu.org/licenses/gpl-2.0.txt>.             *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+/*-----------------------------------------------------------------------------
+ *   File: include/lyra/syscall.h
+ * Author: Wes Hampson
+ *   Desc: System call interface.
+ *
+ * System calls are made with 'int $0x80'. The system call number goes in EAX
+ * and up to five arguments go in EBX, ECX, EDX, ESI and EDI, in that order.
+ * The return value comes back in EAX; -1 indicates an error. All other
+ * registers are preserved.
+ *
+ * If the CPU supports it, SYSENTER may be used instead; it takes the same
+ * arguments, but a good deal less time. SYSEXIT needs to know where to return
+ * to, so the caller passes its stack pointer in EBP, with the return address
+ * on top of the stack. On return, ESP points just past the return address,
+ * and ECX and EDX are clobbered. For example:
+ *
+ *         pushl   %ebp
+ *         pushl   $1f
+ *         movl    %esp, %ebp
+ *         sysenter
+ *     1:  popl    %ebp
+ *----------------------------------------------------------------------------*/
+
+#ifndef __LYRA_SYSCALL_H
+#define __LYRA_SYSCALL_H
+
+/* System call numbers */
+#define SYS_READ        0       /* read(fd, buf, n) */
+#define SYS_WRITE       1       /* write(fd, buf, n) */
+#define SYS_TIME        2       /* time(t) */
+#define SYS_YIELD       3       /* yield() */
+#define SYS_EXIT        4       /* exit(status) */
+#define SYS_GETPID      5       /* getpid() */
+#define SYS_FORK        6       /* fork() */
+#define NUM_SYSCALLS    7
+
+/* File descriptors. There's no file system yet, so these are hard-wired to
+   the TTYs: 0-2 are the console, 3-6 are COM1-COM4. */
+#define FD_STDIN        0
+#define FD_STDOUT       1
+#define FD_STDERR       2
+#define FD_COM1         3
+#define NUM_FD          7
+
+#ifndef __ASM
+#include <stdbool.h>
+#include <stdint.h>
+#include <lyra/interrupt.h>
+
+/* Whether SYSENTER is available; valid after syscall_init(). */
+extern bool sysenter_enabled;
+
+/**
+ * Points the SYSENTER MSRs at the kernel's fast system call entry point, if
+ * the CPU supports SYSENTER.
+ */
+void syscall_init(void);
+
+/**
+ * Sets the stack that SYSENTER switches to.
+ * Should be kept in sync with the TSS's ESP0.
+ *
+ * @param esp - top of the kernel stack
+ */
+void sysenter_set_stack(uint32_t esp);
+
+/**
+ * System call dispatcher; called by the interrupt handler for SYSCALL_VEC.
+ *
+ * @param regs - the caller's registers
+ * @return the system call's return value, which is passed back in EAX
+ */
+__attribute__((fastcall))
+int do_syscall(struct interrupt_frame *regs);
+
+/**
+ * System call dispatcher for SYSENTER. Fetches the return address from the
+ * caller's stack, then calls do_syscall().
+ *
+ * @param regs - the caller's registers
+ * @return the system call's return value, which is passed back in EAX
+ */
+__attribute__((fastcall))
+int do_sysenter(struct interrupt_frame *regs);
+
+/* SYSENTER entry point. */
+extern void sysenter_entry(void);
+
+/**
+ * Checks whether a buffer passed to a system call lies entirely within the
+ * caller's address space. Kernel callers may pass any address.
+ *
+ * @param regs - the caller's registers
+ * @param addr - start of the buffer
+ * @param n    - size of the buffer in bytes
+ * @return true if the buffer may be accessed on behalf of the caller
+ */
+bool access_ok(const struct interrupt_frame *regs, uint32_t addr, uint32_t n);
+
+/**
+ * Prints call counts and latency histograms for each system call.
+ */
+void syscall_print_stats(void);
+
+#endif /* __ASM */
+
+#endif /* __LYRA_SYSCALL_H */
@@ -32,6 +32,10 @@
 
 #define TTY_QUEUE_BUFLEN    128
 
+/* Free space a write queue needs in order to accept one more character;
+   ONLCR can turn a single LF into a CR/LF pair. */
+#define TTY_WRITE_ROOM      2
+
 struct tty_queue {
     unsigned char data[TTY_QUEUE_BUFLEN];
     int head;
@@ -54,6 +58,11 @@ struct tty {
  */
 void tty_init(void);
 
+/**
+ * Get the TTY struct for a channel.
+ */
+struct tty * tty_get(int chan);
+
 /**
  * Read data from a TTY's input buffer.
  */
@@ -82,7 +82,7 @@ typedef uint32_t size_t;
  *      hh      - N/S       N/S                 N/A         N/A     N/A     N/A     N/S
  *      h       - short int unsigned short int  N/A         N/A     N/A     N/A     N/S
  *      l       - long int  unsigned long int   N/A         N/S+    N/S+    N/A     N/S
- *      ll      - N/S       N/S                 N/A         N/A     N/A     N/A     N/S
+ *      ll      - long long unsigned long long  N/A         N/A     N/A     N/A     N/S
  *      j       - N/S       N/S                 N/A         N/A     N/A     N/A     N/S
  *      z       - N/S       N/S                 N/A         N/A     N/A     N/A     N/S
  *      t       - N/S       N/S                 N/A         N/A     N/A     N/A     N/S
@@ -99,11 +99,54 @@ typedef uint32_t size_t;
  *          this system.
  */
 
-int printf(const char *fmt, ...);
-int vprintf(const char *fmt, va_list args);
-int sprintf(char *str, const char *fmt, ...);
-int vsprintf(char *str, const char *fmt, va_list args);
-int snprintf(char *str, size_t n, const char *fmt, ...);
-int vsnprintf(char *str, size_t n, const char *fmt, va_list args);
+int printf(const char *fmt, ...)
+    __attribute__((format(printf, 1, 2)));
+int vprintf(const char *fmt, va_list args)
+    __attribute__((format(printf, 1, 0)));
+int sprintf(char *str, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+int vsprintf(char *str, const char *fmt, va_list args)
+    __attribute__((format(printf, 2, 0)));
+int snprintf(char *str, size_t n, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+int vsnprintf(char *str, size_t n, const char *fmt, va_list args)
+    __attribute__((format(printf, 3, 0)));
+
+/**
+ * Precompiled format strings (non-standard).
+ *
+ * cprintf() behaves like printf() (and vcsnprintf() like vsnprintf()), but
+ * the format string is only parsed on the first call; the result is stored in
+ * 'pf' and later calls go straight to formatting the arguments. Each call
+ * site should have its own (static) 'struct printf_fmt', and must always pass
+ * the same format string with it. Formats with more than PRINTF_FMT_MAXSPEC
+ * conversions are not cached and are parsed on every call, like printf().
+ */
+#define PRINTF_FMT_MAXSPEC  8
+
+struct printf_spec {
+    uint16_t lit_off;       /* offset of literal text preceding conversion */
+    uint16_t lit_len;       /* length of literal text preceding conversion */
+    int16_t w;              /* width */
+    int16_t p;              /* precision */
+    uint8_t flags;          /* formatting flags */
+    char l;                 /* length specifier */
+    char conv;              /* conversion specifier, '\0' if none */
+};
+
+struct printf_fmt {
+    const char *fmt;        /* format string */
+    int state;              /* compilation state */
+    int nspec;              /* number of entries in 'spec' */
+    struct printf_spec spec[PRINTF_FMT_MAXSPEC + 1];    /* + trailing text */
+};
+
+int cprintf(struct printf_fmt *pf, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+int vcprintf(struct printf_fmt *pf, const char *fmt, va_list args)
+    __attribute__((format(printf, 2, 0)));
+int vcsnprintf(char *str, size_t n, struct printf_fmt *pf, const char *fmt,
+               va_list args)
+    __attribute__((format(printf, 4, 0)));
 
 #endif /* __STDIO_H */
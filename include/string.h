@@ -83,6 +83,16 @@ static inline size_t strlen(const char *str)
     return len;
 }
 
+static inline int strcmp(const char *s1, const char *s2)
+{
+    while (*s1 != '\0' && *s1 == *s2) {
+        s1++;
+        s2++;
+    }
+
+    return (unsigned char) *s1 - (unsigned char) *s2;
+}
+
 static inline char * strcat(char *dest, const char *src)
 {
     char *end;
@@ -132,44 +142,57 @@ static inline char * strrev(char *str)
 static inline void * memset(void *dest, int c, size_t n)
 {
     unsigned char ch;
+    int d0, d1;
     ch = (unsigned char) c;
 
     __asm__ volatile (
         "                               \n\
-    .memset_top%=:                      \n\
-        testl   %%ecx, %%ecx            \n\
-        jz      .memset_done%=          \n\
-        testl   $3, %%edi               \n\
-        jz      .memset_aligned%=       \n\
-        movb    %%al, (%%edi)           \n\
-        addl    $1, %%edi               \n\
-        subl    $1, %%ecx               \n\
-    .memset_aligned%=:                  \n\
         movw    %%ds, %%dx              \n\
         movw    %%dx, %%es              \n\
+        cld                             \n\
         movl    %%ecx, %%edx            \n\
         shrl    $2, %%ecx               \n\
         andl    $3, %%edx               \n\
-        cld                             \n\
         rep     stosl                   \n\
-    .memset_bottom%=:                   \n\
-        testl   %%edx, %%edx            \n\
-        jz      .memset_done%=          \n\
-        movb    %%al, (%%edi)           \n\
-        addl    $1, %%edi               \n\
-        subl    $1, %%edx               \n\
-    .memset_done%=:                     \n\
+        movl    %%edx, %%ecx            \n\
+        rep     stosb                   \n\
         "
-        :
-        : "D"(dest), "a"(ch << 24 | ch << 16 | ch << 8 | ch), "c"(n)
+        : "=&c"(d0), "=&D"(d1)
+        : "0"(n), "1"(dest), "a"(ch << 24 | ch << 16 | ch << 8 | ch)
         : "edx", "memory", "cc"
     );
 
     return dest;
 }
 
+static inline void * memcpy(void *dest, const void *src, size_t n)
+{
+    int d0, d1, d2;
+
+    __asm__ volatile (
+        "                               \n\
+        movw    %%ds, %%dx              \n\
+        movw    %%dx, %%es              \n\
+        cld                             \n\
+        movl    %%ecx, %%edx            \n\
+        shrl    $2, %%ecx               \n\
+        andl    $3, %%edx               \n\
+        rep     movsl                   \n\
+        movl    %%edx, %%ecx            \n\
+        rep     movsb                   \n\
+        "
+        : "=&c"(d0), "=&D"(d1), "=&S"(d2)
+        : "0"(n), "1"(dest), "2"(src)
+        : "edx", "cc", "memory"
+    );
+
+    return dest;
+}
+
 static inline void * memmove(void *dest, const void *src, size_t n)
 {
+    int d0, d1, d2;
+
     __asm__ volatile (
         "                               \n\
         movw    %%ds, %%dx              \n\
@@ -182,9 +205,10 @@ static inline void * memmove(void *dest, const void *src, size_t n)
         std                             \n\
     .memmove_start%=:                   \n\
         rep     movsb                   \n\
+        cld                             \n\
         "
-        :
-        : "D"(dest), "S"(src), "c"(n)
+        : "=&c"(d0), "=&D"(d1), "=&S"(d2)
+        : "0"(n), "1"(dest), "2"(src)
         : "edx", "cc", "memory"
     );
 
@@ -0,0 +1,413 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * Copyright (C) 2018 Wes Hampson. All Rights Reserved.                       *
+ *                                                                            *
+ * This file is part of the Lyra operating system.                            *
+ *                                                                            *
+ * Lyra is free software: you can redistribute it and/or modify               *
+ * it under the terms of version 2 of the GNU General Public License          *
+ * as published by the Free Software Foundation.                              *
+ *                                                                            *
+ * See LICENSE in the top-level directory for a copy of the license.          *
+ * You may also visit <https://www.gnu.org/licenses/gpl-2.0.txt>.             *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+/*-----------------------------------------------------------------------------
+ *   File: kernel/block.c
+ * Author: Wes Hampson
+ *   Desc: Generic block device layer.
+ *
+ * I/O is submitted as bios, each covering a run of consecutive sectors that
+ * may be scattered across several buffers. Bios are turned into requests,
+ * which are what the drivers work on: each device keeps a queue of requests
+ * sorted by sector, and a bio for sectors that are adjacent to a queued
+ * request is merged into it rather than getting a request of its own.
+ *
+ * Merging only pays off if bios pile up in the queue, so a device can be
+ * plugged while a batch of bios is submitted; the queue starts moving when
+ * it's unplugged. Drivers get one request at a time and may complete it
+ * right away (e.g. a RAM disk) or later from an interrupt handler.
+ *----------------------------------------------------------------------------*/
+
+#include <string.h>
+#include <lyra/kernel.h>
+#include <lyra/block.h>
+#include <lyra/interrupt.h>
+#include <lyra/proc.h>
+
+static struct blkdev *blkdevs[MAX_BLKDEVS];
+static int num_blkdevs;
+
+static struct request requests[MAX_REQUESTS];
+static bool request_used[MAX_REQUESTS];
+
+static struct request * alloc_request(void);
+static void free_request(struct request *req);
+static bool merge_bio(struct blkdev *dev, struct bio *bio);
+static void insert_request(struct blkdev *dev, struct request *req);
+static void run_queue(struct blkdev *dev, bool force);
+static void end_bio(struct blkdev *dev, struct bio *bio, int status);
+static void wait_for_io(void);
+static int blk_rw(struct blkdev *dev, int dir, uint32_t sector, void *buf,
+                  uint32_t count);
+
+int blkdev_register(struct blkdev *dev)
+{
+    if (num_blkdevs >= MAX_BLKDEVS) {
+        return -1;
+    }
+
+    dev->queue = NULL;
+    dev->active = NULL;
+    dev->plugged = 0;
+    dev->running = false;
+    memset(&dev->stats, 0, sizeof(struct blkdev_stats));
+    blkdevs[num_blkdevs++] = dev;
+
+    kprintf("%s: %lu sectors (%lu KiB)\n",
+        dev->name, dev->nr_sectors, dev->nr_sectors >> (10 - SECTOR_SHIFT));
+    return 0;
+}
+
+struct blkdev * blkdev_get(const char *name)
+{
+    int i;
+
+    for (i = 0; i < num_blkdevs; i++) {
+        if (strcmp(blkdevs[i]->name, name) == 0) {
+            return blkdevs[i];
+        }
+    }
+
+    return NULL;
+}
+
+void bio_init(struct bio *bio, struct blkdev *dev, int dir, uint32_t sector)
+{
+    memset(bio, 0, sizeof(struct bio));
+    bio->dev = dev;
+    bio->dir = dir;
+    bio->sector = sector;
+    bio->status = BIO_PENDING;
+}
+
+int bio_add_buf(struct bio *bio, void *buf, uint32_t len)
+{
+    if (bio->nvecs >= BIO_MAX_VECS
+            || len == 0 || (len & (SECTOR_SIZE - 1)) != 0) {
+        return -1;
+    }
+
+    bio->vecs[bio->nvecs].buf = buf;
+    bio->vecs[bio->nvecs].len = len;
+    bio->nvecs++;
+    bio->nr_sectors += len >> SECTOR_SHIFT;
+
+    return 0;
+}
+
+int submit_bio(struct bio *bio)
+{
+    struct blkdev *dev;
+    struct request *req;
+    uint32_t eflags;
+
+    dev = bio->dev;
+    bio->status = BIO_PENDING;
+    bio->next = NULL;
+
+    if (bio->nr_sectors == 0 || bio->nr_sectors > dev->max_sectors
+            || bio->sector >= dev->nr_sectors
+            || bio->nr_sectors > dev->nr_sectors - bio->sector) {
+        cli_save(eflags);
+        end_bio(dev, bio, -1);
+        restore_flags(eflags);
+        return -1;
+    }
+
+    cli_save(eflags);
+    dev->stats.bios++;
+
+    if (merge_bio(dev, bio)) {
+        dev->stats.merges++;
+        restore_flags(eflags);
+        return 0;
+    }
+
+    while ((req = alloc_request()) == NULL) {
+        /* Every request is in use. Push this device's queue out, plug or no
+           plug, and wait for some of them to come back. */
+        restore_flags(eflags);
+        run_queue(dev, true);
+        wait_for_io();
+        cli_save(eflags);
+    }
+
+    req->dir = bio->dir;
+    req->sector = bio->sector;
+    req->nr_sectors = bio->nr_sectors;
+    req->bio = bio;
+    req->biotail = bio;
+    insert_request(dev, req);
+    restore_flags(eflags);
+
+    run_queue(dev, false);
+    return 0;
+}
+
+void blk_plug(struct blkdev *dev)
+{
+    uint32_t eflags;
+
+    cli_save(eflags);
+    dev->plugged++;
+    restore_flags(eflags);
+}
+
+void blk_unplug(struct blkdev *dev)
+{
+    uint32_t eflags;
+
+    cli_save(eflags);
+    if (dev->plugged > 0) {
+        dev->plugged--;
+    }
+    restore_flags(eflags);
+
+    run_queue(dev, false);
+}
+
+int bio_wait(struct bio *bio)
+{
+    while (bio->status == BIO_PENDING) {
+        wait_for_io();
+    }
+
+    return bio->status;
+}
+
+int blk_read(struct blkdev *dev, uint32_t sector, void *buf, uint32_t count)
+{
+    return blk_rw(dev, BIO_READ, sector, buf, count);
+}
+
+int blk_write(struct blkdev *dev, uint32_t sector, const void *buf,
+              uint32_t count)
+{
+    return blk_rw(dev, BIO_WRITE, sector, (void *) buf, count);
+}
+
+void blk_end_request(struct blkdev *dev, struct request *req, int status)
+{
+    struct bio *bio;
+    struct bio *next;
+    uint32_t eflags;
+
+    cli_save(eflags);
+    if (dev->active == req) {
+        dev->active = NULL;
+    }
+
+    for (bio = req->bio; bio != NULL; bio = next) {
+        next = bio->next;
+        end_bio(dev, bio, status);
+    }
+    free_request(req);
+    restore_flags(eflags);
+
+    run_queue(dev, false);
+}
+
+void blk_print_stats(void)
+{
+    struct blkdev *dev;
+    struct blkdev_stats *st;
+    int i;
+
+    for (i = 0; i < num_blkdevs; i++) {
+        dev = blkdevs[i];
+        st = &dev->stats;
+        kprintf("%s: %lu bios, %lu merged, %lu requests (avg %lu sectors), "
+            "%lu errors\n",
+            dev->name, st->bios, st->merges, st->requests,
+            (st->requests > 0)
+                ? (st->sectors_read + st->sectors_written) / st->requests
+                : 0,
+            st->errors);
+        kprintf("%s: %lu sectors read, %lu written\n",
+            dev->name, st->sectors_read, st->sectors_written);
+    }
+}
+
+static struct request * alloc_request(void)
+{
+    int i;
+
+    for (i = 0; i < MAX_REQUESTS; i++) {
+        if (!request_used[i]) {
+            request_used[i] = true;
+            memset(&requests[i], 0, sizeof(struct request));
+            return &requests[i];
+        }
+    }
+
+    return NULL;
+}
+
+static void free_request(struct request *req)
+{
+    request_used[req - requests] = false;
+}
+
+/**
+ * Tries to merge a bio into one of the queued requests, either at its end
+ * (back merge) or at its start (front merge).
+ * Interrupts must be disabled.
+ */
+static bool merge_bio(struct blkdev *dev, struct bio *bio)
+{
+    struct request *req;
+
+    for (req = dev->queue; req != NULL; req = req->next) {
+        if (req->dir != bio->dir
+                || req->nr_sectors + bio->nr_sectors > dev->max_sectors) {
+            continue;
+        }
+
+        if (req->sector + req->nr_sectors == bio->sector) {
+            req->biotail->next = bio;
+            req->biotail = bio;
+            req->nr_sectors += bio->nr_sectors;
+            return true;
+        }
+
+        if (bio->sector + bio->nr_sectors == req->sector) {
+            bio->next = req->bio;
+            req->bio = bio;
+            req->sector = bio->sector;
+            req->nr_sectors += bio->nr_sectors;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Inserts a request into the queue, keeping it sorted by sector so that the
+ * device sweeps across the disk in one direction.
+ * Interrupts must be disabled.
+ */
+static void insert_request(struct blkdev *dev, struct request *req)
+{
+    struct request **pos;
+
+    pos = &dev->queue;
+    while (*pos != NULL && (*pos)->sector <= req->sector) {
+        pos = &(*pos)->next;
+    }
+
+    req->next = *pos;
+    *pos = req;
+}
+
+/**
+ * Hands queued requests to the driver, one at a time, for as long as it's
+ * idle and the queue isn't plugged.
+ *
+ * @param dev   - the device
+ * @param force - ignore the plug
+ */
+static void run_queue(struct blkdev *dev, bool force)
+{
+    struct request *req;
+    uint32_t eflags;
+
+    cli_save(eflags);
+
+    /* A driver that completes requests synchronously calls back in here
+       through blk_end_request(); the loop below picks up where it left off
+       instead of recursing. */
+    if (dev->running) {
+        restore_flags(eflags);
+        return;
+    }
+    dev->running = true;
+
+    while (dev->active == NULL && dev->queue != NULL
+            && (force || dev->plugged == 0)) {
+        req = dev->queue;
+        dev->queue = req->next;
+        req->next = NULL;
+        dev->active = req;
+
+        dev->stats.requests++;
+        if (req->dir == BIO_READ) {
+            dev->stats.sectors_read += req->nr_sectors;
+        }
+        else {
+            dev->stats.sectors_written += req->nr_sectors;
+        }
+
+        restore_flags(eflags);
+        dev->ops->transfer(dev, req);
+        cli_save(eflags);
+    }
+
+    dev->running = false;
+    restore_flags(eflags);
+}
+
+/**
+ * Completes a bio.
+ * Interrupts must be disabled.
+ */
+static void end_bio(struct blkdev *dev, struct bio *bio, int status)
+{
+    bio->next = NULL;
+    bio->status = status;
+    if (status != 0) {
+        dev->stats.errors++;
+    }
+
+    if (bio->end_io != NULL) {
+        bio->end_io(bio);
+    }
+}
+
+/**
+ * Lets other tasks run while waiting for an I/O to complete, or sleeps until
+ * the next interrupt if there's nobody else.
+ */
+static void wait_for_io(void)
+{
+    if (schedule() == 0) {
+        __asm__ volatile ("hlt" : : : "memory");
+    }
+}
+
+/**
+ * Transfers consecutive sectors synchronously, split into bios that the
+ * driver can take in one go.
+ */
+static int blk_rw(struct blkdev *dev, int dir, uint32_t sector, void *buf,
+                  uint32_t count)
+{
+    struct bio bio;
+    uint32_t n;
+
+    while (count > 0) {
+        n = (count < dev->max_sectors) ? count : dev->max_sectors;
+
+        bio_init(&bio, dev, dir, sector);
+        bio_add_buf(&bio, buf, n << SECTOR_SHIFT);
+        if (submit_bio(&bio) != 0 || bio_wait(&bio) != 0) {
+            return -1;
+        }
+
+        sector += n;
+        buf = (uint8_t *) buf + (n << SECTOR_SHIFT);
+        count -= n;
+    }
+
+    return 0;
+}
@@ -27,7 +27,6 @@
 #include <lyra/io.h>
 #include <lyra/kernel.h>
 #include <drivers/vga.h>
-#include <drivers/ps2kbd.h>
 #include <drivers/pcspk.h>
 
 #define BEL_TICKS   150
@@ -181,7 +180,6 @@ void console_init(void)
 {
     uint16_t pos;
 
-    ps2kbd_init();
     vga_init();
 
     memset(cons, 0, sizeof(cons));
@@ -264,6 +262,12 @@ int console_write(struct tty *tty)
         count++;
     }
 
+    /* Moving the hardware cursor means a handful of slow port writes, so do it
+       once per batch rather than once per character. */
+    if (count > 0) {
+        do_cursor_update();
+    }
+
     return count;
 }
 
@@ -272,13 +276,11 @@ static void process_char(struct tty *tty, unsigned char c)
     int pos;
     bool update_char;
     bool update_attr;
-    bool update_cursor;
     bool needs_newline;
 
     pos = xy2pos(m_cursor.x, m_cursor.y);
     update_char = false;
     update_attr = false;
-    update_cursor = true;
     needs_newline = false;
 
     if (iscntrl(c)) {
@@ -348,9 +350,6 @@ move_cursor:
         carriage_return();
         linefeed();
     }
-    if (update_cursor) {
-        do_cursor_update();
-    }
 }
 
 static void handle_esc(unsigned char c)
@@ -0,0 +1,72 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * Copyright (C) 2018 Wes Hampson. All Rights Reserved.                       *
+ *                                                                            *
+ * This file is part of the Lyra operating system.                            *
+ *                                                                            *
+ * Lyra is free software: you can redistribute it and/or modify               *
+ * it under the terms of version 2 of the GNU General Public License          *
+ * as published by the Free Software Foundation.                              *
+ *                                                                            *
+ * See LICENSE in the top-level directory for a copy of the license.          *
+ * You may also visit <https://www.gnu.org/licenses/gpl-2.0.txt>.             *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+/*-----------------------------------------------------------------------------
+ *   File: kernel/cpu.c
+ * Author: Wes Hampson
+ *   Desc: CPU feature detection.
+ *----------------------------------------------------------------------------*/
+
+#include <lyra/cpu.h>
+
+#define EFLAGS_ID   (1 << 21)   /* CPUID available if this bit can be toggled */
+
+uint32_t cpu_features = 0;
+uint32_t cpu_signature = 0;
+
+static bool has_cpuid(void);
+
+void cpu_init(void)
+{
+    uint32_t a, b, c, d;
+
+    if (!has_cpuid()) {
+        /* 386 or early 486, no optional features at all */
+        return;
+    }
+
+    cpuid(0, &a, &b, &c, &d);
+    if (a < 1) {
+        return;
+    }
+
+    cpuid(1, &a, &b, &c, &d);
+    cpu_signature = a;
+    cpu_features = d;
+}
+
+static bool has_cpuid(void)
+{
+    uint32_t before;
+    uint32_t after;
+
+    __asm__ volatile (
+        "                           \n\
+        pushfl                      \n\
+        popl    %0                  \n\
+        movl    %0, %1              \n\
+        xorl    %2, %1              \n\
+        pushl   %1                  \n\
+        popfl                       \n\
+        pushfl                      \n\
+        popl    %1                  \n\
+        pushl   %0                  \n\
+        popfl                       \n\
+        "
+        : "=&r"(before), "=&r"(after)
+        : "i"(EFLAGS_ID)
+        : "cc"
+    );
+
+    return ((before ^ after) & EFLAGS_ID) != 0;
+}
@@ -0,0 +1,141 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * Copyright (C) 2018 Wes Hampson. All Rights Reserved.                       *
+ *                                                                            *
+ * This file is part of the Lyra operating system.                            *
+ *                                                                            *
+ * Lyra is free software: you can redistribute it and/or modify               *
+ * it under the terms of version 2 of the GNU General Public License          *
+ * as published by the Free Software Foundation.                              *
+ *                                                                            *
+ * See LICENSE in the top-level directory for a copy of the license.          *
+ * You may also visit <https://www.gnu.org/licenses/gpl-2.0.txt>.             *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+/*-----------------------------------------------------------------------------
+ *   File: kernel/elf.c
+ * Author: Wes Hampson
+ *   Desc: ELF32 program loader.
+ *
+ * Loading a program doesn't copy anything. Every PT_LOAD segment is turned
+ * into a VMA backed by the image, and the page fault handler brings pages in
+ * as the program touches them, so a large program starts as fast as a small
+ * one and only costs memory for the pages it actually uses.
+ *----------------------------------------------------------------------------*/
+
+#include <stdbool.h>
+#include <lyra/kernel.h>
+#include <lyra/elf.h>
+
+static bool valid_header(const Elf32_Ehdr *eh, uint32_t size);
+static int load_segment(struct mm *mm, const char *image, uint32_t size,
+                        const Elf32_Phdr *ph);
+
+int elf_load(struct mm *mm, const void *image, uint32_t size, uint32_t *entry)
+{
+    const Elf32_Ehdr *eh;
+    const Elf32_Phdr *ph;
+    int i;
+
+    eh = (const Elf32_Ehdr *) image;
+    if (!valid_header(eh, size)) {
+        return -1;
+    }
+
+    ph = (const Elf32_Phdr *) ((const char *) image + eh->e_phoff);
+    for (i = 0; i < eh->e_phnum; i++) {
+        if (ph[i].p_type != PT_LOAD) {
+            continue;
+        }
+        if (load_segment(mm, (const char *) image, size, &ph[i]) != 0) {
+            return -1;
+        }
+    }
+
+    if (vma_find(mm, eh->e_entry) == NULL) {
+        return -1;
+    }
+
+    *entry = eh->e_entry;
+    return 0;
+}
+
+static bool valid_header(const Elf32_Ehdr *eh, uint32_t size)
+{
+    if (size < sizeof(Elf32_Ehdr)) {
+        return false;
+    }
+
+    if (eh->e_ident[EI_MAG0] != ELFMAG0
+            || eh->e_ident[EI_MAG1] != ELFMAG1
+            || eh->e_ident[EI_MAG2] != ELFMAG2
+            || eh->e_ident[EI_MAG3] != ELFMAG3
+            || eh->e_ident[EI_CLASS] != ELFCLASS32
+            || eh->e_ident[EI_DATA] != ELFDATA2LSB
+            || eh->e_ident[EI_VERSION] != EV_CURRENT) {
+        return false;
+    }
+
+    if (eh->e_type != ET_EXEC || eh->e_machine != EM_386
+            || eh->e_phentsize != sizeof(Elf32_Phdr)) {
+        return false;
+    }
+
+    /* The program header table must lie within the image. */
+    if (eh->e_phoff > size
+            || eh->e_phnum > (size - eh->e_phoff) / sizeof(Elf32_Phdr)) {
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Creates the VMA for a PT_LOAD segment.
+ */
+static int load_segment(struct mm *mm, const char *image, uint32_t size,
+                        const Elf32_Phdr *ph)
+{
+    uint32_t start;
+    uint32_t end;
+    uint32_t lead;
+    int flags;
+
+    if (ph->p_memsz == 0) {
+        return 0;
+    }
+
+    /* File data must lie within the image, and the file offset must be
+       congruent to the address so that pages can be backed directly. */
+    if (ph->p_filesz > ph->p_memsz
+            || ph->p_offset > size || ph->p_filesz > size - ph->p_offset
+            || (ph->p_offset & (PAGE_SIZE - 1))
+                != (ph->p_vaddr & (PAGE_SIZE - 1))) {
+        return -1;
+    }
+
+    /* Check for wrap-around before rounding up. */
+    if (ph->p_vaddr + ph->p_memsz < ph->p_vaddr
+            || ph->p_vaddr + ph->p_memsz > USER_LIMIT) {
+        return -1;
+    }
+
+    start = ph->p_vaddr & ~(PAGE_SIZE - 1);
+    end = (ph->p_vaddr + ph->p_memsz + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    lead = ph->p_vaddr - start;
+
+    flags = 0;
+    if (flag_set(ph->p_flags, PF_R)) {
+        flags |= VMA_READ;
+    }
+    if (flag_set(ph->p_flags, PF_W)) {
+        flags |= VMA_WRITE;
+    }
+    if (flag_set(ph->p_flags, PF_X)) {
+        flags |= VMA_EXEC;
+    }
+
+    /* The bytes of the first page before p_vaddr come from the file as well;
+       that's where the ELF headers usually end up. */
+    return vma_add(mm, start, end, flags,
+        image + ph->p_offset - lead, ph->p_filesz + lead);
+}
@@ -20,7 +20,11 @@
 #include <stdbool.h>
 #include <string.h>
 #include <lyra/console.h>
+#include <lyra/descriptor.h>
 #include <lyra/exception.h>
+#include <lyra/kernel.h>
+#include <lyra/mm.h>
+#include <lyra/proc.h>
 #include <drivers/vga.h>
 
 /* Names of all non-Intel-reserved exceptions. */
@@ -81,7 +85,7 @@ struct err_code {
 };
 
 static void handle_unknown_exception(int num);
-static void exception_halt(void);
+__attribute__((noreturn)) static void exception_halt(void);
 static void dump_regs(struct interrupt_frame *regs);
 static void blue_screen(int num, bool has_error_code, struct interrupt_frame *regs);
 
@@ -111,15 +115,68 @@ void do_exception(struct interrupt_frame *regs)
             break;
     }
 
-    /* TODO: kill process unless exception happens in kernel */
+    if (num == EXCEPT_PF && do_page_fault(regs) == 0) {
+        return;
+    }
+
+    if ((regs->cs & 3) == PRIVL_USER) {
+        kprintf_level(KLOG_ERR, "%s[%d]: %s at %08lX, killed\n",
+            current_task->name, current_task->pid, EXCEPTION_NAMES[num],
+            regs->eip);
+        proc_exit(-1);
+    }
 
     blue_screen(num, has_err_code, regs);
     exception_halt();
 }
 
+void double_fault_task(void)
+{
+    struct interrupt_frame regs;
+    struct task *t;
+    uint32_t cr2;
+
+    /* The task switch saved the context that double faulted in the kernel
+       TSS. */
+    memset(&regs, 0, sizeof(struct interrupt_frame));
+    regs.eax = kernel_tss.eax;
+    regs.ebx = kernel_tss.ebx;
+    regs.ecx = kernel_tss.ecx;
+    regs.edx = kernel_tss.edx;
+    regs.esi = kernel_tss.esi;
+    regs.edi = kernel_tss.edi;
+    regs.ebp = kernel_tss.ebp;
+    regs.esp = kernel_tss.esp;
+    regs.eip = kernel_tss.eip;
+    regs.eflags = kernel_tss.eflags;
+    regs.cs = kernel_tss.cs;
+    regs.ds = kernel_tss.ds;
+    regs.es = kernel_tss.es;
+    regs.fs = kernel_tss.fs;
+    regs.gs = kernel_tss.gs;
+    regs.vec_num = EXCEPT_DF;
+
+    /* A kernel stack overflow shows up as a page fault on the guard page,
+       which double faults when the CPU tries to push the exception frame
+       onto that same stack. */
+    __asm__ volatile ("movl %%cr2, %0" : "=r"(cr2));
+    t = kstack_guard_owner(cr2);
+    if (t == NULL) {
+        t = kstack_guard_owner(regs.esp);
+    }
+
+    blue_screen(EXCEPT_DF, true, &regs);
+    if (t != NULL) {
+        printf("\033[%d;%dHkernel stack overflow in %s[%d]",
+            13, (CON_COLS / 2) - 16, t->name, t->pid);
+    }
+    exception_halt();
+}
+
 static void handle_unknown_exception(int num)
 {
-    kprintf("Unknown exception! (%x)\n", num);
+    klog_sync();
+    printf("Unknown exception! (%x)\n", num);
     exception_halt();
 }
 
@@ -127,6 +184,7 @@ static void exception_halt(void)
 {
     /* Deathbed... */
     __asm__ volatile ("cli; .rip%=: hlt; jmp .rip%=" : : : "memory");
+    __builtin_unreachable();
 }
 
 static void dump_regs(struct interrupt_frame *regs)
@@ -152,11 +210,11 @@ static void dump_regs(struct interrupt_frame *regs)
     }
     strcat(fl_str, "]");
 
-    kprintf("EAX = %08X, EBX = %08X, ECX = %08X, EDX = %08X\r\n",
+    printf("EAX = %08lX, EBX = %08lX, ECX = %08lX, EDX = %08lX\r\n",
         regs->eax, regs->ebx, regs->ecx, regs->edx);
-    kprintf("ESI = %08X, EDI = %08X, EBP = %08X, ESP = %08X\r\n",
+    printf("ESI = %08lX, EDI = %08lX, EBP = %08lX, ESP = %08lX\r\n",
         regs->esi, regs->edi, regs->ebp, regs->esp);
-    kprintf("EIP = %08X, EFLAGS = %s",
+    printf("EIP = %08lX, EFLAGS = %s",
         regs->eip, fl_str);
 }
 
@@ -166,7 +224,10 @@ static void blue_screen(int num, bool has_error_code, struct interrupt_frame *re
     size_t len;
     int row, col;
 
-    kprintf("\033[0;44m\033[2J");
+    /* Get the last words out, at least on the serial console; the screen is
+       about to be cleared. */
+    klog_sync();
+    printf("\033[0;44m\033[2J");
 
     /* TODO: sprintf would be really useful here... */
 
@@ -174,35 +235,35 @@ static void blue_screen(int num, bool has_error_code, struct interrupt_frame *re
     len = strlen(s) + 4;
     row = 4;
     col = (CON_COLS / 2) - (len / 2);
-    kprintf("\033[%d;%dH\033[34;47m  %s  ", row, col, OS_NAME);
+    printf("\033[%d;%dH\033[34;47m  %s  ", row, col, OS_NAME);
 
     row = 7;
     col = (CON_COLS / 2) - 23;
-    kprintf("\033[%d;%dH\033[37;44m", row, col);
-    kprintf("A fatal exception \033[1m%02X\033[21m has occurred at \033[1m%08X\033[21m.",
+    printf("\033[%d;%dH\033[37;44m", row, col);
+    printf("A fatal exception \033[1m%02X\033[21m has occurred at \033[1m%08lX\033[21m.",
         num, regs->eip);
 
     s = "Your computer must be restarted.";
     len = strlen(s);
     row = 8;
     col = (CON_COLS / 2) - (len / 2);
-    kprintf("\033[%d;%dH%s", row, col, s);
+    printf("\033[%d;%dH%s", row, col, s);
 
     s = EXCEPTION_NAMES[num];
     len = strlen(s);
     row = 11;
     col = (CON_COLS / 2) - (len / 2);
-    kprintf("\033[%d;%dH\033[1m%s\033[21m", row, col, s);
+    printf("\033[%d;%dH\033[1m%s\033[21m", row, col, s);
 
     if (has_error_code) {
         row = 12;
         col = (CON_COLS / 2) - 2;
-        kprintf("\033[%d;%dH%04X", row, col, regs->err_code);
+        printf("\033[%d;%dH%04lX", row, col, regs->err_code);
     }
 
     row = CON_ROWS - 2;
     col = 1;
-    kprintf("\033[%d;%dH", row, col);
+    printf("\033[%d;%dH", row, col);
     dump_regs(regs);
 
     hide_cursor();
@@ -20,27 +20,129 @@
 
 #include <lyra/kernel.h>
 #include <lyra/console.h>
+#include <lyra/cpu.h>
+#include <lyra/exception.h>
+#include <lyra/input.h>
 #include <lyra/tty.h>
 #include <lyra/descriptor.h>
 #include <lyra/interrupt.h>
 #include <lyra/irq.h>
 #include <lyra/io.h>
 #include <lyra/memory.h>
+#include <lyra/pcache.h>
+#include <lyra/proc.h>
+#include <lyra/syscall.h>
+#include <drivers/ata.h>
+#include <drivers/floppy.h>
+#include <drivers/ps2kbd.h>
+#include <drivers/ramdisk.h>
 #include <drivers/timer.h>
+#include <drivers/uart.h>
 #include <string.h>
 
 const char * const OS_NAME = "Lyra";
 
 /* The TSS. */
-static struct tss_struct tss = { 0 };
+struct tss_struct kernel_tss = { 0 };
+
+/* The double fault handler runs as its own task, so that it gets a known-good
+   stack even when the fault was caused by overflowing a kernel stack. */
+static struct tss_struct df_tss = { 0 };
+static uint8_t df_stack[PAGE_SIZE] __attribute__((aligned(16)));
 
 /* The LDT.
    We're not using LDTs on our system, but we need one to keep the CPU happy. */
 static seg_desc_t ldt[2];
 
+/* The built-in init program; see user_init.S. */
+extern const char user_init_start[];
+extern const char user_init_end[];
+
+#define SHELL_LINE_LEN      64
+
+#ifdef __BENCH
+#define BOOT_TRACE_MAX      32
+#define TSC_CALIBRATE_MS    10
+
+/* When each phase of the boot finished, in the order they ran. */
+static struct {
+    const char *phase;
+    uint64_t tsc;
+} boot_trace_log[BOOT_TRACE_MAX];
+static int boot_trace_count;
+#endif
+
 static void ldt_init(void);
 static void tss_init(void);
+static void df_tss_init(void);
+static void timer_init(void);
 static void mini_shell(void);
+static bool poll_initcalls(const struct initcall *calls, int count,
+                           uint32_t started, uint32_t *done);
+
+/* Initcall IDs, for the dependency masks. */
+enum {
+    INIT_CPU,
+    INIT_LDT,
+    INIT_TSS,
+    INIT_DF_TSS,
+    INIT_IDT,
+    INIT_SYSCALL,
+    INIT_IRQ,
+    INIT_PS2KBD,
+    INIT_CONSOLE,
+    INIT_TTY,
+    INIT_UART,
+    INIT_MEM,
+    INIT_PROC,
+    INIT_TIMER,
+    INIT_PCACHE,
+    INIT_RAMDISK,
+    INIT_ATA,
+    INIT_FLOPPY,
+    NUM_INITCALLS
+};
+
+/* Everything that kernel_init() brings up before starting init. The keyboard
+   is started early, since it spends most of its time waiting on the keyboard;
+   it needs interrupts, and with them the timer, to make progress. */
+static const struct initcall initcalls[NUM_INITCALLS] =
+{
+    [INIT_CPU]      = { "cpu_init", cpu_init, NULL, 0 },
+    [INIT_LDT]      = { "ldt_init", ldt_init, NULL, 0 },
+    [INIT_TSS]      = { "tss_init", tss_init, NULL, 0 },
+    [INIT_DF_TSS]   = { "df_tss_init", df_tss_init, NULL, 0 },
+    [INIT_IDT]      = { "idt_init", idt_init, NULL, 0 },
+    [INIT_SYSCALL]  = { "syscall_init", syscall_init, NULL,
+                        INIT_DEP(INIT_CPU) },
+    [INIT_IRQ]      = { "irq_init", irq_init, NULL, INIT_DEP(INIT_IDT) },
+    [INIT_PS2KBD]   = { "ps2kbd_init", ps2kbd_init, ps2kbd_poll,
+                        INIT_DEP(INIT_IRQ) | INIT_DEP(INIT_TTY)
+                        | INIT_DEP(INIT_TIMER) },
+    [INIT_CONSOLE]  = { "console_init", console_init, NULL, 0 },
+    [INIT_TTY]      = { "tty_init", tty_init, NULL, INIT_DEP(INIT_CONSOLE) },
+    [INIT_UART]     = { "uart_init", uart_init, NULL,
+                        INIT_DEP(INIT_TTY) | INIT_DEP(INIT_IRQ) },
+    [INIT_MEM]      = { "mem_init", mem_init, NULL, INIT_DEP(INIT_CPU) },
+    [INIT_PROC]     = { "proc_init", proc_init, NULL,
+                        INIT_DEP(INIT_MEM) | INIT_DEP(INIT_TSS) },
+    [INIT_TIMER]    = { "timer_init", timer_init, NULL,
+                        INIT_DEP(INIT_IRQ) | INIT_DEP(INIT_PROC) },
+    [INIT_PCACHE]   = { "pcache_init", pcache_init, NULL, INIT_DEP(INIT_MEM) },
+    [INIT_RAMDISK]  = { "ramdisk_init", ramdisk_init, NULL,
+                        INIT_DEP(INIT_PCACHE) },
+    [INIT_ATA]      = { "ata_init", ata_init, NULL,
+                        INIT_DEP(INIT_IRQ) | INIT_DEP(INIT_PCACHE) },
+    [INIT_FLOPPY]   = { "floppy_init", floppy_init, NULL,
+                        INIT_DEP(INIT_IRQ) | INIT_DEP(INIT_PCACHE) },
+};
+#ifdef __BENCH
+static uint32_t tsc_khz(void);
+static void print_boot_row(const char *phase, uint64_t start, uint64_t end,
+                           uint64_t base, uint32_t khz);
+static void print_boot_trace(void);
+static void print_run_stats(void);
+#endif
 
 /**
  * "Fire 'er up, man!"
@@ -48,29 +150,193 @@ static void mini_shell(void);
  */
 void kernel_init(void)
 {
-    ldt_init();
-    tss_init();
-    idt_init();
-    irq_init();
-    console_init();
-    tty_init();
-    mem_init();
-    timer_set_rate(TIMER_CH_INTR, 1000);    /* timer interrupts every 1ms */
-    irq_enable(IRQ_TIMER);
-    irq_enable(IRQ_KEYBOARD);
-    sti();
+    const struct boot_info *bi;
+    int init_pid;
+
+    run_initcalls(initcalls, NUM_INITCALLS);
+
+    bi = &boot_info;
+    if (bi->cmdline[0] != '\0') {
+        kprintf("command line: %s\n", bi->cmdline);
+    }
+
+    /* Nothing else runs until the idle loop calls schedule(). */
+    init_pid = proc_create("init", user_init_start,
+        user_init_end - user_init_start);
+    if (init_pid < 0) {
+        kprintf_level(KLOG_ERR, "failed to start init\n");
+    }
+    boot_trace("start init");
+
+#ifdef __BENCH
+    print_boot_trace();
+    uart_bench();
+    ramdisk_bench();
+    ata_bench();
+    floppy_bench();
+    if (blkdev_get("hda") != NULL) {
+        pcache_bench(blkdev_get("hda"));
+    }
+    if (blkdev_get("ram0") != NULL) {
+        pcache_bench(blkdev_get("ram0"));
+    }
+#endif
+
+    int busy;
+
+    /* Idle loop. Spare cycles are spent running console commands, writing
+       out the kernel log, cleaning up after exited processes, writing back
+       dirty cached blocks and pre-zeroing page frames. The idle task gives up
+       the CPU once per pass if anyone else wants it; once there's nothing
+       left to do, sleep until the next interrupt. */
+    for (;;) {
+        mini_shell();
+        busy = klog_flush() + proc_reap() + pcache_flush()
+            + zero_pool_refill();
+#ifdef __BENCH
+        /* Report on the run once init has exited and been reaped. */
+        if (init_pid > 0 && !proc_alive(init_pid)) {
+            print_run_stats();
+            init_pid = -1;
+        }
+#endif
+        if (schedule() == 0 && busy == 0) {
+            __asm__ volatile ("hlt" : : : "memory");
+        }
+    }
+}
+
+void run_initcalls(const struct initcall *calls, int count)
+{
+    uint32_t all;
+    uint32_t started;
+    uint32_t done;
+    bool progress;
+    int i;
 
-    char buf[128];
-    int nchars;
+    all = (count < 32) ? INIT_DEP(count) - 1 : 0xFFFFFFFF;
+    started = 0;
+    done = 0;
 
-    while ((nchars = tty_read(TTY_CONSOLE, buf, sizeof(buf))) > -1);
+    while (done != all) {
+        progress = false;
+        for (i = 0; i < count; i++) {
+            if ((started & INIT_DEP(i))
+                    || (calls[i].deps & done) != calls[i].deps) {
+                continue;
+            }
 
-    __asm__ volatile (".idle: hlt; jmp .idle" : : : "memory");
+            started |= INIT_DEP(i);
+            calls[i].init();
+            if (calls[i].poll == NULL) {
+                done |= INIT_DEP(i);
+                boot_trace(calls[i].name);
+            }
+            progress = true;
+
+            /* Keep any slow probes moving. */
+            poll_initcalls(calls, count, started, &done);
+
+            /* Whatever just finished may have unblocked an earlier entry;
+               start over so that it doesn't have to wait for a whole
+               pass. */
+            i = -1;
+        }
+
+        if (poll_initcalls(calls, count, started, &done)) {
+            progress = true;
+        }
+
+        if (!progress && started == done) {
+            kprintf_level(KLOG_ERR, "init: dependency cycle in initcalls\n");
+            return;
+        }
+    }
+}
+
+/**
+ * Polls every initcall that has been started but isn't done yet.
+ *
+ * @param calls   - the initcalls
+ * @param count   - number of initcalls
+ * @param started - mask of the initcalls that have been started
+ * @param done    - mask of the initcalls that are done; updated
+ * @return true if any initcall finished
+ */
+static bool poll_initcalls(const struct initcall *calls, int count,
+                           uint32_t started, uint32_t *done)
+{
+    uint32_t pending;
+    bool finished;
+    int i;
+
+    pending = started & ~*done;
+    finished = false;
+    for (i = 0; pending != 0 && i < count; i++) {
+        if ((pending & INIT_DEP(i)) && calls[i].poll()) {
+            *done |= INIT_DEP(i);
+            boot_trace(calls[i].name);
+            finished = true;
+        }
+    }
+
+    return finished;
+}
+
+/**
+ * Collects console input into a line and runs it as a command once Enter is
+ * pressed. There's no shell yet; this is just enough to poke at the kernel.
+ */
+static void mini_shell(void)
+{
+    static char line[SHELL_LINE_LEN];
+    static int len;
+    char buf[32];
+    int n;
+    int i;
+
+    n = tty_read(TTY_CONSOLE, buf, sizeof(buf));
+    for (i = 0; i < n; i++) {
+        switch (buf[i]) {
+            case ASCII_CR:
+            case ASCII_LF:
+                line[len] = '\0';
+                len = 0;
+                if (strcmp(line, "dmesg") == 0) {
+                    dmesg();
+                }
+                else if (line[0] != '\0') {
+                    printf("%s: unknown command (try 'dmesg')\n", line);
+                }
+                break;
+            case ASCII_BS:
+            case ASCII_DEL:
+                if (len > 0) {
+                    len--;
+                }
+                break;
+            default:
+                if (len < SHELL_LINE_LEN - 1) {
+                    line[len++] = buf[i];
+                }
+                break;
+        }
+    }
+}
+
+/**
+ * Starts the timer and turns interrupts on. Drivers can use timer_ticks for
+ * timeouts from here on.
+ */
+static void timer_init(void)
+{
+    timer_set_rate(TIMER_CH_INTR, 1000);    /* timer interrupts every 1ms */
+    irq_enable(IRQ_TIMER);
+    sti();
 }
 
 static void ldt_init(void)
 {
-    seg_desc_t *gdt;
     seg_desc_t *ldt_desc;
     uint32_t ldt_base;
     size_t ldt_size;
@@ -86,7 +352,6 @@ static void ldt_init(void)
     }
 
     /* Get LDT descriptor from GDT */
-    gdt = (seg_desc_t *) GDT_BASE;
     ldt_desc_idx = get_gdt_index(KERNEL_LDT);
     ldt_desc = &gdt[ldt_desc_idx];
 
@@ -95,28 +360,161 @@ static void ldt_init(void)
     lldt(KERNEL_LDT);
 }
 
+void set_kernel_stack(uint32_t esp)
+{
+    kernel_tss.esp0 = esp;
+    sysenter_set_stack(esp);
+}
+
 static void tss_init(void)
 {
-    seg_desc_t *gdt;
     seg_desc_t *tss_desc;
     uint32_t tss_base;
     size_t tss_size;
     int tss_desc_idx;
 
     /* Get TSS descriptor from GDT */
-    gdt = (seg_desc_t *) GDT_BASE;
     tss_desc_idx = get_gdt_index(KERNEL_TSS);
     tss_desc = &gdt[tss_desc_idx];
 
-    tss_base = (uint32_t) &tss;
+    tss_base = (uint32_t) &kernel_tss;
     tss_size = sizeof(struct tss_struct);
 
     /* Set up the TSS descriptor */
     SET_SYS_DESC_PARAMS(tss_desc, tss_base, tss_size, DESC_TSS32);
 
     /* Populate TSS params and load task register */
-    tss.ldt_selector = KERNEL_LDT;
-    tss.esp0 = KERNEL_STACK_BASE;
-    tss.ss0 = KERNEL_DS;
+    kernel_tss.ldt_selector = KERNEL_LDT;
+    kernel_tss.esp0 = KERNEL_STACK_BASE;
+    kernel_tss.ss0 = KERNEL_DS;
+    kernel_tss.io_base_addr = sizeof(struct tss_struct);  /* no ring 3 I/O */
     ltr(KERNEL_TSS);
 }
+
+#ifdef __BENCH
+void boot_trace(const char *phase)
+{
+    if (boot_trace_count < BOOT_TRACE_MAX) {
+        boot_trace_log[boot_trace_count].phase = phase;
+        boot_trace_log[boot_trace_count].tsc = rdtsc();
+        boot_trace_count++;
+    }
+}
+
+/**
+ * Measures the TSC frequency against the timer. Interrupts must be on.
+ *
+ * @return the TSC frequency in kHz, or 0 if there is no TSC
+ */
+static uint32_t tsc_khz(void)
+{
+    uint32_t ticks;
+    uint64_t start;
+    uint64_t cycles;
+
+    if (!cpu_has(CPU_FEAT_TSC)) {
+        return 0;
+    }
+
+    /* Line up with a tick first. */
+    ticks = timer_ticks;
+    while (timer_ticks == ticks);
+
+    start = rdtsc();
+    ticks = timer_ticks;
+    while (timer_ticks - ticks < TSC_CALIBRATE_MS);
+    cycles = rdtsc() - start;
+
+    div64(&cycles, TSC_CALIBRATE_MS);
+    return (uint32_t) cycles;
+}
+
+/**
+ * Logs one row of the boot trace: how long a phase took, and when it finished
+ * relative to the start of the boot, both in microseconds.
+ */
+static void print_boot_row(const char *phase, uint64_t start, uint64_t end,
+                           uint64_t base, uint32_t khz)
+{
+    uint64_t us;
+    uint64_t at;
+
+    us = (end - start) * 1000;
+    at = (end - base) * 1000;
+    div64(&us, khz);
+    div64(&at, khz);
+    kprintf("  %-20s %10lu %10lu\n", phase, (uint32_t) us, (uint32_t) at);
+}
+
+/**
+ * Logs how long each phase of the boot took, from the time stamps left by
+ * the bootloader through to the boot trace.
+ */
+static void print_boot_trace(void)
+{
+    const struct boot_info *bi;
+    uint64_t base;
+    uint64_t prev;
+    uint32_t khz;
+    int i;
+
+    khz = tsc_khz();
+    if (khz == 0 || boot_trace_count == 0) {
+        return;
+    }
+
+    /* A Multiboot loader doesn't leave any time stamps behind. */
+    bi = &boot_info;
+    base = (bi->tsc_start != 0) ? bi->tsc_start : boot_trace_log[0].tsc;
+    prev = (bi->tsc_kernel != 0) ? bi->tsc_kernel : boot_trace_log[0].tsc;
+
+    kprintf("boot trace (TSC at %lu kHz):\n", khz);
+    kprintf("  %-20s %10s %10s\n", "phase", "us", "at (us)");
+    if (bi->tsc_start != 0) {
+        print_boot_row("stage 1: load", bi->tsc_start, bi->tsc_loaded,
+            base, khz);
+        print_boot_row("stage 2: unpack", bi->tsc_loaded, bi->tsc_kernel,
+            base, khz);
+    }
+    for (i = 0; i < boot_trace_count; i++) {
+        print_boot_row(boot_trace_log[i].phase, prev, boot_trace_log[i].tsc,
+            base, khz);
+        prev = boot_trace_log[i].tsc;
+    }
+}
+
+/**
+ * Logs what the system calls, page faults, frame allocator, kernel stacks and
+ * page cache have been up to.
+ */
+static void print_run_stats(void)
+{
+    syscall_print_stats();
+    fault_print_stats();
+    frame_print_stats();
+    kstack_print_stats();
+    pcache_print_stats();
+}
+#endif
+
+static void df_tss_init(void)
+{
+    seg_desc_t *tss_desc;
+
+    tss_desc = &gdt[get_gdt_index(DF_TSS)];
+    SET_SYS_DESC_PARAMS(tss_desc, (uint32_t) &df_tss,
+        sizeof(struct tss_struct), DESC_TSS32);
+
+    /* The state that the double fault task starts out in. The task switch
+       leaves the faulting context in the kernel TSS. */
+    df_tss.cr3 = KERNEL_PGDIR;
+    df_tss.eip = (uint32_t) double_fault_task;
+    df_tss.eflags = 0x002;                  /* interrupts off */
+    df_tss.esp = (uint32_t) df_stack + sizeof(df_stack);
+    df_tss.cs = KERNEL_CS;
+    df_tss.ds = KERNEL_DS;
+    df_tss.es = KERNEL_DS;
+    df_tss.ss = KERNEL_DS;
+    df_tss.ldt_selector = KERNEL_LDT;
+    df_tss.io_base_addr = sizeof(struct tss_struct);
+}
@@ -55,7 +55,6 @@ static const intr_handler_stub IRQ_STUBS[NUM_IRQ] = {
 void idt_init(void)
 {
     size_t i;
-    idt_gate_t *idt;
     size_t idt_len;
     desc_reg_t idt_ptr;
 
@@ -64,7 +63,6 @@ void idt_init(void)
     int type;
     intr_handler_stub stub;
 
-    idt = (idt_gate_t *) IDT_BASE;
     idt_len = NUM_VEC * sizeof(idt_gate_t);
 
     /* Populate IDT entries */
@@ -96,6 +94,10 @@ void idt_init(void)
         SET_IDT_ENTRY(idt[i], in_use, privl, type, (uint32_t) stub)
     }
 
+    /* Double faults switch to a task of their own; see double_fault_task(). */
+    SET_IDT_ENTRY(idt[EXCEPT_DF], 1, PRIVL_KERNEL, GATE_TASK, 0)
+    idt[EXCEPT_DF].fields.seg_selector = DF_TSS;
+
     /* Load IDTR */
     idt_ptr.fields.base = (uint32_t) idt;
     idt_ptr.fields.limit = (uint16_t) idt_len;
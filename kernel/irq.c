@@ -20,8 +20,12 @@
 #include <stdint.h>
 #include <lyra/irq.h>
 #include <lyra/kernel.h>
+#include <lyra/proc.h>
+#include <drivers/ata.h>
+#include <drivers/floppy.h>
 #include <drivers/ps2kbd.h>
 #include <drivers/timer.h>
+#include <drivers/uart.h>
 
 static int eoi(unsigned int irq_num);
 
@@ -63,8 +67,19 @@ void do_irq(struct interrupt_frame *regs)
         case IRQ_KEYBOARD:
             ps2kbd_do_irq();
             break;
+        case IRQ_COM1:
+        case IRQ_COM2:
+            uart_do_irq(irq_num);
+            break;
+        case IRQ_FLOPPY:
+            floppy_do_irq();
+            break;
+        case IRQ_ATA0:
+        case IRQ_ATA1:
+            ata_do_irq(irq_num);
+            break;
         default:
-            kprintf("Unknown IRQ! (%d)\n", irq_num);
+            kprintf_level(KLOG_ERR, "Unknown IRQ! (%d)\n", irq_num);
             break;
     }
 
@@ -73,6 +88,11 @@ void do_irq(struct interrupt_frame *regs)
            will not work if IRQ7 enabled for real IRQs  */
         eoi(irq_num);
     }
+
+    /* Only after the EOI, since this may switch to another task. */
+    if (irq_num == IRQ_TIMER) {
+        sched_tick(regs);
+    }
 }
 
 static int eoi(unsigned int irq_num)
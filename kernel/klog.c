@@ -0,0 +1,264 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * Copyright (C) 2018 Wes Hampson. All Rights Reserved.                       *
+ *                                                                            *
+ * This file is part of the Lyra operating system.                            *
+ *                                                                            *
+ * Lyra is free software: you can redistribute it and/or modify               *
+ * it under the terms of version 2 of the GNU General Public License          *
+ * as published by the Free Software Foundation.                              *
+ *                                                                            *
+ * See LICENSE in the top-level directory for a copy of the license.          *
+ * You may also visit <https://www.gnu.org/licenses/gpl-2.0.txt>.             *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+/*-----------------------------------------------------------------------------
+ *   File: kernel/klog.c
+ * Author: Wes Hampson
+ *   Desc: Kernel log ring buffer.
+ *
+ * The log is a ring of fixed-size records. A writer claims the next sequence
+ * number with an atomic increment, formats its message directly into the
+ * matching slot, then publishes the slot by storing the sequence number in
+ * the record's 'commit' field. Writers never wait on each other or on
+ * readers, so logging from an interrupt handler costs no more than formatting
+ * the message.
+ *
+ * Readers (the VGA and serial consoles, and dmesg) keep their own position
+ * in the log and copy records out, checking 'commit' before and after the
+ * copy to detect a record that was overwritten in the meantime. Once the ring
+ * fills up, the oldest records are lost.
+ *----------------------------------------------------------------------------*/
+
+#include <stdbool.h>
+#include <string.h>
+#include <lyra/kernel.h>
+#include <lyra/klog.h>
+#include <lyra/tty.h>
+#include <drivers/timer.h>
+#include <drivers/uart.h>
+
+#define KLOG_NUM_RECORDS    64      /* must be a power of 2 */
+#define KLOG_RECORD_SIZE    128
+#define KLOG_TEXT_LEN       (KLOG_RECORD_SIZE - 10)
+
+struct klog_record {
+    uint32_t commit;        /* seq + 1 once written, 0 while being written */
+    uint32_t ticks;         /* timer ticks at time of logging */
+    uint8_t level;          /* KLOG_* */
+    uint8_t len;            /* length of text */
+    char text[KLOG_TEXT_LEN];
+};
+
+static struct klog_record ring[KLOG_NUM_RECORDS];
+static uint32_t next_seq;       /* next sequence number to hand out */
+static uint32_t console_seq;    /* next record to send to the console */
+static uint32_t serial_seq;     /* next record to send to the serial port */
+
+static int drain(uint32_t *seq, bool (*emit)(const struct klog_record *));
+static bool console_emit(const struct klog_record *rec);
+static bool serial_emit(const struct klog_record *rec);
+static int read_record(uint32_t seq, struct klog_record *rec);
+
+int klog(int level, const char *fmt, ...)
+{
+    int retval;
+    va_list ap;
+
+    va_start(ap, fmt);
+    retval = vklog(level, NULL, fmt, ap);
+    va_end(ap);
+
+    return retval;
+}
+
+int klog_fmt(int level, struct printf_fmt *pf, const char *fmt, ...)
+{
+    int retval;
+    va_list ap;
+
+    va_start(ap, fmt);
+    retval = vklog(level, pf, fmt, ap);
+    va_end(ap);
+
+    return retval;
+}
+
+int vklog(int level, struct printf_fmt *pf, const char *fmt, va_list args)
+{
+    struct klog_record *rec;
+    uint32_t seq;
+    int len;
+
+    seq = __atomic_fetch_add(&next_seq, 1, __ATOMIC_RELAXED);
+    rec = &ring[seq & (KLOG_NUM_RECORDS - 1)];
+
+    /* Only one CPU, so compiler barriers are enough to keep the stores to
+       the record in order as seen by an interrupt handler. */
+    __atomic_store_n(&rec->commit, 0, __ATOMIC_RELAXED);
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+
+    rec->ticks = timer_ticks;
+    rec->level = (uint8_t) level;
+    len = vcsnprintf(rec->text, KLOG_TEXT_LEN, pf, fmt, args);
+    if (len < 0) {
+        len = 0;
+    }
+    else if (len > KLOG_TEXT_LEN - 1) {
+        len = KLOG_TEXT_LEN - 1;
+    }
+    rec->len = (uint8_t) len;
+
+    __atomic_store_n(&rec->commit, seq + 1, __ATOMIC_RELEASE);
+
+    return len;
+}
+
+int klog_flush(void)
+{
+    int count;
+
+    count = drain(&console_seq, console_emit);
+    count += drain(&serial_seq, serial_emit);
+
+    return count;
+}
+
+void klog_sync(void)
+{
+    /* The serial console only takes as much as fits in its transmit ring
+       per flush, so empty the ring and go again until there's nothing
+       left. */
+    do {
+        uart_console_sync();
+    } while (klog_flush() > 0);
+    uart_console_sync();
+}
+
+void dmesg(void)
+{
+    struct klog_record rec;
+    uint32_t head;
+    uint32_t seq;
+    bool line_start;
+
+    head = __atomic_load_n(&next_seq, __ATOMIC_ACQUIRE);
+    seq = (head > KLOG_NUM_RECORDS) ? head - KLOG_NUM_RECORDS : 0;
+    line_start = true;
+
+    for (; seq != head; seq++) {
+        if (read_record(seq, &rec) <= 0) {
+            continue;
+        }
+
+        /* A message may be built up over several calls, so only stamp the
+           start of each line. */
+        if (line_start) {
+            printf("[%8lu] ", rec.ticks);
+        }
+        printf("%.*s", (int) rec.len, rec.text);
+        line_start = (rec.len > 0 && rec.text[rec.len - 1] == '\n');
+    }
+
+    if (!line_start) {
+        printf("\n");
+    }
+}
+
+/**
+ * Feeds unseen records to a console, starting at '*seq'. Stops early if the
+ * console can't take any more right now.
+ *
+ * @param seq  - the console's position in the log
+ * @param emit - writes a record to the console; returns false if it is busy
+ * @return the number of records consumed
+ */
+static int drain(uint32_t *seq, bool (*emit)(const struct klog_record *))
+{
+    struct klog_record rec;
+    uint32_t head;
+    uint32_t lost;
+    int count;
+    int ret;
+
+    count = 0;
+    for (;;) {
+        head = __atomic_load_n(&next_seq, __ATOMIC_ACQUIRE);
+        if (*seq == head) {
+            break;
+        }
+
+        /* Skip anything that has already been overwritten. The position
+           only moves on once the console has taken the note, so that the
+           count isn't lost if it's busy. */
+        if (head - *seq > KLOG_NUM_RECORDS) {
+            lost = head - *seq - KLOG_NUM_RECORDS;
+
+            rec.level = KLOG_ERR;
+            rec.len = (uint8_t) snprintf(rec.text, KLOG_TEXT_LEN,
+                "klog: %lu messages dropped\n", lost);
+            if (!emit(&rec)) {
+                break;
+            }
+            *seq += lost;
+        }
+
+        ret = read_record(*seq, &rec);
+        if (ret == 0) {
+            /* Writer hasn't finished yet; pick it up next time. */
+            break;
+        }
+
+        if (ret > 0 && rec.level <= KLOG_CONSOLE_LEVEL && !emit(&rec)) {
+            break;
+        }
+        (*seq)++;
+        count++;
+    }
+
+    return count;
+}
+
+static bool console_emit(const struct klog_record *rec)
+{
+    tty_write(TTY_CONSOLE, rec->text, rec->len);
+    return true;
+}
+
+static bool serial_emit(const struct klog_record *rec)
+{
+    return uart_console_write(rec->text, rec->len) >= 0;
+}
+
+/**
+ * Copies a record out of the ring.
+ *
+ * @param seq - sequence number of the record
+ * @param rec - buffer to hold the record
+ * @return 1 if the record was copied, 0 if it is still being written,
+ *         -1 if it has been overwritten
+ */
+static int read_record(uint32_t seq, struct klog_record *rec)
+{
+    struct klog_record *slot;
+    uint32_t commit;
+
+    slot = &ring[seq & (KLOG_NUM_RECORDS - 1)];
+
+    commit = __atomic_load_n(&slot->commit, __ATOMIC_ACQUIRE);
+    if (commit != seq + 1) {
+        if (__atomic_load_n(&next_seq, __ATOMIC_RELAXED) - seq
+                > KLOG_NUM_RECORDS) {
+            return -1;
+        }
+        return 0;
+    }
+
+    memcpy(rec, slot, sizeof(struct klog_record));
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&slot->commit, __ATOMIC_RELAXED) != seq + 1) {
+        return -1;
+    }
+
+    return 1;
+}
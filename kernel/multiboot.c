@@ -0,0 +1,87 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * Copyright (C) 2018 Wes Hampson. All Rights Reserved.                       *
+ *                                                                            *
+ * This file is part of the Lyra operating system.                            *
+ *                                                                            *
+ * Lyra is free software: you can redistribute it and/or modify               *
+ * it under the terms of version 2 of the GNU General Public License          *
+ * as published by the Free Software Foundation.                              *
+ *                                                                            *
+ * See LICENSE in the top-level directory for a copy of the license.          *
+ * You may also visit <https://www.gnu.org/licenses/gpl-2.0.txt>.             *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+/*-----------------------------------------------------------------------------
+ *   File: kernel/multiboot.c
+ * Author: Wes Hampson
+ *   Desc: Translates the Multiboot information structure into the boot info
+ *         that the rest of the kernel knows how to read.
+ *----------------------------------------------------------------------------*/
+
+#include <string.h>
+#include <lyra/kernel.h>
+#include <lyra/memory.h>
+#include <lyra/multiboot.h>
+
+static uint32_t mmap_mem_size(const struct multiboot_info *mbi);
+
+void multiboot_init(const struct multiboot_info *mbi)
+{
+    struct boot_info *bi;
+    const struct multiboot_module *mod;
+    uint32_t size;
+
+    bi = &boot_info;
+    memset(bi, 0, sizeof(struct boot_info));
+
+    if (mbi->flags & MBI_MMAP) {
+        bi->mem_size = mmap_mem_size(mbi);
+    }
+    if (bi->mem_size == 0 && (mbi->flags & MBI_MEMORY)) {
+        bi->mem_size = 0x100000 + (mbi->mem_upper << 10);
+    }
+
+    if (mbi->flags & MBI_CMDLINE) {
+        strncpy(bi->cmdline, (const char *) mbi->cmdline,
+            BOOT_CMDLINE_SIZE - 1);
+    }
+
+    if (!(mbi->flags & MBI_MODS) || mbi->mods_count == 0) {
+        return;
+    }
+
+    /* The first module is the initrd. The loader may have put it anywhere,
+       including memory that the frame allocator will hand out, so move it to
+       where the floppy bootloader would have put it. This goes last, since
+       the move may well clobber the rest of the Multiboot info. */
+    mod = (const struct multiboot_module *) mbi->mods_addr;
+    size = mod->mod_end - mod->mod_start;
+    bi->initrd_start = INITRD_START;
+    bi->initrd_size = size;
+    if (size <= INITRD_MAX_SIZE) {
+        memmove((void *) INITRD_START, (const void *) mod->mod_start, size);
+    }
+}
+
+/**
+ * Finds the end of the block of available memory that the kernel is loaded
+ * into, which is as far as the kernel's identity mapping can go.
+ */
+static uint32_t mmap_mem_size(const struct multiboot_info *mbi)
+{
+    const struct multiboot_mmap *entry;
+    uint32_t addr;
+    uint64_t end;
+
+    addr = mbi->mmap_addr;
+    while (addr < mbi->mmap_addr + mbi->mmap_length) {
+        entry = (const struct multiboot_mmap *) addr;
+        end = entry->base_addr + entry->length;
+        if (entry->type == MB_MMAP_AVAILABLE
+                && entry->base_addr <= KERNEL_START && end > KERNEL_START) {
+            return (end > 0xFFFFF000) ? 0xFFFFF000 : (uint32_t) end;
+        }
+        addr += entry->size + sizeof(entry->size);
+    }
+
+    return 0;
+}
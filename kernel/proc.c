@@ -0,0 +1,439 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * Copyright (C) 2018 Wes Hampson. All Rights Reserved.                       *
+ *                                                                            *
+ * This file is part of the Lyra operating system.                            *
+ *                                                                            *
+ * Lyra is free software: you can redistribute it and/or modify               *
+ * it under the terms of version 2 of the GNU General Public License          *
+ * as published by the Free Software Foundation.                              *
+ *                                                                            *
+ * See LICENSE in the top-level directory for a copy of the license.          *
+ * You may also visit <https://www.gnu.org/licenses/gpl-2.0.txt>.             *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+/*-----------------------------------------------------------------------------
+ *   File: kernel/proc.c
+ * Author: Wes Hampson
+ *   Desc: Processes and the round-robin scheduler.
+ *
+ * Each task has its own page directory and a kernel stack. A task
+ * that isn't running is parked inside switch_context() on its kernel stack,
+ * so switching tasks is just a matter of swapping stacks and page
+ * directories, and pointing the TSS (and SYSENTER) at the new kernel stack so
+ * that the next entry from ring 3 lands in the right place.
+ *
+ * Task 0 is the idle task, i.e. the kernel's boot thread. It runs on the boot
+ * stack in the kernel page directory and takes its turn like everyone else,
+ * but it gives up the CPU voluntarily; tasks are only preempted by the timer
+ * while they're in user mode, since most of the kernel isn't reentrant.
+ *
+ * Kernel stacks are mapped into KSTACK_AREA, one slot per task table entry,
+ * each with an unmapped guard page below it. Overflowing a kernel stack thus
+ * page faults, which in turn double faults since the CPU can't push the
+ * exception frame, and the double fault task reports the culprit using
+ * kstack_guard_owner(). Stacks are filled with a poison pattern when they're
+ * set up, so how deep each one has gone can be told by looking for the
+ * first word that was overwritten.
+ *----------------------------------------------------------------------------*/
+
+#include <string.h>
+#include <lyra/kernel.h>
+#include <lyra/descriptor.h>
+#include <lyra/elf.h>
+#include <lyra/interrupt.h>
+#include <lyra/proc.h>
+
+#define EFLAGS_IF       0x200
+#define EFLAGS_RSVD     0x002   /* always set */
+
+#define KSTACK_SLOT     (PAGE_SIZE + KSTACK_SIZE)   /* guard page + stack */
+#define KSTACK_POISON   0xA5A5A5A5
+#define IDLE_SLACK      64      /* bytes left alone below the idle task's ESP */
+
+struct task *current_task;
+
+static struct task tasks[NUM_TASKS];
+static int next_pid;
+
+static uint32_t kstack_peak;    /* deepest stack use of any exited task */
+
+static struct task * alloc_task(void);
+static int kstack_alloc(struct task *t);
+static void kstack_free(struct task *t);
+static void kstack_poison(uint32_t base, uint32_t limit);
+static uint32_t kstack_usage(uint32_t base, uint32_t size);
+
+void proc_init(void)
+{
+    struct task *idle;
+    uint32_t esp;
+
+    idle = &tasks[0];
+    idle->pid = 0;
+    idle->state = TASK_RUNNABLE;
+    strncpy(idle->name, "idle", TASK_NAME_LEN);
+    idle->mm.pgdir = KERNEL_PGDIR;
+    idle->kstack = 0;
+    idle->slice = TIME_SLICE;
+
+    current_task = idle;
+    next_pid = 1;
+
+    /* The idle task is already running on the boot stack, so only poison
+       what it hasn't used yet. Interrupts are still off, so nothing else is
+       using it either. */
+    __asm__ volatile ("movl %%esp, %0" : "=r"(esp));
+    kstack_poison(KERNEL_STACK_BASE - KERNEL_STACK_SIZE,
+        (esp - IDLE_SLACK) & ~3);
+}
+
+int proc_create(const char *name, const void *image, uint32_t size)
+{
+    struct task *t;
+    uint32_t *sp;
+    uint32_t entry;
+    uint32_t eflags;
+
+    cli_save(eflags);
+    t = alloc_task();
+    restore_flags(eflags);
+    if (t == NULL) {
+        return -1;
+    }
+
+    strncpy(t->name, name, TASK_NAME_LEN - 1);
+    t->name[TASK_NAME_LEN - 1] = '\0';
+
+    if (mm_init(&t->mm) != 0) {
+        goto fail;
+    }
+    if (elf_load(&t->mm, image, size, &entry) != 0) {
+        goto fail;
+    }
+    if (vma_add(&t->mm, USER_STACK_TOP - PAGE_SIZE, USER_STACK_TOP,
+            VMA_READ | VMA_WRITE | VMA_GROWSDOWN, NULL, 0) != 0) {
+        goto fail;
+    }
+
+    if (kstack_alloc(t) != 0) {
+        goto fail;
+    }
+
+    /* Build the stack that the first switch_context() into this task will
+       unwind: the callee-saved registers, then a return into enter_user(),
+       which irets into ring 3 using the frame above it. */
+    sp = (uint32_t *) (t->kstack + KSTACK_SIZE);
+    *--sp = USER_DS;                        /* SS */
+    *--sp = USER_STACK_TOP;                 /* ESP */
+    *--sp = EFLAGS_IF | EFLAGS_RSVD;        /* EFLAGS */
+    *--sp = USER_CS;                        /* CS */
+    *--sp = entry;                          /* EIP */
+    *--sp = (uint32_t) enter_user;
+    *--sp = 0;                              /* EBP */
+    *--sp = 0;                              /* EBX */
+    *--sp = 0;                              /* ESI */
+    *--sp = 0;                              /* EDI */
+    t->esp = (uint32_t) sp;
+    t->slice = TIME_SLICE;
+
+    cli_save(eflags);
+    t->pid = next_pid++;
+    t->state = TASK_RUNNABLE;
+    restore_flags(eflags);
+
+    return t->pid;
+
+fail:
+    mm_destroy(&t->mm);
+    kstack_free(t);
+    t->state = TASK_UNUSED;
+    return -1;
+}
+
+int proc_fork(struct interrupt_frame *regs)
+{
+    struct task *parent;
+    struct task *child;
+    struct interrupt_frame *frame;
+    uint32_t *sp;
+    uint32_t eflags;
+
+    parent = current_task;
+
+    cli_save(eflags);
+    child = alloc_task();
+    restore_flags(eflags);
+    if (child == NULL) {
+        return -1;
+    }
+
+    memcpy(child->name, parent->name, TASK_NAME_LEN);
+
+    if (mm_fork(&child->mm, &parent->mm) != 0) {
+        goto fail;
+    }
+
+    if (kstack_alloc(child) != 0) {
+        goto fail;
+    }
+
+    /* The child returns to user mode through the same frame as the parent,
+       except that fork() returns 0. */
+    frame = (struct interrupt_frame *)
+        (child->kstack + KSTACK_SIZE - sizeof(struct interrupt_frame));
+    memcpy(frame, regs, sizeof(struct interrupt_frame));
+    frame->eax = 0;
+
+    sp = (uint32_t *) frame;
+    *--sp = (uint32_t) interrupt_return;
+    *--sp = 0;                              /* EBP */
+    *--sp = 0;                              /* EBX */
+    *--sp = 0;                              /* ESI */
+    *--sp = 0;                              /* EDI */
+    child->esp = (uint32_t) sp;
+    child->slice = TIME_SLICE;
+
+    cli_save(eflags);
+    child->pid = next_pid++;
+    child->state = TASK_RUNNABLE;
+    restore_flags(eflags);
+
+    return child->pid;
+
+fail:
+    mm_destroy(&child->mm);
+    kstack_free(child);
+    child->state = TASK_UNUSED;
+    return -1;
+}
+
+void proc_exit(int code)
+{
+    cli();
+    current_task->exit_code = code;
+    current_task->state = TASK_ZOMBIE;
+    schedule();
+
+    /* Never scheduled again. */
+    for (;;) {
+        __asm__ volatile ("hlt");
+    }
+}
+
+int proc_reap(void)
+{
+    struct task *t;
+    uint32_t eflags;
+    uint32_t used;
+    int count;
+    int i;
+
+    count = 0;
+    for (i = 1; i < NUM_TASKS; i++) {
+        t = &tasks[i];
+        if (t->state != TASK_ZOMBIE) {
+            continue;
+        }
+
+        /* A zombie never runs again, and it can't be the current task
+           because we are, so it's safe to tear it down. */
+        used = kstack_usage(t->kstack, KSTACK_SIZE);
+        if (used > kstack_peak) {
+            kstack_peak = used;
+        }
+        kprintf("%s[%d] exited with status %d (%lu bytes of kernel stack)\n",
+            t->name, t->pid, t->exit_code, used);
+        mm_destroy(&t->mm);
+        kstack_free(t);
+
+        cli_save(eflags);
+        t->state = TASK_UNUSED;
+        restore_flags(eflags);
+        count++;
+    }
+
+    return count;
+}
+
+bool proc_alive(int pid)
+{
+    int i;
+
+    for (i = 0; i < NUM_TASKS; i++) {
+        if (tasks[i].state != TASK_UNUSED && tasks[i].pid == pid) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+int schedule(void)
+{
+    struct task *prev;
+    struct task *next;
+    uint32_t eflags;
+    int i;
+
+    cli_save(eflags);
+
+    prev = current_task;
+    next = NULL;
+    for (i = 1; i <= NUM_TASKS; i++) {
+        next = &tasks[(prev - tasks + i) % NUM_TASKS];
+        if (next->state == TASK_RUNNABLE) {
+            break;
+        }
+    }
+
+    prev->slice = TIME_SLICE;
+    if (next == prev) {
+        restore_flags(eflags);
+        return 0;
+    }
+
+    current_task = next;
+    set_kernel_stack((next->kstack != 0)
+        ? next->kstack + KSTACK_SIZE
+        : KERNEL_STACK_BASE);
+    pgdir_switch(next->mm.pgdir);
+    switch_context(&prev->esp, next->esp);
+
+    /* Back in 'prev', possibly much later. */
+    restore_flags(eflags);
+    return 1;
+}
+
+void sched_tick(const struct interrupt_frame *regs)
+{
+    if (--current_task->slice > 0) {
+        return;
+    }
+
+    if ((regs->cs & 3) == PRIVL_USER) {
+        schedule();
+    }
+}
+
+struct task * kstack_guard_owner(uint32_t addr)
+{
+    uint32_t slot;
+
+    if ((addr & ~(PAGE_SIZE - 1)) == KERNEL_STACK_GUARD) {
+        return &tasks[0];
+    }
+
+    if (addr < KSTACK_AREA || addr >= KSTACK_AREA + NUM_TASKS * KSTACK_SLOT) {
+        return NULL;
+    }
+
+    slot = (addr - KSTACK_AREA) / KSTACK_SLOT;
+    if (addr - KSTACK_AREA - slot * KSTACK_SLOT >= PAGE_SIZE
+            || tasks[slot].kstack == 0) {
+        return NULL;
+    }
+
+    return &tasks[slot];
+}
+
+void kstack_print_stats(void)
+{
+    uint32_t peak;
+    uint32_t used;
+    int i;
+
+    peak = kstack_peak;
+    for (i = 1; i < NUM_TASKS; i++) {
+        if (tasks[i].state != TASK_RUNNABLE) {
+            continue;
+        }
+        used = kstack_usage(tasks[i].kstack, KSTACK_SIZE);
+        if (used > peak) {
+            peak = used;
+        }
+    }
+
+    kprintf("kernel stacks (bytes): idle %lu of %d, tasks %lu of %d\n",
+        kstack_usage(KERNEL_STACK_BASE - KERNEL_STACK_SIZE, KERNEL_STACK_SIZE),
+        KERNEL_STACK_SIZE, peak, KSTACK_SIZE);
+}
+
+static struct task * alloc_task(void)
+{
+    struct task *t;
+    int i;
+
+    for (i = 1; i < NUM_TASKS; i++) {
+        t = &tasks[i];
+        if (t->state == TASK_UNUSED) {
+            memset(t, 0, sizeof(struct task));
+            t->state = TASK_NEW;
+            return t;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Maps a kernel stack into the task's slot of the kernel stack area.
+ */
+static int kstack_alloc(struct task *t)
+{
+    uint32_t base;
+    uint32_t frame;
+    uint32_t i;
+
+    base = KSTACK_AREA + (t - tasks) * KSTACK_SLOT + PAGE_SIZE;
+    for (i = 0; i < KSTACK_SIZE; i += PAGE_SIZE) {
+        frame = frame_alloc(0);
+        if (frame == 0 || kmap_page(base + i, frame) != 0) {
+            frame_free(frame);
+            t->kstack = base;
+            kstack_free(t);
+            return -1;
+        }
+    }
+
+    t->kstack = base;
+    kstack_poison(base, base + KSTACK_SIZE);
+    return 0;
+}
+
+static void kstack_free(struct task *t)
+{
+    uint32_t i;
+
+    if (t->kstack == 0) {
+        return;
+    }
+
+    for (i = 0; i < KSTACK_SIZE; i += PAGE_SIZE) {
+        frame_free(kunmap_page(t->kstack + i));
+    }
+    t->kstack = 0;
+}
+
+static void kstack_poison(uint32_t base, uint32_t limit)
+{
+    uint32_t *p;
+
+    for (p = (uint32_t *) base; p < (uint32_t *) limit; p++) {
+        *p = KSTACK_POISON;
+    }
+}
+
+/**
+ * Finds how many bytes of a stack have been used since it was poisoned.
+ */
+static uint32_t kstack_usage(uint32_t base, uint32_t size)
+{
+    uint32_t *p;
+
+    p = (uint32_t *) base;
+    while (p < (uint32_t *) (base + size) && *p == KSTACK_POISON) {
+        p++;
+    }
+
+    return base + size - (uint32_t) p;
+}
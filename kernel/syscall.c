@@ -0,0 +1,319 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * Copyright (C) 2018 Wes Hampson. All Rights Reserved.                       *
+ *                                                                            *
+ * This file is part of the Lyra operating system.                            *
+ *                                                                            *
+ * Lyra is free software: you can redistribute it and/or modify               *
+ * it under the terms of version 2 of the GNU General Public License          *
+ * as published by the Free Software Foundation.                              *
+ *                                                                            *
+ * See LICENSE in the top-level directory for a copy of the license.          *
+ * You may also visit <https://www.gnu.org/licenses/gpl-2.0.txt>.             *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+/*-----------------------------------------------------------------------------
+ *   File: kernel/syscall.c
+ * Author: Wes Hampson
+ *   Desc: System call dispatcher and handlers.
+ *
+ * Every system call is timed with the TSC. Along with a call count, each one
+ * keeps a histogram of its latency in power-of-2 buckets, so slow paths show
+ * up without any extra instrumentation.
+ *----------------------------------------------------------------------------*/
+
+#include <stdbool.h>
+#include <lyra/kernel.h>
+#include <lyra/cpu.h>
+#include <lyra/descriptor.h>
+#include <lyra/interrupt.h>
+#include <lyra/memory.h>
+#include <lyra/proc.h>
+#include <lyra/syscall.h>
+#include <lyra/tty.h>
+#include <drivers/timer.h>
+
+/* Number of latency histogram buckets; bucket i counts calls that took
+   [2^i, 2^(i+1)) cycles. */
+#define HIST_BUCKETS    32
+
+typedef int (*syscall_fn)(struct interrupt_frame *regs);
+
+struct syscall_stats {
+    uint32_t calls;             /* number of calls */
+    uint32_t errors;            /* number of calls that returned -1 */
+    uint64_t cycles;            /* total cycles spent in the handler */
+    uint32_t hist[HIST_BUCKETS];
+};
+
+static int sys_read(struct interrupt_frame *regs);
+static int sys_write(struct interrupt_frame *regs);
+static int sys_time(struct interrupt_frame *regs);
+static int sys_yield(struct interrupt_frame *regs);
+static int sys_exit(struct interrupt_frame *regs);
+static int sys_getpid(struct interrupt_frame *regs);
+static int sys_fork(struct interrupt_frame *regs);
+
+static const syscall_fn SYSCALLS[NUM_SYSCALLS] = {
+    [SYS_READ]   = sys_read,
+    [SYS_WRITE]  = sys_write,
+    [SYS_TIME]   = sys_time,
+    [SYS_YIELD]  = sys_yield,
+    [SYS_EXIT]   = sys_exit,
+    [SYS_GETPID] = sys_getpid,
+    [SYS_FORK]   = sys_fork
+};
+
+static const char * const SYSCALL_NAMES[NUM_SYSCALLS] = {
+    [SYS_READ]   = "read",
+    [SYS_WRITE]  = "write",
+    [SYS_TIME]   = "time",
+    [SYS_YIELD]  = "yield",
+    [SYS_EXIT]   = "exit",
+    [SYS_GETPID] = "getpid",
+    [SYS_FORK]   = "fork"
+};
+
+bool sysenter_enabled = false;
+
+static struct syscall_stats stats[NUM_SYSCALLS];
+static uint32_t bad_syscalls;
+
+static int fd_to_tty(uint32_t fd);
+
+void syscall_init(void)
+{
+    uint32_t sig;
+
+    if (!cpu_has(CPU_FEAT_SEP | CPU_FEAT_MSR)) {
+        return;
+    }
+
+    /* Early Pentium Pros report SEP but don't actually support it. */
+    sig = cpu_signature;
+    if (cpu_family(sig) == 6 && cpu_model(sig) < 3 && cpu_stepping(sig) < 3) {
+        return;
+    }
+
+    /* SYSENTER derives SS from CS (+8), and SYSEXIT derives the user CS and
+       SS from it as well (+16, +24); the GDT is laid out to match. */
+    wrmsr(MSR_SYSENTER_CS, KERNEL_CS);
+    wrmsr(MSR_SYSENTER_ESP, KERNEL_STACK_BASE);
+    wrmsr(MSR_SYSENTER_EIP, (uint32_t) sysenter_entry);
+    sysenter_enabled = true;
+}
+
+void sysenter_set_stack(uint32_t esp)
+{
+    if (sysenter_enabled) {
+        wrmsr(MSR_SYSENTER_ESP, esp);
+    }
+}
+
+__attribute__((fastcall))
+int do_sysenter(struct interrupt_frame *regs)
+{
+    if (!access_ok(regs, regs->esp, sizeof(uint32_t))) {
+        /* No way to know where to go back to; returning to 0 will fault in
+           user mode, which is the best we can do for now. */
+        regs->eip = 0;
+        return -1;
+    }
+
+    /* Pop the return address, so that the frame looks just like one from
+       'int $0x80' and could be returned through with iret just as well. */
+    regs->eip = *((uint32_t *) regs->esp);
+    regs->esp += sizeof(uint32_t);
+    return do_syscall(regs);
+}
+
+__attribute__((fastcall))
+int do_syscall(struct interrupt_frame *regs)
+{
+    struct syscall_stats *st;
+    uint32_t nr;
+    uint32_t eflags;
+    uint32_t cycles;
+    uint64_t start;
+    int bucket;
+    int ret;
+
+    nr = regs->eax;
+    if (nr >= NUM_SYSCALLS || SYSCALLS[nr] == NULL) {
+        bad_syscalls++;
+        return -1;
+    }
+
+    start = rdtsc();
+    ret = SYSCALLS[nr](regs);
+    cycles = (uint32_t) (rdtsc() - start);
+
+    bucket = (cycles == 0) ? 0 : 31 - __builtin_clz(cycles);
+
+    st = &stats[nr];
+    cli_save(eflags);
+    st->calls++;
+    st->cycles += cycles;
+    st->hist[bucket]++;
+    if (ret == -1) {
+        st->errors++;
+    }
+    restore_flags(eflags);
+
+    return ret;
+}
+
+bool access_ok(const struct interrupt_frame *regs, uint32_t addr, uint32_t n)
+{
+    if ((regs->cs & 3) != PRIVL_USER) {
+        return true;
+    }
+
+    return addr >= USER_BASE && addr < USER_LIMIT && n <= USER_LIMIT - addr;
+}
+
+void syscall_print_stats(void)
+{
+    const struct syscall_stats *st;
+    uint64_t avg;
+    int lo, hi;
+    int i, j;
+
+    for (i = 0; i < NUM_SYSCALLS; i++) {
+        st = &stats[i];
+        if (st->calls == 0) {
+            continue;
+        }
+
+        avg = st->cycles;
+        div64(&avg, st->calls);
+        kprintf("%-6s %lu calls, %lu errors, avg %lu cycles\n",
+            SYSCALL_NAMES[i], st->calls, st->errors, (uint32_t) avg);
+
+        /* Only print the populated part of the histogram. */
+        for (lo = 0; lo < HIST_BUCKETS && st->hist[lo] == 0; lo++);
+        for (hi = HIST_BUCKETS - 1; hi > lo && st->hist[hi] == 0; hi--);
+        for (j = lo; j <= hi; j++) {
+            kprintf("    >= 2^%-2d cycles: %lu\n", j, st->hist[j]);
+        }
+    }
+
+    if (bad_syscalls > 0) {
+        kprintf("invalid system calls: %lu\n", bad_syscalls);
+    }
+}
+
+/**
+ * Reads up to n characters from a TTY without blocking.
+ *
+ * EBX - file descriptor
+ * ECX - buffer
+ * EDX - max number of characters to read
+ */
+static int sys_read(struct interrupt_frame *regs)
+{
+    int chan;
+
+    chan = fd_to_tty(regs->ebx);
+    if (chan < 0 || (int) regs->edx < 0
+            || !access_ok(regs, regs->ecx, regs->edx)) {
+        return -1;
+    }
+
+    return tty_read(chan, (char *) regs->ecx, (int) regs->edx);
+}
+
+/**
+ * Writes n characters to a TTY.
+ *
+ * EBX - file descriptor
+ * ECX - buffer
+ * EDX - number of characters to write
+ */
+static int sys_write(struct interrupt_frame *regs)
+{
+    int chan;
+
+    chan = fd_to_tty(regs->ebx);
+    if (chan < 0 || (int) regs->edx < 0
+            || !access_ok(regs, regs->ecx, regs->edx)) {
+        return -1;
+    }
+
+    return tty_write(chan, (const char *) regs->ecx, (int) regs->edx);
+}
+
+/**
+ * Gets the number of timer ticks (milliseconds) since boot.
+ *
+ * EBX - if not NULL, where to store the result as well
+ */
+static int sys_time(struct interrupt_frame *regs)
+{
+    uint32_t t;
+
+    t = timer_ticks;
+    if (regs->ebx != 0) {
+        if (!access_ok(regs, regs->ebx, sizeof(uint32_t))) {
+            return -1;
+        }
+        *((uint32_t *) regs->ebx) = t;
+    }
+
+    return (int) t;
+}
+
+/**
+ * Gives up the rest of the caller's time slice.
+ */
+static int sys_yield(struct interrupt_frame *regs)
+{
+    (void) regs;
+
+    schedule();
+    return 0;
+}
+
+/**
+ * Terminates the calling process.
+ *
+ * EBX - exit status
+ */
+static int sys_exit(struct interrupt_frame *regs)
+{
+    proc_exit((int) regs->ebx);
+}
+
+/**
+ * Gets the caller's process ID.
+ */
+static int sys_getpid(struct interrupt_frame *regs)
+{
+    (void) regs;
+
+    return current_task->pid;
+}
+
+/**
+ * Creates a copy of the calling process. Returns the child's PID to the
+ * parent and 0 to the child.
+ */
+static int sys_fork(struct interrupt_frame *regs)
+{
+    return proc_fork(regs);
+}
+
+static int fd_to_tty(uint32_t fd)
+{
+    switch (fd) {
+        case FD_STDIN:
+        case FD_STDOUT:
+        case FD_STDERR:
+            return TTY_CONSOLE;
+    }
+
+    if (fd >= FD_COM1 && fd < NUM_FD) {
+        return TTY_COM1 + (fd - FD_COM1);
+    }
+
+    return -1;
+}
@@ -21,6 +21,7 @@
 #include <lyra/input.h>
 #include <lyra/console.h>
 #include <lyra/interrupt.h>
+#include <drivers/uart.h>
 
 #define NUM_TTY 5
 
@@ -36,22 +37,34 @@ static struct tty tty_table[NUM_TTY] = {
     },
     {
         /* COM1 */
-        .termio = { 0 },
+        .termio = {
+            .c_iflag = ICRNL,
+            .c_oflag = OPOST | ONLCR
+        },
         .column = 0
     },
     {
         /* COM2 */
-        .termio = { 0 },
+        .termio = {
+            .c_iflag = ICRNL,
+            .c_oflag = OPOST | ONLCR
+        },
         .column = 0
     },
     {
         /* COM3 */
-        .termio = { 0 },
+        .termio = {
+            .c_iflag = ICRNL,
+            .c_oflag = OPOST | ONLCR
+        },
         .column = 0
     },
     {
         /* COM4 */
-        .termio = { 0 },
+        .termio = {
+            .c_iflag = ICRNL,
+            .c_oflag = OPOST | ONLCR
+        },
         .column = 0
     },
 };
@@ -82,6 +95,18 @@ void tty_init(void)
     }
 
     tty_table[TTY_CONSOLE].write = console_write;
+    for (i = TTY_COM1; i <= TTY_COM4; i++) {
+        tty_table[i].write = uart_write;
+    }
+}
+
+struct tty * tty_get(int chan)
+{
+    if (chan < 0 || chan >= NUM_TTY) {
+        return NULL;
+    }
+
+    return tty_table + chan;
 }
 
 int tty_read(int chan, char *buf, int n)
@@ -150,9 +175,15 @@ int tty_write(int chan, const char *buf, int n)
 
     do_write:
         tty_putch(tty, c_out);
-        tty->write(tty);
+
+        /* Only drain the queue when it's about to fill up. */
+        if (TTY_QUEUE_BUFLEN - tty->wr_q.len < TTY_WRITE_ROOM) {
+            tty->write(tty);
+        }
     }
 
+    tty->write(tty);
+
     return i;
 }
 
@@ -215,11 +246,19 @@ void tty_queue_init(struct tty_queue *q)
 unsigned char tty_queue_get(struct tty_queue *q)
 {
     unsigned char c;
+    uint32_t flags;
 
     /* NOTE: always check if the queue is empty first.
        You will get back the wrong value if you don't. */
 
-    if (q == NULL || q->empty) {
+    if (q == NULL) {
+        return 0;
+    }
+
+    /* Queues are shared with interrupt handlers. */
+    cli_save(flags);
+    if (q->empty) {
+        restore_flags(flags);
         return 0;
     }
 
@@ -234,13 +273,22 @@ unsigned char tty_queue_get(struct tty_queue *q)
     if (q->tail == q->head) {
         q->empty = true;
     }
+    restore_flags(flags);
 
     return c;
 }
 
 void tty_queue_put(struct tty_queue *q, unsigned char c)
 {
-    if (q == NULL || q->full) {
+    uint32_t flags;
+
+    if (q == NULL) {
+        return;
+    }
+
+    cli_save(flags);
+    if (q->full) {
+        restore_flags(flags);
         return;
     }
 
@@ -255,4 +303,5 @@ void tty_queue_put(struct tty_queue *q, unsigned char c)
     if (q->head == q->tail) {
         q->full = true;
     }
+    restore_flags(flags);
 }
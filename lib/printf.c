@@ -24,17 +24,42 @@
 #include <lyra/kernel.h>
 #include <lyra/tty.h>
 
+/* Size of the on-stack staging buffer used when printing to a file.
+   Output is handed to the TTY layer one chunk at a time. */
+#define CHUNK_LEN   128
+
+/* Size of the buffer used for formatting numbers; large enough to hold a
+   64-bit value in octal. */
+#define NUM_BUFLEN  24
+
 /* Default values for parameters */
 #define W_NONE  0
 #define P_NONE  (-1)
 #define L_NONE  0
 
+/* Width/precision to be taken from the argument list ('*') */
+#define W_ARG   (-1)
+#define P_ARG   (-2)
+
+/* Largest width/precision that will be honored */
+#define WP_MAX  0x7FFF
+
+/* Internal length specifier for 'll' */
+#define L_LLONG 'L'
+
 enum printf_flags {
     F_NONE      = 0,
     F_PRINTSIGN = (1 << 0), /* show sign where applicable */
     F_SIGNALIGN = (1 << 1), /* if no sign printed, print space */
     F_PREFIX    = (1 << 2), /* print radix prefix */
-    F_ZEROPAD   = (1 << 3)  /* pad with zeros instead of spaces */
+    F_ZEROPAD   = (1 << 3), /* pad with zeros instead of spaces */
+    F_LJUST     = (1 << 4)  /* left-justify */
+};
+
+enum printf_fmt_state {
+    PF_NEW,                 /* format not compiled yet */
+    PF_READY,               /* format compiled */
+    PF_DYNAMIC              /* format too complex, parse on every call */
 };
 
 struct printf_params {
@@ -45,6 +70,8 @@ struct printf_params {
     bool bounded;           /* abide by max char limit */
     bool use_buf;           /* 0 = write to fd, 1 = write to buf */
     bool buf_full;          /* output buffer is full (bounded = 1 only) */
+    char *chunk;            /* staging buffer (use_buf = 0 only) */
+    int chunk_len;          /* number of chars in staging buffer */
     int flags;              /* formatting flags (see above) */
     int typeid;             /* argument type */
     int w;                  /* width */
@@ -56,38 +83,59 @@ struct printf_params {
     bool ljust;             /* left-justified */
 };
 
-enum printf_fmt_state {
-    S_READF,                /* reading flags */
-    S_READW,                /* reading width */
-    S_READP,                /* reading precision */
-    S_READL                 /* reading length (not supported yet) */
-};
-
 enum typeid {
     T_SHORT,
     T_INT,
     T_LONG,
+    T_LLONG,
     T_USHORT,
     T_UINT,
     T_ULONG,
+    T_ULLONG,
     T_CHARPTR,
     T_VOIDPTR
 };
 
 static int do_printf(struct printf_params *params, const char *f, va_list *ap);
+static int do_printf_fmt(struct printf_params *params,
+                         const struct printf_fmt *pf, va_list *ap);
+static const char * parse_spec(const char *f, struct printf_spec *spec);
+static int do_spec(struct printf_params *params,
+                   const struct printf_spec *spec, va_list *ap);
+static bool fmt_ready(struct printf_fmt *pf, const char *fmt);
+static void compile_fmt(struct printf_fmt *pf, const char *fmt);
+static int int_type(char l, bool sign);
 
 static int fmt_char(struct printf_params *params, va_list *ap);
 static int fmt_string(struct printf_params *params, va_list *ap);
 static int fmt_int(struct printf_params *params, va_list *ap);
 
-static unsigned long nextarg(int typeid, va_list *ap);
+static uint64_t nextarg(int typeid, va_list *ap);
 
 static int pad(struct printf_params *params, int n, char c);
 static int writechar(struct printf_params *params, char c);
 static int writestr(struct printf_params *params, const char *str, int len);
-
-static char * strlower(char *str);
-static int num2str(unsigned long val, char *str, int base, bool sign_allowed);
+static void flush(struct printf_params *params);
+
+static char * fmt_dec(char *end, uint64_t val);
+static char * fmt_dec32(char *end, uint32_t val);
+static char * fmt_hex(char *end, uint64_t val, const char *digits);
+static char * fmt_oct(char *end, uint64_t val);
+
+/* Lookup tables for number formatting */
+static const char dec_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+static const char hex_upper[] = "0123456789ABCDEF";
+static const char hex_lower[] = "0123456789abcdef";
 
 int printf(const char *fmt, ...)
 {
@@ -104,17 +152,23 @@ int printf(const char *fmt, ...)
 int vprintf(const char *fmt, va_list args)
 {
     int count;
+    char chunk[CHUNK_LEN];
     struct printf_params params;
 
     if (fmt == NULL) {
         return -1;
     }
 
-    params.fd = 0;
+    params.fd = 1;
     params.use_buf = false;
     params.bounded = false;
+    params.chunk = chunk;
+    params.chunk_len = 0;
 
-    return do_printf(&params, fmt, &args);
+    count = do_printf(&params, fmt, &args);
+    flush(&params);
+
+    return count;
 }
 
 int sprintf(char *str, const char *fmt, ...)
@@ -176,7 +230,72 @@ int vsnprintf(char *str, size_t n, const char *fmt, va_list args)
 
     count = do_printf(&params, fmt, &args);
     if (n > 0) {
-        str[n - 1] = '\0';
+        str[(count < (int) n) ? count : (int) n - 1] = '\0';
+    }
+
+    return count;
+}
+
+int cprintf(struct printf_fmt *pf, const char *fmt, ...)
+{
+    int retval;
+    va_list ap;
+
+    va_start(ap, fmt);
+    retval = vcprintf(pf, fmt, ap);
+    va_end(ap);
+
+    return retval;
+}
+
+int vcprintf(struct printf_fmt *pf, const char *fmt, va_list args)
+{
+    int count;
+    char chunk[CHUNK_LEN];
+    struct printf_params params;
+
+    if (fmt == NULL) {
+        return -1;
+    }
+
+    if (!fmt_ready(pf, fmt)) {
+        return vprintf(fmt, args);
+    }
+
+    params.fd = 1;
+    params.use_buf = false;
+    params.bounded = false;
+    params.chunk = chunk;
+    params.chunk_len = 0;
+
+    count = do_printf_fmt(&params, pf, &args);
+    flush(&params);
+
+    return count;
+}
+
+int vcsnprintf(char *str, size_t n, struct printf_fmt *pf, const char *fmt,
+               va_list args)
+{
+    int count;
+    struct printf_params params;
+
+    if (fmt == NULL || str == NULL) {
+        return -1;
+    }
+
+    if (!fmt_ready(pf, fmt)) {
+        return vsnprintf(str, n, fmt, args);
+    }
+
+    params.buf = str;
+    params.n = n;
+    params.use_buf = true;
+    params.bounded = true;
+
+    count = do_printf_fmt(&params, pf, &args);
+    if (n > 0) {
+        str[(count < (int) n) ? count : (int) n - 1] = '\0';
     }
 
     return count;
@@ -184,301 +303,304 @@ int vsnprintf(char *str, size_t n, const char *fmt, va_list args)
 
 static int do_printf(struct printf_params *params, const char *f, va_list *ap)
 {
-    bool formatting;
-    char *numptr;
-    int state;
+    struct printf_spec spec;
+    const char *lit;
     int count;
-    char c;
 
-    formatting = false;
-    numptr = NULL;
-    state = S_READF;
     count = 0;
+    params->pos = 0;
+    params->buf_full = false;
+
+    while (*f != '\0') {
+        /* Copy literal text in one go. */
+        lit = f;
+        while (*f != '\0' && *f != '%') {
+            f++;
+        }
+        if (f > lit) {
+            count += writestr(params, lit, (int) (f - lit));
+        }
 
+        if (*f == '\0') {
+            break;
+        }
+
+        f = parse_spec(f + 1, &spec);
+        count += do_spec(params, &spec, ap);
+    }
+
+    return count;
+}
+
+static int do_printf_fmt(struct printf_params *params,
+                         const struct printf_fmt *pf, va_list *ap)
+{
+    const struct printf_spec *spec;
+    int count;
+    int i;
+
+    count = 0;
     params->pos = 0;
     params->buf_full = false;
 
-    while ((c = *(f++)) != '\0')
-    {
-        switch (c)
-        {
-            /* Format specifiers */
-            case '%':
-                if (!formatting) {
-                    formatting = true;
-                    /* Formatting defaults */
-                    state = S_READF;
-                    numptr = NULL;
-                    params->flags = F_NONE;
-                    params->w = W_NONE;
-                    params->p = P_NONE;
-                    params->l = L_NONE;
-                    params->ljust = false;
-                    continue;
-                }
-                goto sendchar;
+    for (i = 0; i < pf->nspec; i++) {
+        spec = &pf->spec[i];
+        if (spec->lit_len > 0) {
+            count += writestr(params, pf->fmt + spec->lit_off, spec->lit_len);
+        }
+        count += do_spec(params, spec, ap);
+    }
 
-            case 'd':
-            case 'i':
-                if (!formatting) {
-                    goto sendchar;
-                }
-                if (state == S_READW && numptr != NULL) { params->w = atoi(numptr); }
-                if (state == S_READP && numptr != NULL) { params->p = atoi(numptr); }
-                switch (params->l) {
-                    case 'h':
-                        params->typeid = T_SHORT;
-                        break;
-                    case 'l':
-                        params->typeid = T_LONG;
-                        break;
-                    default:
-                        params->typeid = T_INT;
-                        break;
-                }
-                params->sign = true;
-                params->base = 10;
-                count += fmt_int(params, ap);
-                formatting = false;
-                continue;
-
-            case 'u':
-                if (!formatting) {
-                    goto sendchar;
-                }
-                if (state == S_READW && numptr != NULL) { params->w = atoi(numptr); }
-                if (state == S_READP && numptr != NULL) { params->p = atoi(numptr); }
-                switch (params->l) {
-                    case 'h':
-                        params->typeid = T_USHORT;
-                        break;
-                    case 'l':
-                        params->typeid = T_ULONG;
-                        break;
-                    default:
-                        params->typeid = T_UINT;
-                        break;
-                }
-                params->sign = false;
-                params->base = 10;
-                count += fmt_int(params, ap);
-                formatting = false;
-                continue;
-
-            case 'o':
-                if (!formatting) {
-                    goto sendchar;
-                }
-                if (state == S_READW && numptr != NULL) { params->w = atoi(numptr); }
-                if (state == S_READP && numptr != NULL) { params->p = atoi(numptr); }
-                switch (params->l) {
-                    case 'h':
-                        params->typeid = T_USHORT;
-                        break;
-                    case 'l':
-                        params->typeid = T_ULONG;
-                        break;
-                    default:
-                        params->typeid = T_UINT;
-                        break;
-                }
-                params->base = 8;
-                count += fmt_int(params, ap);
-                formatting = false;
-                continue;
-
-            case 'p':
-                params->flags |= F_PREFIX;
-                goto hex;
-
-        hex:
-            case 'x':
-            case 'X':
-                if (!formatting) {
-                    goto sendchar;
-                }
-                if (state == S_READW && numptr != NULL) { params->w = atoi(numptr); }
-                if (state == S_READP && numptr != NULL) { params->p = atoi(numptr); }
-                switch (params->l) {
-                    case 'h':
-                        params->typeid = T_USHORT;
-                        break;
-                    case 'l':
-                        params->typeid = T_ULONG;
-                        break;
-                    default:
-                        params->typeid = T_UINT;
-                        break;
-                }
-                params->base = 16;
-                params->lower = (c == 'x');
-                count += fmt_int(params, ap);
-                formatting = false;
-                continue;
-
-            case 'c':
-                if (!formatting) {
-                    goto sendchar;
-                }
-                if (state == S_READW && numptr != NULL) { params->w = atoi(numptr); }
-                switch (params->l) {
-                    default:
-                        params->typeid = T_INT;
-                        break;
-                }
-                count += fmt_char(params, ap);
-                formatting = false;
-                continue;
+    return count;
+}
 
-            case 's':
-                if (!formatting) {
-                    goto sendchar;
-                }
-                if (state == S_READW && numptr != NULL) { params->w = atoi(numptr); }
-                if (state == S_READP && numptr != NULL) { params->p = atoi(numptr); }
-                switch (params->l) {
-                    default:
-                        params->typeid = T_CHARPTR;
-                        break;
-                }
-                count += fmt_string(params, ap);
-                formatting = false;
-                continue;
+/**
+ * Parses a single conversion specification.
+ *
+ * @param f    - pointer to the char following the '%'
+ * @param spec - parsed specification
+ * @return a pointer to the char following the specification
+ */
+static const char * parse_spec(const char *f, struct printf_spec *spec)
+{
+    int n;
 
-            /* Flags */
-            case '-':
-                if (!formatting) {
-                    goto sendchar;
-                }
-                else if (state == S_READF) {
-                    params->ljust = true;
-                }
-                continue;
+    spec->flags = F_NONE;
+    spec->w = W_NONE;
+    spec->p = P_NONE;
+    spec->l = L_NONE;
 
+    /* Flags */
+    for (;;) {
+        switch (*f) {
+            case '-':
+                spec->flags |= F_LJUST;
+                break;
             case '+':
-                if (!formatting) {
-                    goto sendchar;
-                }
-                else if (state == S_READF) {
-                    params->flags |= F_PRINTSIGN;
-                }
-                continue;
-
+                spec->flags |= F_PRINTSIGN;
+                break;
             case ' ':
-                if (!formatting) {
-                    goto sendchar;
-                }
-                else if (state == S_READF) {
-                    params->flags |= F_SIGNALIGN;
-                }
-                continue;
-
+                spec->flags |= F_SIGNALIGN;
+                break;
             case '#':
-                if (!formatting) {
-                    goto sendchar;
-                }
-                else if (state == S_READF) {
-                    params->flags |= F_PREFIX;
-                }
-                continue;
-
+                spec->flags |= F_PREFIX;
+                break;
             case '0':
-                if (!formatting) {
-                    goto sendchar;
-                }
-                else if (state == S_READF) {
-                    params->flags |= F_ZEROPAD;
-                    continue;
-                }
-                goto handle_num;
+                spec->flags |= F_ZEROPAD;
+                break;
+            default:
+                goto width;
+        }
+        f++;
+    }
 
-            /* Length */
-            case 'h':
-            case 'l':
-                if (!formatting) {
-                    goto sendchar;
-                }
-                else if (state == S_READW && numptr != NULL) {
-                    params->w = atoi(numptr);
-                }
-                else if (state == S_READP && numptr != NULL) {
-                    params->p = atoi(numptr);
-                }
-                state = S_READL;
-                params->l = c;
-                continue;
-
-            /* Special */
-            case '1':
-            case '2':
-            case '3':
-            case '4':
-            case '5':
-            case '6':
-            case '7':
-            case '8':
-            case '9':
-        handle_num:
-                if (!formatting) {
-                    goto sendchar;
-                }
-                if (numptr == NULL) {
-                    numptr = (char *) (f - 1);
-                }
-                if (state == S_READF) {
-                    state = S_READW;
-                }
-                continue;
+width:
+    if (*f == '*') {
+        spec->w = W_ARG;
+        f++;
+    }
+    else {
+        for (n = 0; isdigit(*f); f++) {
+            if (n <= WP_MAX) {
+                n = (n * 10) + (*f - '0');
+            }
+        }
+        spec->w = (n > WP_MAX) ? WP_MAX : n;
+    }
 
-            case '.':
-                if (!formatting) {
-                    goto sendchar;
+    /* Precision */
+    if (*f == '.') {
+        f++;
+        if (*f == '*') {
+            spec->p = P_ARG;
+            f++;
+        }
+        else {
+            for (n = 0; isdigit(*f); f++) {
+                if (n <= WP_MAX) {
+                    n = (n * 10) + (*f - '0');
                 }
-                state = S_READP;
-                params->p = 0;
+            }
+            spec->p = (n > WP_MAX) ? WP_MAX : n;
+        }
+    }
 
-                if (numptr != NULL) {
-                    params->w = atoi(numptr);
-                    numptr = NULL;
-                }
-                continue;
+    /* Length */
+    if (*f == 'h') {
+        spec->l = 'h';
+        if (*(++f) == 'h') {
+            f++;
+        }
+    }
+    else if (*f == 'l') {
+        spec->l = 'l';
+        if (*(++f) == 'l') {
+            spec->l = L_LLONG;
+            f++;
+        }
+    }
 
-            case '*':
-                if (!formatting) {
-                    goto sendchar;
-                }
-                if (numptr != NULL) {
-                    /* Invalid format, cancel. */
-                    formatting = false;
-                    break;
-                }
-                if (state == S_READF) {
-                    params->w = va_arg(*ap, int);
-                    if (params->w < 0) {
-                        params->ljust = true;
-                        params->w = negate(params->w);
-                    }
-                    state = S_READW;
-                }
-                else if (state == S_READP) {
-                    params->p = va_arg(*ap, int);
-                }
-                continue;
+    spec->conv = *f;
+    if (*f != '\0') {
+        f++;
+    }
 
-            /* Invalid specifier */
-            default:
-                if (!formatting) {
-                    goto sendchar;
-                }
-                formatting = false;
-                break;
+    return f;
+}
+
+static int do_spec(struct printf_params *params,
+                   const struct printf_spec *spec, va_list *ap)
+{
+    params->flags = spec->flags;
+    params->ljust = flag_set(spec->flags, F_LJUST);
+    params->w = spec->w;
+    params->p = spec->p;
+    params->l = spec->l;
+
+    if (params->w == W_ARG) {
+        params->w = va_arg(*ap, int);
+        if (params->w < 0) {
+            params->ljust = true;
+            params->w = negate(params->w);
         }
+    }
+    if (params->p == P_ARG) {
+        params->p = va_arg(*ap, int);
+        if (params->p < 0) {
+            params->p = P_NONE;
+        }
+    }
 
-    sendchar:
-        count += writechar(params, c);
+    switch (spec->conv) {
+        case 'd':
+        case 'i':
+            params->typeid = int_type(params->l, true);
+            params->sign = true;
+            params->base = 10;
+            return fmt_int(params, ap);
+
+        case 'u':
+            params->typeid = int_type(params->l, false);
+            params->sign = false;
+            params->base = 10;
+            return fmt_int(params, ap);
+
+        case 'o':
+            params->typeid = int_type(params->l, false);
+            params->sign = false;
+            params->base = 8;
+            return fmt_int(params, ap);
+
+        case 'p':
+            params->flags |= F_PREFIX;
+            /* fall through */
+        case 'x':
+        case 'X':
+            params->typeid = int_type(params->l, false);
+            params->sign = false;
+            params->base = 16;
+            params->lower = (spec->conv == 'x');
+            return fmt_int(params, ap);
+
+        case 'c':
+            params->typeid = T_INT;
+            return fmt_char(params, ap);
+
+        case 's':
+            params->typeid = T_CHARPTR;
+            return fmt_string(params, ap);
+
+        case '\0':
+            return 0;
+
+        /* '%', or an invalid specifier; print it verbatim */
+        default:
+            return writechar(params, spec->conv);
     }
+}
 
-    return count;
+/**
+ * Checks whether a precompiled format can be used, compiling it if this is
+ * the first time it's been seen.
+ */
+static bool fmt_ready(struct printf_fmt *pf, const char *fmt)
+{
+    if (pf == NULL) {
+        return false;
+    }
+
+    /* If we get interrupted here and the handler compiles the same format,
+       both compile to the same result, so no lock is needed. */
+    if (pf->state == PF_NEW || pf->fmt != fmt) {
+        compile_fmt(pf, fmt);
+    }
+
+    return pf->state == PF_READY;
+}
+
+/**
+ * Splits a format string into literal text and conversion specifications.
+ */
+static void compile_fmt(struct printf_fmt *pf, const char *fmt)
+{
+    struct printf_spec *spec;
+    const char *f;
+    const char *lit;
+    int n;
+
+    pf->state = PF_NEW;
+    pf->fmt = fmt;
+
+    f = fmt;
+    n = 0;
+    for (;;) {
+        /* The last entry only ever holds the text after the final
+           conversion. */
+        if (n == PRINTF_FMT_MAXSPEC + 1) {
+            pf->state = PF_DYNAMIC;
+            return;
+        }
+
+        lit = f;
+        while (*f != '\0' && *f != '%') {
+            f++;
+        }
+        if (f - fmt > UINT16_MAX) {
+            pf->state = PF_DYNAMIC;
+            return;
+        }
+
+        spec = &pf->spec[n++];
+        spec->lit_off = (uint16_t) (lit - fmt);
+        spec->lit_len = (uint16_t) (f - lit);
+
+        if (*f == '\0') {
+            spec->conv = '\0';
+            break;
+        }
+
+        f = parse_spec(f + 1, spec);
+        if (spec->conv == '\0') {
+            break;
+        }
+    }
+
+    pf->nspec = n;
+    pf->state = PF_READY;
+}
+
+static int int_type(char l, bool sign)
+{
+    switch (l) {
+        case 'h':
+            return (sign) ? T_SHORT : T_USHORT;
+        case 'l':
+            return (sign) ? T_LONG : T_ULONG;
+        case L_LLONG:
+            return (sign) ? T_LLONG : T_ULLONG;
+        default:
+            return (sign) ? T_INT : T_UINT;
+    }
 }
 
 static int fmt_char(struct printf_params *params, va_list *ap)
@@ -519,7 +641,7 @@ static int fmt_string(struct printf_params *params, va_list *ap)
     s = (char *) va_arg(*ap, char*);
     len = strlen(s);
 
-    if (params->p > 0) {
+    if (params->p > 0 && params->p < len) {
         len = params->p;
     }
     npad = params->w - len;
@@ -539,124 +661,118 @@ static int fmt_string(struct printf_params *params, va_list *ap)
 
 static int fmt_int(struct printf_params *params, va_list *ap)
 {
-    unsigned int val;
-    char padch;
-    int npad;
-    int nchar;
+    uint64_t val;
+    char buf[NUM_BUFLEN];
+    char *end;
+    char *num;
+    const char *prefix;
+    char sign;
     int ndigit;
-    bool print_plus;
-    bool sign_align;
-    char buf[32];
-    int buflen;
-
-    padch = ' ';
-    npad = 0;
-    sign_align = (flag_set(params->flags, F_SIGNALIGN) && params->base == 10);
-    print_plus = (flag_set(params->flags, F_PRINTSIGN) && params->base == 10);
+    int nprefix;
+    int nzero;
+    int npad;
+    int count;
 
     val = nextarg(params->typeid, ap);
-    // val = va_arg(*ap, int);
 
-    /* A value of zero with zero precision should be blank. */
-    if (params->p == 0 && val == 0) {
-        return 0;
+    sign = '\0';
+    if (params->sign && (int64_t) val < 0) {
+        sign = '-';
+        val = -val;
     }
-
-    /* A prefix should not be printed for 0. */
-    if (val == 0 && flag_set(params->flags, F_PREFIX)) {
-        params->flags &= ~F_PREFIX;
+    else if (flag_set(params->flags, F_PRINTSIGN) && params->base == 10) {
+        sign = '+';
+    }
+    else if (flag_set(params->flags, F_SIGNALIGN) && params->base == 10) {
+        sign = ' ';
     }
 
-    buflen = num2str(val, buf, params->base, params->sign);
-    ndigit = buflen;
-    if (params->lower) {
-        strlower(buf);
+    /* A value of zero with zero precision should be blank. */
+    if (params->p == 0 && val == 0) {
+        return 0;
     }
-    nchar = ndigit;
 
-    if (flag_set(params->flags, F_ZEROPAD) && params->p == P_NONE) {
-        padch = '0';
+    /* Digits are written right-to-left, ending at the end of the buffer. */
+    end = buf + sizeof(buf);
+    switch (params->base) {
+        case 8:
+            num = fmt_oct(end, val);
+            break;
+        case 16:
+            num = fmt_hex(end, val, (params->lower) ? hex_lower : hex_upper);
+            break;
+        default:
+            num = fmt_dec(end, val);
+            break;
     }
+    ndigit = (int) (end - num);
 
-    if (flag_set(params->flags, F_PREFIX)) {
+    /* A prefix should not be printed for 0. */
+    prefix = NULL;
+    nprefix = 0;
+    if (flag_set(params->flags, F_PREFIX) && val != 0) {
         switch (params->base) {
             case 8:
-                nchar += 1;
+                prefix = "0";
+                nprefix = 1;
                 break;
             case 16:
-                nchar += 2;
+                prefix = (params->lower) ? "0x" : "0X";
+                nprefix = 2;
                 break;
         }
     }
 
-    if (print_plus || sign_align) {
-        nchar += 1;
-    }
+    nzero = (params->p > ndigit) ? params->p - ndigit : 0;
+    npad = params->w - (ndigit + nzero + nprefix + ((sign) ? 1 : 0));
 
-    npad = params->w - nchar;
-    if (params->p > ndigit) {
-        npad -= params->p - ndigit;
+    /* Zero padding goes between the sign/prefix and the digits. */
+    if (npad > 0 && flag_set(params->flags, F_ZEROPAD)
+            && params->p == P_NONE && !params->ljust) {
+        nzero += npad;
+        npad = 0;
     }
 
-    if (flag_set(params->flags, F_PREFIX)) {
-        switch (params->base) {
-            case 8:
-                writechar(params, '0');
-                break;
-            case 16:
-                writechar(params, '0');
-                if (params->lower) {
-                    writechar(params, 'x');
-                }
-                else {
-                    writechar(params, 'X');
-                }
-                break;
-        }
-    }
-    else if (print_plus && (long) val >= 0) {
-        writechar(params, '+');
-    }
-    else if (sign_align && (long) val >= 0) {
-        writechar(params, ' ');
+    count = 0;
+    if (!params->ljust && npad > 0) {
+        count += pad(params, npad, ' ');
     }
-
-    if (!params->ljust && params->w > nchar) {
-        nchar += pad(params, npad, padch);
+    if (sign) {
+        count += writechar(params, sign);
     }
-
-    while (params->p > ndigit) {
-        writechar(params, '0');
-        ndigit++;
-        nchar++;
+    if (prefix != NULL) {
+        count += writestr(params, prefix, nprefix);
     }
-
-    writestr(params, buf, buflen);
-
-    if (params->ljust && params->w > nchar) {
-        nchar += pad(params, npad, ' ');
+    count += pad(params, nzero, '0');
+    count += writestr(params, num, ndigit);
+    if (params->ljust && npad > 0) {
+        count += pad(params, npad, ' ');
     }
 
-    return nchar;
+    return count;
 }
 
-static unsigned long nextarg(int typeid, va_list *ap)
+static uint64_t nextarg(int typeid, va_list *ap)
 {
-    unsigned long val;
+    uint64_t val;
 
+    /* Signed values are sign-extended to 64 bits. */
     val = 0;
     switch (typeid) {
         case T_SHORT:
-            val = va_arg(*ap, short int);
+            val = (int64_t) (short int) va_arg(*ap, int);
             break;
         case T_INT:
-            val = va_arg(*ap, int);
+            val = (int64_t) va_arg(*ap, int);
             break;
         case T_LONG:
-            val = va_arg(*ap, long int);
+            val = (int64_t) va_arg(*ap, long int);
+            break;
+        case T_LLONG:
+            val = (uint64_t) va_arg(*ap, long long int);
             break;
         case T_USHORT:
-            val = va_arg(*ap, unsigned short int);
+            val = (unsigned short int) va_arg(*ap, unsigned int);
             break;
         case T_UINT:
             val = va_arg(*ap, unsigned int);
@@ -664,79 +780,116 @@ static unsigned long nextarg(int typeid, va_list *ap)
         case T_ULONG:
             val = va_arg(*ap, unsigned long int);
             break;
+        case T_ULLONG:
+            val = va_arg(*ap, unsigned long long int);
+            break;
         case T_CHARPTR:
-            val = (unsigned long) va_arg(*ap, char*);
+            val = (uint32_t) va_arg(*ap, char*);
             break;
     }
 
     return val;
 }
 
-static char * strlower(char *str)
+/**
+ * Formats an unsigned decimal number. Digits are written right-to-left,
+ * ending just before 'end'.
+ *
+ * 64-bit values are split into 8-digit chunks so that the bulk of the work is
+ * done using 32-bit arithmetic; the kernel has no __udivdi3.
+ *
+ * @param end - pointer to one past the last char to write
+ * @param val - the number to format
+ * @return a pointer to the first digit
+ */
+static char * fmt_dec(char *end, uint64_t val)
 {
+    uint32_t chunk;
+    char *p;
     int i;
 
-    i = 0;
-    while (str[i] != '\0') {
-        str[i] = tolower(str[i]);
-        i++;
+    while ((val >> 32) != 0) {
+        chunk = div64(&val, 100000000);
+
+        /* Inner chunks need all eight digits, leading zeros included. */
+        p = fmt_dec32(end, chunk);
+        for (i = (int) (end - p); i < 8; i++) {
+            *(--p) = '0';
+        }
+        end = p;
     }
 
-    return str;
+    return fmt_dec32(end, (uint32_t) val);
 }
 
-/* itoa() but with more parameters :) */
-static int num2str(unsigned long val, char *str, int base, bool sign_allowed)
+static char * fmt_dec32(char *end, uint32_t val)
 {
-    static char lookup[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
-
-    char *str_base;
-    int i;
-    bool sign;
-
-    if (str == NULL) {
-        return 0;
+    uint32_t i;
+
+    /* Two digits at a time; the compiler turns the divide by a constant into
+       a multiply. */
+    while (val >= 100) {
+        i = (val % 100) * 2;
+        val /= 100;
+        *(--end) = dec_pairs[i + 1];
+        *(--end) = dec_pairs[i];
     }
 
-    if (base < 2 || base > 36) {
-        str[0] = '\0';
-        return 0;
+    if (val >= 10) {
+        i = val * 2;
+        *(--end) = dec_pairs[i + 1];
+        *(--end) = dec_pairs[i];
     }
-
-    /* Special case for zero */
-    if (val == 0) {
-        str[0] = '0';
-        str[1] = '\0';
-        return 1;
+    else {
+        *(--end) = '0' + val;
     }
 
-    str_base = str;
+    return end;
+}
+
+static char * fmt_hex(char *end, uint64_t val, const char *digits)
+{
+    uint32_t lo;
+    uint32_t hi;
+    int i;
 
-    if (sign_allowed && base == 10) {
-        sign = ((long) val) < 0;
-        if (sign && base == 10) {
-            val = /*(long)*/ negate(val);
+    lo = (uint32_t) val;
+    hi = (uint32_t) (val >> 32);
+
+    if (hi != 0) {
+        for (i = 0; i < 8; i++) {
+            *(--end) = digits[lo & 0xF];
+            lo >>= 4;
         }
-    }
-    else {
-        sign = false;
+        lo = hi;
     }
 
-    while (val > 0) {
-        i = (int) (val % base);
-        *str = lookup[i];
-        str++;
-        val /= base;
-    }
+    do {
+        *(--end) = digits[lo & 0xF];
+        lo >>= 4;
+    } while (lo != 0);
 
-    if (sign) {
-        *(str++) = '-';
+    return end;
+}
+
+static char * fmt_oct(char *end, uint64_t val)
+{
+    uint32_t lo;
+
+    /* 3 doesn't divide 32, so shift the whole 64-bit value until the rest
+       fits in a word. */
+    while ((val >> 32) != 0) {
+        *(--end) = '0' + ((uint32_t) val & 7);
+        val >>= 3;
     }
-    *str = '\0';
 
-    strrev(str_base);
+    lo = (uint32_t) val;
+    do {
+        *(--end) = '0' + (lo & 7);
+        lo >>= 3;
+    } while (lo != 0);
 
-    return (int) (str - str_base);
+    return end;
 }
 
 int atoi(const char *str)
@@ -782,21 +935,31 @@ int atoi(const char *str)
 
 static int pad(struct printf_params *params, int n, char c)
 {
-    int i;
+    char buf[16];
+    int count;
+    int len;
 
-    for (i = 0; i < n; i++) {
-        writechar(params, c);
+    if (n <= 0) {
+        return 0;
     }
 
-    return i;
+    len = (n < (int) sizeof(buf)) ? n : (int) sizeof(buf);
+    memset(buf, c, len);
+
+    count = 0;
+    while (count < n) {
+        len = n - count;
+        if (len > (int) sizeof(buf)) {
+            len = sizeof(buf);
+        }
+        count += writestr(params, buf, len);
+    }
+
+    return count;
 }
 
 static int writechar(struct printf_params *params, char c)
 {
-    int count;
-
-    count = 0;
-
     if (params->use_buf) {
         if (params->bounded) {
             if (params->n > 0 && params->pos < params->n - 1) {
@@ -809,23 +972,70 @@ static int writechar(struct printf_params *params, char c)
         return 1;
     }
 
-    switch (params->fd) {
-        case 1:
-            count += tty_write(TTY_CONSOLE, &c, 1);
-            break;
+    params->chunk[params->chunk_len++] = c;
+    if (params->chunk_len == CHUNK_LEN) {
+        flush(params);
     }
 
-    return count;
+    return 1;
 }
 
 static int writestr(struct printf_params *params, const char *str, int len)
 {
     int count;
+    int n;
+
+    /* Don't run past the end of the string. */
+    for (n = 0; n < len && str[n] != '\0'; n++);
+    len = n;
+
+    if (params->use_buf) {
+        n = len;
+        if (params->bounded) {
+            if (params->n == 0 || params->pos >= params->n - 1) {
+                return len;
+            }
+            if (params->pos + n > params->n - 1) {
+                n = params->n - 1 - params->pos;
+            }
+        }
+        memcpy(&params->buf[params->pos], str, n);
+        params->pos += n;
+        return len;
+    }
 
     count = 0;
-    while (count < len && *str != '\0') {
-        count += writechar(params, *(str++));
+    while (count < len) {
+        n = CHUNK_LEN - params->chunk_len;
+        if (n > len - count) {
+            n = len - count;
+        }
+        memcpy(&params->chunk[params->chunk_len], &str[count], n);
+        params->chunk_len += n;
+        count += n;
+
+        if (params->chunk_len == CHUNK_LEN) {
+            flush(params);
+        }
     }
 
     return count;
 }
+
+/**
+ * Sends the contents of the staging buffer to the output file.
+ */
+static void flush(struct printf_params *params)
+{
+    if (params->use_buf || params->chunk_len == 0) {
+        return;
+    }
+
+    switch (params->fd) {
+        case 1:
+            tty_write(TTY_CONSOLE, params->chunk, params->chunk_len);
+            break;
+    }
+
+    params->chunk_len = 0;
+}
@@ -0,0 +1,354 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * Copyright (C) 2018 Wes Hampson. All Rights Reserved.                       *
+ *                                                                            *
+ * This file is part of the Lyra operating system.                            *
+ *                                                                            *
+ * Lyra is free software: you can redistribute it and/or modify               *
+ * it under the terms of version 2 of the GNU General Public License          *
+ * as published by the Free Software Foundation.                              *
+ *                                                                            *
+ * See LICENSE in the top-level directory for a copy of the license.          *
+ * You may also visit <https://www.gnu.org/licenses/gpl-2.0.txt>.             *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+/*-----------------------------------------------------------------------------
+ *   File: mem/fault.c
+ * Author: Wes Hampson
+ *   Desc: Page fault handling and demand paging.
+ *
+ * User pages are mapped lazily, so most page faults are not errors. Each
+ * fault is sorted into one of the FAULT_* classes based on the error code,
+ * the VMA the address falls in, and (for write faults on present pages) the
+ * PTE, then resolved accordingly:
+ *
+ *   demand-zero   first touch of anonymous memory; map a zeroed frame
+ *   file          first touch of image-backed memory; map the image page
+ *                 itself if it's never written, otherwise a private copy
+ *   copy-on-write write to a page shared by fork(); give the writer its
+ *                 own copy, unless it's the last one sharing the page
+ *   stack growth  touch just below a VMA_GROWSDOWN area; extend the area,
+ *                 then treat it like demand-zero
+ *   invalid       anything else; the process is killed
+ *
+ * Every fault is counted and timed per class, from entry into the handler
+ * until the page is mapped.
+ *----------------------------------------------------------------------------*/
+
+#include <stdbool.h>
+#include <string.h>
+#include <lyra/kernel.h>
+#include <lyra/cpu.h>
+#include <lyra/interrupt.h>
+#include <lyra/mm.h>
+#include <lyra/proc.h>
+
+/* How far below the stack pointer a stack access may be. 'pushal' touches
+   up to 32 bytes below ESP before ESP is updated. */
+#define STACK_SLACK     32
+
+struct fault_stats {
+    uint32_t count;
+    uint64_t cycles;            /* total time to resolve */
+    uint32_t max;               /* worst-case time to resolve */
+};
+
+static const char * const FAULT_NAMES[NUM_FAULT_CLASSES] = {
+    [FAULT_DEMAND_ZERO] = "demand-zero",
+    [FAULT_FILE]        = "file",
+    [FAULT_COW]         = "copy-on-write",
+    [FAULT_STACK]       = "stack growth",
+    [FAULT_INVALID]     = "invalid"
+};
+
+static struct fault_stats stats[NUM_FAULT_CLASSES];
+
+static int classify(struct mm *mm, struct interrupt_frame *regs,
+                    uint32_t addr, struct vma **vma_out);
+static struct vma * stack_vma(struct mm *mm, struct interrupt_frame *regs,
+                              uint32_t addr);
+static int fill_page(struct mm *mm, struct vma *vma, uint32_t page);
+static int copy_page(struct mm *mm, struct vma *vma, uint32_t page);
+static void account(int class, uint64_t start);
+__attribute__((noreturn))
+static void bad_access(struct interrupt_frame *regs, uint32_t addr);
+
+static inline uint32_t read_cr2(void)
+{
+    uint32_t cr2;
+
+    __asm__ volatile (
+        "movl   %%cr2, %0"
+        : "=r"(cr2)
+    );
+    return cr2;
+}
+
+int do_page_fault(struct interrupt_frame *regs)
+{
+    struct mm *mm;
+    struct vma *vma;
+    uint32_t addr;
+    uint32_t page;
+    uint64_t start;
+    int class;
+    int ret;
+
+    start = rdtsc();
+    addr = read_cr2();
+    page = addr & ~(PAGE_SIZE - 1);
+    mm = &current_task->mm;
+
+    /* The kernel touches user memory on behalf of system calls, so faults
+       on user addresses are handled the same regardless of privilege. */
+    class = classify(mm, regs, addr, &vma);
+    switch (class) {
+        case FAULT_STACK:
+            vma->start = page;
+            /* fall through */
+        case FAULT_DEMAND_ZERO:
+        case FAULT_FILE:
+            ret = fill_page(mm, vma, page);
+            break;
+        case FAULT_COW:
+            ret = copy_page(mm, vma, page);
+            break;
+        default:
+            account(FAULT_INVALID, start);
+            if (current_task->pid == 0
+                    || addr < USER_BASE || addr >= USER_LIMIT) {
+                /* Kernel bug; let the caller deal with it. */
+                return -1;
+            }
+            bad_access(regs, addr);
+    }
+
+    if (ret != 0) {
+        kprintf_level(KLOG_ERR, "%s[%d]: out of memory\n",
+            current_task->name, current_task->pid);
+        proc_exit(-1);
+    }
+
+    account(class, start);
+    return 0;
+}
+
+void fault_print_stats(void)
+{
+    const struct fault_stats *st;
+    uint64_t avg;
+    int i;
+
+    for (i = 0; i < NUM_FAULT_CLASSES; i++) {
+        st = &stats[i];
+        avg = st->cycles;
+        if (st->count > 0) {
+            div64(&avg, st->count);
+        }
+
+        kprintf("%-14s %lu faults, avg %lu cycles, max %lu cycles\n",
+            FAULT_NAMES[i], st->count, (uint32_t) avg, st->max);
+    }
+}
+
+/**
+ * Works out what kind of fault this is.
+ *
+ * @param mm      - the faulting address space
+ * @param regs    - the faulting context
+ * @param addr    - the faulting address
+ * @param vma_out - receives the VMA the fault should be resolved in
+ * @return one of the FAULT_* classes
+ */
+static int classify(struct mm *mm, struct interrupt_frame *regs,
+                    uint32_t addr, struct vma **vma_out)
+{
+    struct vma *vma;
+    pte_t *pte;
+    uint32_t err;
+    uint32_t off;
+
+    err = regs->err_code;
+    vma = vma_find(mm, addr);
+    if (vma == NULL) {
+        vma = stack_vma(mm, regs, addr);
+        if (vma == NULL || flag_set(err, PF_PRESENT)) {
+            return FAULT_INVALID;
+        }
+        *vma_out = vma;
+        return FAULT_STACK;
+    }
+    *vma_out = vma;
+
+    if (flag_set(err, PF_WRITE) && !flag_set(vma->flags, VMA_WRITE)) {
+        return FAULT_INVALID;
+    }
+
+    if (flag_set(err, PF_PRESENT)) {
+        /* The only legitimate protection fault is a write to a page that's
+           shared copy-on-write. */
+        pte = get_pte(mm->pgdir, addr, false);
+        if (!flag_set(err, PF_WRITE) || pte == NULL || !pte->fields.p
+                || !flag_set(pte->value, PG_COW)) {
+            return FAULT_INVALID;
+        }
+        return FAULT_COW;
+    }
+
+    off = (addr & ~(PAGE_SIZE - 1)) - vma->start;
+    return (off < vma->image_size) ? FAULT_FILE : FAULT_DEMAND_ZERO;
+}
+
+/**
+ * Checks whether an access just below a stack area should grow the stack.
+ *
+ * @return the stack VMA, or NULL if the access isn't a stack access
+ */
+static struct vma * stack_vma(struct mm *mm, struct interrupt_frame *regs,
+                              uint32_t addr)
+{
+    struct vma *vma;
+    uint32_t page;
+    int i;
+
+    /* Find the first area above the address. */
+    for (i = 0; i < mm->nvmas; i++) {
+        if (addr < mm->vmas[i].start) {
+            break;
+        }
+    }
+    if (i == mm->nvmas || !flag_set(mm->vmas[i].flags, VMA_GROWSDOWN)) {
+        return NULL;
+    }
+
+    vma = &mm->vmas[i];
+    page = addr & ~(PAGE_SIZE - 1);
+    if (page < USER_BASE || vma->end - page > USER_STACK_MAX) {
+        return NULL;
+    }
+
+    /* Don't run into the area below. */
+    if (i > 0 && page < mm->vmas[i - 1].end) {
+        return NULL;
+    }
+
+    /* In user mode the stack pointer tells us whether this is really a
+       stack access. The kernel only touches the user stack on behalf of a
+       system call, so we trust it. */
+    if ((regs->cs & 3) == PRIVL_USER && addr + STACK_SLACK < regs->esp) {
+        return NULL;
+    }
+
+    return vma;
+}
+
+/**
+ * Maps a page of a VMA into an address space for the first time.
+ */
+static int fill_page(struct mm *mm, struct vma *vma, uint32_t page)
+{
+    uint32_t off;
+    uint32_t frame;
+    uint32_t n;
+    int flags;
+
+    off = page - vma->start;
+    flags = PG_USER;
+    if (flag_set(vma->flags, VMA_WRITE)) {
+        flags |= PG_RW;
+    }
+
+    /* Read-only pages fully backed by the image can share the image's
+       memory. Kernel memory is identity-mapped, so the image's address is
+       also its physical address. */
+    if (!flag_set(vma->flags, VMA_WRITE)
+            && off + PAGE_SIZE <= vma->image_size) {
+        return map_page(mm->pgdir, page, (uint32_t) vma->image + off, flags);
+    }
+
+    n = 0;
+    if (off < vma->image_size) {
+        n = vma->image_size - off;
+        if (n > PAGE_SIZE) {
+            n = PAGE_SIZE;
+        }
+    }
+
+    frame = frame_alloc((n < PAGE_SIZE) ? GFP_ZERO : 0);
+    if (frame == 0) {
+        return -1;
+    }
+    if (n > 0) {
+        memcpy((void *) frame, vma->image + off, n);
+    }
+
+    if (map_page(mm->pgdir, page, frame, flags) != 0) {
+        frame_free(frame);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Gives the faulting address space its own writable copy of a copy-on-write
+ * page. If nobody else is using the frame anymore, there's no need to copy.
+ */
+static int copy_page(struct mm *mm, struct vma *vma, uint32_t page)
+{
+    pte_t *pte;
+    uint32_t old;
+    uint32_t frame;
+
+    (void) vma;
+
+    pte = get_pte(mm->pgdir, page, false);
+    old = pte->fields.base_addr << PAGE_SHIFT;
+
+    if (frame_refcount(old) == 1) {
+        return map_page(mm->pgdir, page, old, PG_USER | PG_RW);
+    }
+
+    frame = frame_alloc(0);
+    if (frame == 0) {
+        return -1;
+    }
+    memcpy((void *) frame, (void *) old, PAGE_SIZE);
+
+    if (map_page(mm->pgdir, page, frame, PG_USER | PG_RW) != 0) {
+        frame_free(frame);
+        return -1;
+    }
+
+    frame_free(old);
+    return 0;
+}
+
+static void account(int class, uint64_t start)
+{
+    struct fault_stats *st;
+    uint32_t cycles;
+    uint32_t eflags;
+
+    cycles = (uint32_t) (rdtsc() - start);
+
+    st = &stats[class];
+    cli_save(eflags);
+    st->count++;
+    st->cycles += cycles;
+    if (cycles > st->max) {
+        st->max = cycles;
+    }
+    restore_flags(eflags);
+}
+
+/**
+ * Kills the current process for making an invalid memory access.
+ */
+static void bad_access(struct interrupt_frame *regs, uint32_t addr)
+{
+    kprintf_level(KLOG_ERR, "%s[%d]: invalid %s at %08lX (EIP=%08lX), "
+        "killed\n", current_task->name, current_task->pid,
+        flag_set(regs->err_code, PF_WRITE) ? "write" : "read", addr,
+        regs->eip);
+    proc_exit(-1);
+}
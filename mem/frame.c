@@ -0,0 +1,389 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * Copyright (C) 2018 Wes Hampson. All Rights Reserved.                       *
+ *                                                                            *
+ * This file is part of the Lyra operating system.                            *
+ *                                                                            *
+ * Lyra is free software: you can redistribute it and/or modify               *
+ * it under the terms of version 2 of the GNU General Public License          *
+ * as published by the Free Software Foundation.                              *
+ *                                                                            *
+ * See LICENSE in the top-level directory for a copy of the license.          *
+ * You may also visit <https://www.gnu.org/licenses/gpl-2.0.txt>.             *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+/*-----------------------------------------------------------------------------
+ *   File: mem/frame.c
+ * Author: Wes Hampson
+ *   Desc: Physical page frame allocator.
+ *
+ * Free frames live on one of two lists: the free list, whose frames contain
+ * garbage, and the zero pool, whose frames are known to be zero-filled. The
+ * idle loop moves frames from the free list to the zero pool a few at a time,
+ * so that GFP_ZERO allocations (e.g. anonymous memory on a page fault) don't
+ * have to pay for zeroing 4 KiB on the spot. Background zeroing uses
+ * non-temporal stores when the CPU supports them, so that filling the pool
+ * doesn't evict useful data from the cache.
+ *----------------------------------------------------------------------------*/
+
+#include <stdbool.h>
+#include <string.h>
+#include <lyra/kernel.h>
+#include <lyra/cpu.h>
+#include <lyra/interrupt.h>
+#include <lyra/memory.h>
+
+/* Zero pool sizing. */
+#define ZERO_POOL_MAX       512     /* max frames kept pre-zeroed (2 MiB) */
+#define ZERO_REFILL_BATCH   4       /* frames zeroed per call to refill */
+
+/* Frame flags. */
+#define FRAME_RESERVED      0x01    /* never handed out (e.g. frame table) */
+#define FRAME_FREE          0x02    /* on the free list or zero pool */
+
+/* End-of-list marker. */
+#define FRAME_NONE          0xFFFFFFFF
+
+/* Per-frame bookkeeping. */
+struct frame {
+    uint32_t next;          /* index of next frame in list */
+    uint16_t refcount;      /* number of users of this frame */
+    uint16_t flags;         /* FRAME_* flags */
+};
+
+/* A LIFO list of frames. */
+struct frame_list {
+    uint32_t head;          /* index of first frame */
+    uint32_t count;         /* number of frames in list */
+};
+
+static struct frame *frame_table;
+static uint32_t frame_base;
+static uint32_t num_frames;
+
+static struct frame_list free_list;     /* free frames with unknown contents */
+static struct frame_list zero_pool;     /* free frames known to be zero */
+
+static bool use_movnti;
+
+static struct {
+    uint32_t zero_hits;         /* GFP_ZERO served from the pool */
+    uint32_t zero_misses;       /* GFP_ZERO zeroed on the spot */
+    uint32_t idle_zeroed;       /* frames zeroed by the idle loop */
+    uint32_t out_of_memory;     /* failed allocations */
+    uint64_t hit_cycles;        /* total GFP_ZERO latency, hits */
+    uint64_t miss_cycles;       /* total GFP_ZERO latency, misses */
+    uint32_t hit_max;           /* worst-case GFP_ZERO latency, hits */
+    uint32_t miss_max;          /* worst-case GFP_ZERO latency, misses */
+} stats;
+
+static uint32_t list_pop(struct frame_list *list);
+static void list_push(struct frame_list *list, uint32_t idx);
+static void zero_frame(void *page);
+static void zero_frame_nt(void *page);
+
+static inline uint32_t frame_addr(uint32_t idx)
+{
+    return frame_base + (idx << PAGE_SHIFT);
+}
+
+static inline uint32_t frame_index(uint32_t addr)
+{
+    return (addr - frame_base) >> PAGE_SHIFT;
+}
+
+/**
+ * Checks whether a frame is owned by the frame allocator. Memory that isn't
+ * (e.g. the kernel image) may be mapped into user space, but is never
+ * reference counted or freed.
+ */
+static inline bool managed(uint32_t addr)
+{
+    return addr >= frame_base && (addr & (PAGE_SIZE - 1)) == 0
+        && frame_index(addr) < num_frames;
+}
+
+void frame_init(uint32_t base, uint32_t limit)
+{
+    uint32_t table_size;
+    uint32_t table_frames;
+    uint32_t i;
+
+    frame_base = base;
+    num_frames = (limit - base) >> PAGE_SHIFT;
+    use_movnti = cpu_has(CPU_FEAT_SSE2);
+
+    free_list.head = FRAME_NONE;
+    free_list.count = 0;
+    zero_pool.head = FRAME_NONE;
+    zero_pool.count = 0;
+
+    /* The frame table lives in the first few managed frames. */
+    frame_table = (struct frame *) base;
+    table_size = num_frames * sizeof(struct frame);
+    table_frames = (table_size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+
+    for (i = 0; i < table_frames; i++) {
+        frame_table[i].next = FRAME_NONE;
+        frame_table[i].refcount = 1;
+        frame_table[i].flags = FRAME_RESERVED;
+    }
+
+    /* Push in reverse so that low frames get handed out first. */
+    for (i = num_frames; i > table_frames; i--) {
+        frame_table[i - 1].refcount = 0;
+        frame_table[i - 1].flags = 0;
+        list_push(&free_list, i - 1);
+    }
+}
+
+uint32_t frame_alloc(int flags)
+{
+    uint32_t idx;
+    uint32_t eflags;
+    uint64_t start;
+    uint32_t cycles;
+    bool zeroed;
+
+    start = rdtsc();
+
+    cli_save(eflags);
+    if (flag_set(flags, GFP_ZERO)) {
+        idx = list_pop(&zero_pool);
+        zeroed = (idx != FRAME_NONE);
+        if (!zeroed) {
+            idx = list_pop(&free_list);
+        }
+    }
+    else {
+        /* Leave the pre-zeroed frames for those who need them. */
+        idx = list_pop(&free_list);
+        if (idx == FRAME_NONE) {
+            idx = list_pop(&zero_pool);
+        }
+        zeroed = false;
+    }
+
+    if (idx == FRAME_NONE) {
+        stats.out_of_memory++;
+        restore_flags(eflags);
+        return 0;
+    }
+
+    frame_table[idx].refcount = 1;
+    frame_table[idx].flags &= ~FRAME_FREE;
+    restore_flags(eflags);
+
+    if (!flag_set(flags, GFP_ZERO)) {
+        return frame_addr(idx);
+    }
+
+    if (!zeroed) {
+        /* The caller is about to use the page, so regular (cached) stores are
+           the better choice here. */
+        zero_frame((void *) frame_addr(idx));
+    }
+
+    cycles = (uint32_t) (rdtsc() - start);
+
+    cli_save(eflags);
+    if (zeroed) {
+        stats.zero_hits++;
+        stats.hit_cycles += cycles;
+        if (cycles > stats.hit_max) {
+            stats.hit_max = cycles;
+        }
+    }
+    else {
+        stats.zero_misses++;
+        stats.miss_cycles += cycles;
+        if (cycles > stats.miss_max) {
+            stats.miss_max = cycles;
+        }
+    }
+    restore_flags(eflags);
+
+    return frame_addr(idx);
+}
+
+void frame_free(uint32_t addr)
+{
+    uint32_t idx;
+    uint32_t eflags;
+
+    if (!managed(addr)) {
+        return;
+    }
+
+    idx = frame_index(addr);
+    cli_save(eflags);
+    if (frame_table[idx].flags & (FRAME_RESERVED | FRAME_FREE)) {
+        /* Double free or bogus address; ignore it. */
+        restore_flags(eflags);
+        return;
+    }
+
+    if (--frame_table[idx].refcount > 0) {
+        /* Still shared. */
+        restore_flags(eflags);
+        return;
+    }
+
+    list_push(&free_list, idx);
+    restore_flags(eflags);
+}
+
+void frame_ref(uint32_t addr)
+{
+    uint32_t idx;
+    uint32_t eflags;
+
+    if (!managed(addr)) {
+        return;
+    }
+
+    idx = frame_index(addr);
+    cli_save(eflags);
+    if (!(frame_table[idx].flags & (FRAME_RESERVED | FRAME_FREE))) {
+        frame_table[idx].refcount++;
+    }
+    restore_flags(eflags);
+}
+
+int frame_refcount(uint32_t addr)
+{
+    if (!managed(addr)) {
+        return -1;
+    }
+
+    return frame_table[frame_index(addr)].refcount;
+}
+
+int zero_pool_refill(void)
+{
+    uint32_t idx;
+    uint32_t eflags;
+    int count;
+
+    count = 0;
+    while (count < ZERO_REFILL_BATCH) {
+        cli_save(eflags);
+        if (zero_pool.count >= ZERO_POOL_MAX) {
+            restore_flags(eflags);
+            break;
+        }
+        idx = list_pop(&free_list);
+        restore_flags(eflags);
+
+        if (idx == FRAME_NONE) {
+            break;
+        }
+
+        /* The frame is on neither list while it's being zeroed, so this can
+           safely run with interrupts enabled. */
+        if (use_movnti) {
+            zero_frame_nt((void *) frame_addr(idx));
+        }
+        else {
+            zero_frame((void *) frame_addr(idx));
+        }
+
+        cli_save(eflags);
+        list_push(&zero_pool, idx);
+        stats.idle_zeroed++;
+        restore_flags(eflags);
+
+        count++;
+    }
+
+    return count;
+}
+
+void frame_print_stats(void)
+{
+    uint32_t requests;
+    uint64_t avg_hit;
+    uint64_t avg_miss;
+
+    requests = stats.zero_hits + stats.zero_misses;
+    avg_hit = stats.hit_cycles;
+    avg_miss = stats.miss_cycles;
+    if (stats.zero_hits > 0) {
+        div64(&avg_hit, stats.zero_hits);
+    }
+    if (stats.zero_misses > 0) {
+        div64(&avg_miss, stats.zero_misses);
+    }
+
+    kprintf("frames: %lu total, %lu free, %lu pre-zeroed (%s stores)\n",
+        num_frames, free_list.count + zero_pool.count, zero_pool.count,
+        (use_movnti) ? "non-temporal" : "regular");
+    kprintf("zero pool: %lu hits, %lu misses (%lu%% hit rate), "
+        "%lu zeroed while idle\n",
+        stats.zero_hits, stats.zero_misses,
+        (requests > 0) ? (stats.zero_hits * 100) / requests : 0,
+        stats.idle_zeroed);
+    kprintf("GFP_ZERO latency (cycles): hit avg %lu max %lu, "
+        "miss avg %lu max %lu\n",
+        (uint32_t) avg_hit, stats.hit_max,
+        (uint32_t) avg_miss, stats.miss_max);
+}
+
+static uint32_t list_pop(struct frame_list *list)
+{
+    uint32_t idx;
+
+    idx = list->head;
+    if (idx == FRAME_NONE) {
+        return FRAME_NONE;
+    }
+
+    list->head = frame_table[idx].next;
+    list->count--;
+    frame_table[idx].next = FRAME_NONE;
+
+    return idx;
+}
+
+static void list_push(struct frame_list *list, uint32_t idx)
+{
+    frame_table[idx].next = list->head;
+    frame_table[idx].flags |= FRAME_FREE;
+    list->head = idx;
+    list->count++;
+}
+
+/**
+ * Zeroes a page using regular stores.
+ */
+static void zero_frame(void *page)
+{
+    memset(page, 0, PAGE_SIZE);
+}
+
+/**
+ * Zeroes a page using non-temporal stores, bypassing the cache.
+ * Requires SSE2.
+ */
+static void zero_frame_nt(void *page)
+{
+    uint32_t count;
+
+    count = PAGE_SIZE / 16;
+
+    __asm__ volatile (
+        "                               \n\
+    .zero_nt_loop%=:                    \n\
+        movnti  %%eax, 0(%%edi)         \n\
+        movnti  %%eax, 4(%%edi)         \n\
+        movnti  %%eax, 8(%%edi)         \n\
+        movnti  %%eax, 12(%%edi)        \n\
+        addl    $16, %%edi              \n\
+        decl    %%ecx                   \n\
+        jnz     .zero_nt_loop%=         \n\
+        sfence                          \n\
+        "
+        : "+D"(page), "+c"(count)
+        : "a"(0)
+        : "memory", "cc"
+    );
+}
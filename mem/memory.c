@@ -16,92 +16,70 @@
  * Author: Wes Hampson
  *----------------------------------------------------------------------------*/
 
+#include <stdbool.h>
 #include <lyra/kernel.h>
+#include <lyra/interrupt.h>
+#include <lyra/io.h>
 #include <lyra/memory.h>
 
-/* Page directory base address */
-#define PD_BASE     0x1000
-
 #define PG_BIT      (1 << 31)   /* CR0 - enable paging */
+#define WP_BIT      (1 << 16)   /* CR0 - honor read-only pages in ring 0 */
 #define PSE_BIT     (1 << 4)    /* CR4 - allow for 4 MiB pages */
 
-static void paging_enable(void);
+/* CMOS ports and memory size registers. */
+#define PORT_CMOS_ADDR      0x70
+#define PORT_CMOS_DATA      0x71
+#define CMOS_NMI_DISABLE    0x80
+#define CMOS_EXTMEM_LO      0x30    /* KiB above 1 MiB (up to 64 MiB) */
+#define CMOS_EXTMEM_HI      0x31
+#define CMOS_HIGHMEM_LO     0x34    /* 64 KiB blocks above 16 MiB */
+#define CMOS_HIGHMEM_HI     0x35
 
-/* ===== Intel i386 Paging Structures ===== */
-/* See Chapter 3 of the Intel Software Developers Manual, Volume 3 for more
-   information about i386 memory paging structures.
-*/
-
-/* Page Directory Entry (PDE) for a 4 MiB page. */
-typedef union {
-    struct {
-        uint32_t p          : 1;  /* present */
-        uint32_t rw         : 1;  /* read/write; 1 = r/w, 0 = read only */
-        uint32_t us         : 1;  /* user/supervisor; 1 = user */
-        uint32_t pwt        : 1;  /* page-level write policy; 1 = WT, 0 = WB */
-        uint32_t pcd        : 1;  /* page-level cache disabled */
-        uint32_t a          : 1;  /* accessed; has been read or written */
-        uint32_t d          : 1;  /* dirty; has been written to */
-        uint32_t ps         : 1;  /* page size; 1 = 4 MiB */
-        uint32_t g          : 1;  /* global; don't flush from TLB */
-        uint32_t avail      : 3;  /* available for misc. use */
-        uint32_t pat        : 1;  /* page attr. table index */
-        uint32_t reserved   : 9;  /* reserved bits; set to 0 */
-        uint32_t base_addr  : 10; /* page base address (4 MiB aligned) */
-    } fields;
-    uint32_t value;
-} pde4m_t;
-
-/* Page Directory Entry (PDE) for a page table of 4 KiB pages. */
-typedef union {
-    struct {
-        uint32_t p          : 1;  /* (same descriptions as above) */
-        uint32_t rw         : 1;
-        uint32_t us         : 1;
-        uint32_t pwt        : 1;
-        uint32_t pcd        : 1;
-        uint32_t a          : 1;
-        uint32_t d          : 1;
-        uint32_t ps         : 1;
-        uint32_t g          : 1;
-        uint32_t avail      : 3;
-        uint32_t base_addr  : 20; /* page table base address (4 KiB aligned) */
-    } fields;
-    uint32_t value;
-} pde4k_t;
-
-/* Page Table Entry (PTE) for a 4 KiB page. */
-typedef union {
-    struct {
-        uint32_t p          : 1;  /* (same descriptions as above) */
-        uint32_t rw         : 1;
-        uint32_t us         : 1;
-        uint32_t pwt        : 1;
-        uint32_t pcd        : 1;
-        uint32_t a          : 1;
-        uint32_t d          : 1;
-        uint32_t pat        : 1;
-        uint32_t g          : 1;
-        uint32_t avail      : 3;
-        uint32_t base_addr  : 20; /* page base address (4 KiB aligned) */
-    } fields;
-    uint32_t value;
-} pte_t;
+uint32_t mem_size;
+
+static uint32_t read_cr3(void);
+static uint32_t detect_mem_size(void);
+static void paging_enable(void);
+static void guard_boot_stack(void);
+static void kstack_area_init(void);
 
 void mem_init(void)
 {
-    pde4m_t *page_dir = (pde4m_t *) PD_BASE;
-    for (int i = 0; i < 1024; i++) {
+    pde4m_t *page_dir;
+    uint32_t map_limit;
+    uint32_t i;
+
+    mem_size = detect_mem_size();
+    map_limit = mem_size;
+    if (map_limit > MEM_MAP_LIMIT) {
+        map_limit = MEM_MAP_LIMIT;
+    }
+    map_limit &= ~(PAGE_SIZE - 1);
+
+    page_dir = (pde4m_t *) KERNEL_PGDIR;
+    for (i = 0; i < 1024; i++) {
         page_dir[i].value = 0;
     }
 
-    page_dir[0].fields.p = 1;
-    page_dir[0].fields.rw = 1;
-    page_dir[0].fields.ps = 1;
-    page_dir[0].fields.g = 1;
-    page_dir[0].fields.base_addr = 0;
+    /* Identity-map all physical memory using 4 MiB pages. */
+    for (i = 0; i < (map_limit + LARGE_PAGE_SIZE - 1) >> LARGE_PAGE_SHIFT; i++) {
+        page_dir[i].fields.p = 1;
+        page_dir[i].fields.rw = 1;
+        page_dir[i].fields.ps = 1;
+        page_dir[i].fields.g = 1;
+        page_dir[i].fields.base_addr = i;
+    }
 
     paging_enable();
+
+    if (map_limit > FRAME_BASE) {
+        frame_init(FRAME_BASE, map_limit);
+    }
+
+    /* Both of these need page tables, so they have to wait for the frame
+       allocator. They must be done before the first pgdir_create(). */
+    guard_boot_stack();
+    kstack_area_init();
 }
 
 void flush_tlb(void)
@@ -113,9 +91,329 @@ void flush_tlb(void)
         "
         : /* no outputs */
         : /* no inputs */
+        : "eax", "memory"
+    );
+}
+
+uint8_t cmos_read(uint8_t reg)
+{
+    uint32_t eflags;
+    uint8_t val;
+
+    /* The index and data ports are a pair; don't let an interrupt handler
+       get in between. */
+    cli_save(eflags);
+    outb(CMOS_NMI_DISABLE | reg, PORT_CMOS_ADDR);
+    val = inb_p(PORT_CMOS_DATA);
+
+    /* Bit 7 of the index port masks NMIs for as long as it's set. */
+    outb(reg, PORT_CMOS_ADDR);
+    restore_flags(eflags);
+
+    return val;
+}
+
+uint32_t pgdir_create(void)
+{
+    pde4k_t *kernel_dir;
+    pde4k_t *dir;
+    uint32_t pgdir;
+    uint32_t i;
+
+    pgdir = frame_alloc(GFP_ZERO);
+    if (pgdir == 0) {
+        return 0;
+    }
+
+    /* Kernel mappings never change after mem_init(), so a copy of the
+       kernel's PDEs is all it takes to share them. */
+    kernel_dir = (pde4k_t *) KERNEL_PGDIR;
+    dir = (pde4k_t *) pgdir;
+    for (i = 0; i < 1024; i++) {
+        if (i < (USER_BASE >> LARGE_PAGE_SHIFT)
+                || i >= (USER_LIMIT >> LARGE_PAGE_SHIFT)) {
+            dir[i].value = kernel_dir[i].value;
+        }
+    }
+
+    return pgdir;
+}
+
+void pgdir_destroy(uint32_t pgdir)
+{
+    pde4k_t *dir;
+    pte_t *table;
+    uint32_t i, j;
+
+    dir = (pde4k_t *) pgdir;
+    for (i = USER_BASE >> LARGE_PAGE_SHIFT;
+            i < USER_LIMIT >> LARGE_PAGE_SHIFT; i++) {
+        if (!dir[i].fields.p) {
+            continue;
+        }
+
+        table = (pte_t *) (dir[i].fields.base_addr << PAGE_SHIFT);
+        for (j = 0; j < 1024; j++) {
+            if (table[j].fields.p) {
+                frame_free(table[j].fields.base_addr << PAGE_SHIFT);
+            }
+        }
+        frame_free((uint32_t) table);
+    }
+
+    frame_free(pgdir);
+}
+
+int pgdir_clone(uint32_t dst, uint32_t src)
+{
+    pde4k_t *src_dir;
+    pde4k_t *dst_dir;
+    pte_t *src_table;
+    pte_t *dst_table;
+    uint32_t table;
+    uint32_t i, j;
+
+    src_dir = (pde4k_t *) src;
+    dst_dir = (pde4k_t *) dst;
+    for (i = USER_BASE >> LARGE_PAGE_SHIFT;
+            i < USER_LIMIT >> LARGE_PAGE_SHIFT; i++) {
+        if (!src_dir[i].fields.p) {
+            continue;
+        }
+
+        table = frame_alloc(GFP_ZERO);
+        if (table == 0) {
+            return -1;
+        }
+        dst_dir[i].value = table | PG_USER | PG_RW | PG_PRESENT;
+
+        src_table = (pte_t *) (src_dir[i].fields.base_addr << PAGE_SHIFT);
+        dst_table = (pte_t *) table;
+        for (j = 0; j < 1024; j++) {
+            if (!src_table[j].fields.p) {
+                continue;
+            }
+
+            if (src_table[j].fields.rw) {
+                src_table[j].value &= ~PG_RW;
+                src_table[j].value |= PG_COW;
+            }
+            dst_table[j].value = src_table[j].value;
+            frame_ref(src_table[j].fields.base_addr << PAGE_SHIFT);
+        }
+    }
+
+    /* Writable pages in the source just became read-only. */
+    if (read_cr3() == src) {
+        flush_tlb();
+    }
+
+    return 0;
+}
+
+void pgdir_switch(uint32_t pgdir)
+{
+    if (read_cr3() == pgdir) {
+        return;
+    }
+
+    __asm__ volatile (
+        "movl   %0, %%cr3"
+        : /* no outputs */
+        : "r"(pgdir)
+        : "memory"
+    );
+}
+
+int map_page(uint32_t pgdir, uint32_t vaddr, uint32_t paddr, int flags)
+{
+    pte_t *pte;
+
+    if (vaddr < USER_BASE || vaddr >= USER_LIMIT) {
+        return -1;
+    }
+
+    pte = get_pte(pgdir, vaddr, true);
+    if (pte == NULL) {
+        return -1;
+    }
+
+    pte->value = (paddr & ~(PAGE_SIZE - 1)) | (flags & (PG_RW | PG_USER))
+        | PG_PRESENT;
+
+    if (read_cr3() == pgdir) {
+        __asm__ volatile ("invlpg (%0)" : : "r"(vaddr) : "memory");
+    }
+
+    return 0;
+}
+
+int kmap_page(uint32_t vaddr, uint32_t paddr)
+{
+    pte_t *pte;
+
+    if (vaddr < KSTACK_AREA || vaddr >= KSTACK_AREA + LARGE_PAGE_SIZE) {
+        return -1;
+    }
+
+    pte = get_pte(KERNEL_PGDIR, vaddr, false);
+    if (pte == NULL) {
+        return -1;
+    }
+
+    pte->value = (paddr & ~(PAGE_SIZE - 1)) | PG_GLOBAL | PG_RW | PG_PRESENT;
+    __asm__ volatile ("invlpg (%0)" : : "r"(vaddr) : "memory");
+
+    return 0;
+}
+
+uint32_t kunmap_page(uint32_t vaddr)
+{
+    pte_t *pte;
+    uint32_t paddr;
+
+    if (vaddr < KSTACK_AREA || vaddr >= KSTACK_AREA + LARGE_PAGE_SIZE) {
+        return 0;
+    }
+
+    pte = get_pte(KERNEL_PGDIR, vaddr, false);
+    if (pte == NULL || !pte->fields.p) {
+        return 0;
+    }
+
+    paddr = pte->fields.base_addr << PAGE_SHIFT;
+    pte->value = 0;
+    __asm__ volatile ("invlpg (%0)" : : "r"(vaddr) : "memory");
+
+    return paddr;
+}
+
+uint32_t virt_to_phys(uint32_t vaddr)
+{
+    pte_t *pte;
+
+    if (vaddr < MEM_MAP_LIMIT) {
+        return vaddr;
+    }
+
+    pte = get_pte(read_cr3(), vaddr, false);
+    if (pte == NULL || !pte->fields.p) {
+        return 0;
+    }
+
+    return (pte->fields.base_addr << PAGE_SHIFT) | (vaddr & (PAGE_SIZE - 1));
+}
+
+pte_t * get_pte(uint32_t pgdir, uint32_t vaddr, bool alloc)
+{
+    pde4k_t *pde;
+    uint32_t table;
+
+    pde = &((pde4k_t *) pgdir)[vaddr >> LARGE_PAGE_SHIFT];
+    if (!pde->fields.p) {
+        if (!alloc) {
+            return NULL;
+        }
+
+        table = frame_alloc(GFP_ZERO);
+        if (table == 0) {
+            return NULL;
+        }
+
+        /* Permissions are enforced by the PTEs; leave the PDE wide open. */
+        pde->value = table | PG_USER | PG_RW | PG_PRESENT;
+    }
+
+    table = pde->fields.base_addr << PAGE_SHIFT;
+    return &((pte_t *) table)[(vaddr >> PAGE_SHIFT) & 0x3FF];
+}
+
+static uint32_t read_cr3(void)
+{
+    uint32_t cr3;
+
+    __asm__ volatile (
+        "movl   %%cr3, %0"
+        : "=r"(cr3)
     );
+    return cr3;
+}
+
+/**
+ * Remaps the first 4 MiB with 4 KiB pages, leaving out the page below the
+ * boot stack, so that the idle task overflowing its stack faults instead of
+ * quietly overwriting whatever sits below it.
+ */
+static void guard_boot_stack(void)
+{
+    pte_t *table;
+    uint32_t i;
+
+    table = (pte_t *) frame_alloc(0);
+    if (table == NULL) {
+        return;
+    }
+
+    for (i = 0; i < 1024; i++) {
+        table[i].value = (i << PAGE_SHIFT) | PG_GLOBAL | PG_RW | PG_PRESENT;
+    }
+    table[KERNEL_STACK_GUARD >> PAGE_SHIFT].value = 0;
+
+    /* Global pages survive a CR3 reload, so flush the guard page by hand. */
+    ((pde4k_t *) KERNEL_PGDIR)[0].value = (uint32_t) table | PG_RW | PG_PRESENT;
+    __asm__ volatile ("invlpg (%0)" : : "r"(KERNEL_STACK_GUARD) : "memory");
 }
 
+/**
+ * Installs the page table for the kernel stack area. The area starts out
+ * empty; stacks are mapped in with kmap_page().
+ */
+static void kstack_area_init(void)
+{
+    uint32_t table;
+
+    table = frame_alloc(GFP_ZERO);
+    if (table == 0) {
+        return;
+    }
+
+    ((pde4k_t *) KERNEL_PGDIR)[KSTACK_AREA >> LARGE_PAGE_SHIFT].value =
+        table | PG_RW | PG_PRESENT;
+}
+
+/**
+ * Gets the amount of installed memory from the boot info, if the loader
+ * passed it on, or else from the CMOS, as reported by the BIOS during POST.
+ *
+ * @return the total amount of physical memory in bytes
+ */
+static uint32_t detect_mem_size(void)
+{
+    const struct boot_info *bi;
+    uint32_t ext_kb;
+    uint32_t high_blocks;
+
+    /* A Multiboot loader already told us. */
+    bi = &boot_info;
+    if (bi->mem_size != 0) {
+        return bi->mem_size;
+    }
+
+    high_blocks = cmos_read(CMOS_HIGHMEM_LO);
+    high_blocks |= cmos_read(CMOS_HIGHMEM_HI) << 8;
+    if (high_blocks > 0xFEFF) {
+        high_blocks = 0xFEFF;   /* don't overflow; we can't map it anyway */
+    }
+    if (high_blocks > 0) {
+        return 0x1000000 + (high_blocks << 16);
+    }
+
+    ext_kb = cmos_read(CMOS_EXTMEM_LO);
+    ext_kb |= cmos_read(CMOS_EXTMEM_HI) << 8;
+    return 0x100000 + (ext_kb << 10);
+}
+
+
 static void paging_enable(void)
 {
     __asm__ volatile (
@@ -129,6 +427,7 @@ static void paging_enable(void)
         movl    %%eax, %%cr0    \n\
         "
         : /* no outputs */
-        : "b"(PSE_BIT), "c"(PD_BASE), "d"(PG_BIT)
+        : "b"(PSE_BIT), "c"(KERNEL_PGDIR), "d"(PG_BIT | WP_BIT)
+        : "eax", "memory"
     );
 }
@@ -0,0 +1,116 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * Copyright (C) 2018 Wes Hampson. All Rights Reserved.                       *
+ *                                                                            *
+ * This file is part of the Lyra operating system.                            *
+ *                                                                            *
+ * Lyra is free software: you can redistribute it and/or modify               *
+ * it under the terms of version 2 of the GNU General Public License          *
+ * as published by the Free Software Foundation.                              *
+ *                                                                            *
+ * See LICENSE in the top-level directory for a copy of the license.          *
+ * You may also visit <https://www.gnu.org/licenses/gpl-2.0.txt>.             *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+/*-----------------------------------------------------------------------------
+ *   File: mem/mm.c
+ * Author: Wes Hampson
+ *   Desc: User address spaces and virtual memory areas.
+ *----------------------------------------------------------------------------*/
+
+#include <stdbool.h>
+#include <string.h>
+#include <lyra/kernel.h>
+#include <lyra/mm.h>
+
+int mm_init(struct mm *mm)
+{
+    mm->pgdir = pgdir_create();
+    if (mm->pgdir == 0) {
+        return -1;
+    }
+
+    mm->nvmas = 0;
+    return 0;
+}
+
+void mm_destroy(struct mm *mm)
+{
+    if (mm->pgdir != 0) {
+        pgdir_destroy(mm->pgdir);
+    }
+
+    mm->pgdir = 0;
+    mm->nvmas = 0;
+}
+
+int mm_fork(struct mm *dst, struct mm *src)
+{
+    if (mm_init(dst) != 0) {
+        return -1;
+    }
+
+    memcpy(dst->vmas, src->vmas, src->nvmas * sizeof(struct vma));
+    dst->nvmas = src->nvmas;
+
+    if (pgdir_clone(dst->pgdir, src->pgdir) != 0) {
+        mm_destroy(dst);
+        return -1;
+    }
+
+    return 0;
+}
+
+int vma_add(struct mm *mm, uint32_t start, uint32_t end, int flags,
+            const char *image, uint32_t image_size)
+{
+    struct vma *vma;
+    int i;
+
+    if (start >= end || start < USER_BASE || end > USER_LIMIT
+            || (start & (PAGE_SIZE - 1)) != 0
+            || (end & (PAGE_SIZE - 1)) != 0
+            || image_size > end - start
+            || mm->nvmas >= MAX_VMAS) {
+        return -1;
+    }
+
+    /* Find the insertion point, keeping the list sorted. */
+    for (i = 0; i < mm->nvmas; i++) {
+        if (start < mm->vmas[i].end) {
+            break;
+        }
+    }
+    if (i < mm->nvmas && end > mm->vmas[i].start) {
+        return -1;
+    }
+
+    memmove(&mm->vmas[i + 1], &mm->vmas[i],
+        (mm->nvmas - i) * sizeof(struct vma));
+    mm->nvmas++;
+
+    vma = &mm->vmas[i];
+    vma->start = start;
+    vma->end = end;
+    vma->flags = flags;
+    vma->image = image;
+    vma->image_size = (image != NULL) ? image_size : 0;
+
+    return 0;
+}
+
+struct vma * vma_find(struct mm *mm, uint32_t addr)
+{
+    int i;
+
+    /* There are only a handful of areas; a linear search is fine. */
+    for (i = 0; i < mm->nvmas; i++) {
+        if (addr < mm->vmas[i].start) {
+            break;
+        }
+        if (addr < mm->vmas[i].end) {
+            return &mm->vmas[i];
+        }
+    }
+
+    return NULL;
+}
@@ -0,0 +1,1110 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * Copyright (C) 2018 Wes Hampson. All Rights Reserved.                       *
+ *                                                                            *
+ * This file is part of the Lyra operating system.                            *
+ *                                                                            *
+ * Lyra is free software: you can redistribute it and/or modify               *
+ * it under the terms of version 2 of the GNU General Public License          *
+ * as published by the Free Software Foundation.                              *
+ *                                                                            *
+ * See LICENSE in the top-level directory for a copy of the license.          *
+ * You may also visit <https://www.gnu.org/licenses/gpl-2.0.txt>.             *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+/*-----------------------------------------------------------------------------
+ *   File: mem/pcache.c
+ * Author: Wes Hampson
+ *   Desc: Page cache for block devices.
+ *
+ * Cached blocks are found through a hash on (device, block). Eviction uses
+ * 2Q: a block enters the cache on A1in, a FIFO, and only moves to Am, an
+ * LRU, if it's asked for again after falling out of A1in. A1out remembers
+ * the identities (but not the data) of blocks recently evicted from A1in to
+ * make that call. One-off accesses, such as a long sequential scan, thus
+ * churn through A1in without pushing the frequently-used blocks out of Am.
+ *
+ * Sequential readers are detected per stream (struct ra_state): a miss that
+ * follows on from the reader's last block opens a read-ahead window, which
+ * is read in the same plugged batch as the missing block so that the block
+ * layer merges them into one request. A marker page partway through the
+ * window starts reading the next, twice as large, window without waiting,
+ * so by the time the reader gets there it's cached. Writes only
+ * dirty the cached page; dirty pages are written back from the idle loop
+ * once they've aged a bit, or on pcache_sync(). Page frames come from the
+ * frame allocator as the cache fills up, and are recycled from then on.
+ *----------------------------------------------------------------------------*/
+
+#include <string.h>
+#include <lyra/kernel.h>
+#include <lyra/cpu.h>
+#include <lyra/interrupt.h>
+#include <lyra/pcache.h>
+#include <drivers/timer.h>
+
+#define HASH_BITS           8
+#define HASH_SIZE           (1 << HASH_BITS)
+
+#define KIN                 ((uint32_t) num_pages / 4)  /* A1in target size */
+#define KOUT                (PCACHE_PAGES / 2)  /* A1out size */
+
+#define WRITEBACK_DELAY     500     /* ticks a page may stay dirty */
+#define FLUSH_BATCH         16      /* pages written per pcache_flush() */
+
+#ifdef __BENCH
+#define BENCH_HOT_PAGES     32
+#define BENCH_SCAN_PAGES    64      /* scanned per round of hot accesses */
+#define BENCH_ROUNDS        32
+#define BENCH_WRITE_PAGES   16
+#endif
+
+/* Queues. */
+#define Q_FREE              0
+#define Q_A1IN              1       /* seen once; FIFO */
+#define Q_AM                2       /* seen again; LRU */
+#define NUM_QUEUES          3
+
+/* Pages in a queue, most recently added (or used) first. */
+struct queue {
+    struct cpage *head;
+    struct cpage *tail;
+    uint32_t count;
+};
+
+/* A block that was recently evicted from A1in (an A1out entry). */
+struct ghost {
+    struct blkdev *dev;
+    uint32_t block;
+    bool used;
+    struct ghost *hash_next;
+};
+
+/* The descriptors live in page frames rather than in .bss, which is part
+   of the kernel image. */
+static struct cpage *pages[PCACHE_PAGES];
+static int num_pages;
+static struct cpage *page_hash[HASH_SIZE];
+static struct queue queues[NUM_QUEUES];
+
+/* A1out, a FIFO kept in a ring. */
+static struct ghost ghosts[KOUT];
+static struct ghost *ghost_hash[HASH_SIZE];
+static uint32_t ghost_next;
+
+static struct {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t ghost_hits;        /* misses found on A1out */
+    uint32_t ra_issued;         /* pages read ahead */
+    uint32_t ra_hits;           /* ...that were used */
+    uint32_t ra_wasted;         /* ...that were evicted unused */
+    uint32_t evict_a1in;
+    uint32_t evict_am;
+    uint32_t writebacks;
+    uint32_t errors;
+} stats;
+
+static struct cpage * get(struct blkdev *dev, uint32_t block, bool fill,
+                          struct ra_state *ra, uint32_t req);
+static void ra_advance(struct ra_state *ra, struct blkdev *dev,
+                       uint32_t block, uint32_t req, bool sync);
+static uint32_t ra_init_size(uint32_t req);
+static uint32_t ra_next_size(uint32_t size);
+static void readahead(struct blkdev *dev, uint32_t start, uint32_t end,
+                      uint32_t mark);
+static int writeback(struct blkdev *dev, uint32_t age, int max);
+static void start_io(struct cpage *pg, int dir);
+static void end_io(struct bio *bio);
+static struct cpage * alloc_page(void);
+static struct cpage * reclaim(void);
+static struct cpage * evict(struct queue *q);
+static struct cpage * lookup(struct blkdev *dev, uint32_t block);
+static void hash_insert(struct cpage *pg);
+static void hash_remove(struct cpage *pg);
+static bool ghost_take(struct blkdev *dev, uint32_t block);
+static void ghost_remove(struct ghost *g);
+static void ghost_add(struct blkdev *dev, uint32_t block);
+static void q_push(int q, struct cpage *pg);
+static void q_remove(struct cpage *pg);
+#ifdef __BENCH
+static void bench_writeback(struct blkdev *dev);
+static int bench_flip(struct blkdev *dev, uint32_t count, uint32_t *sum);
+static uint32_t checksum(const struct cpage *pg);
+static void drop(struct blkdev *dev);
+#endif
+
+static inline uint32_t hash(struct blkdev *dev, uint32_t block)
+{
+    return ((block ^ ((uint32_t) dev >> 4)) * 2654435761U)
+        >> (32 - HASH_BITS);
+}
+
+static inline uint32_t dev_blocks(struct blkdev *dev)
+{
+    return (dev->nr_sectors + SECTORS_PER_PAGE - 1) / SECTORS_PER_PAGE;
+}
+
+void pcache_init(void)
+{
+    struct cpage *chunk;
+    int per_frame;
+    int i;
+
+    chunk = NULL;
+    per_frame = PAGE_SIZE / sizeof(struct cpage);
+    for (i = 0; i < PCACHE_PAGES; i++) {
+        if (i % per_frame == 0) {
+            chunk = (struct cpage *) frame_alloc(GFP_ZERO);
+            if (chunk == NULL) {
+                kprintf_level(KLOG_WARN,
+                    "pcache: out of memory, cache limited to %d pages\n", i);
+                break;
+            }
+        }
+        pages[i] = &chunk[i % per_frame];
+        q_push(Q_FREE, pages[i]);
+        num_pages++;
+    }
+}
+
+struct cpage * pcache_get(struct blkdev *dev, uint32_t block)
+{
+    return get(dev, block, true, NULL, 1);
+}
+
+struct cpage * pcache_get_ra(struct ra_state *ra, struct blkdev *dev,
+                             uint32_t block, uint32_t req)
+{
+    return get(dev, block, true, ra, (req > 0) ? req : 1);
+}
+
+void pcache_ra_init(struct ra_state *ra)
+{
+    ra->start = 0;
+    ra->size = 0;
+    ra->async_size = 0;
+    ra->next = 0;
+}
+
+void pcache_put(struct cpage *pg)
+{
+    uint32_t eflags;
+
+    cli_save(eflags);
+    pg->refcount--;
+    restore_flags(eflags);
+}
+
+void pcache_mark_dirty(struct cpage *pg)
+{
+    uint32_t eflags;
+
+    cli_save(eflags);
+    if (!(pg->flags & CP_DIRTY)) {
+        pg->flags |= CP_DIRTY;
+        pg->dirtied = timer_ticks;
+    }
+    restore_flags(eflags);
+}
+
+int pcache_read(struct blkdev *dev, uint32_t sector, void *buf,
+                uint32_t count)
+{
+    struct ra_state ra;
+
+    pcache_ra_init(&ra);
+    return pcache_read_ra(&ra, dev, sector, buf, count);
+}
+
+int pcache_read_ra(struct ra_state *ra, struct blkdev *dev, uint32_t sector,
+                   void *buf, uint32_t count)
+{
+    struct cpage *pg;
+    uint32_t req;
+    uint8_t *p;
+    uint32_t off;
+    uint32_t n;
+
+    if (sector >= dev->nr_sectors || count > dev->nr_sectors - sector) {
+        return -1;
+    }
+
+    p = buf;
+    while (count > 0) {
+        off = sector % SECTORS_PER_PAGE;
+        n = SECTORS_PER_PAGE - off;
+        if (n > count) {
+            n = count;
+        }
+
+        req = (off + count + SECTORS_PER_PAGE - 1) / SECTORS_PER_PAGE;
+        pg = get(dev, sector / SECTORS_PER_PAGE, true, ra, req);
+        if (pg == NULL) {
+            return -1;
+        }
+        memcpy(p, (uint8_t *) pg->data + (off << SECTOR_SHIFT),
+            n << SECTOR_SHIFT);
+        pcache_put(pg);
+
+        p += n << SECTOR_SHIFT;
+        sector += n;
+        count -= n;
+    }
+
+    return 0;
+}
+
+int pcache_write(struct blkdev *dev, uint32_t sector, const void *buf,
+                 uint32_t count)
+{
+    struct cpage *pg;
+    const uint8_t *p;
+    uint32_t block;
+    uint32_t off;
+    uint32_t n;
+    uint32_t eflags;
+    bool whole;
+
+    if (sector >= dev->nr_sectors || count > dev->nr_sectors - sector) {
+        return -1;
+    }
+
+    p = buf;
+    while (count > 0) {
+        block = sector / SECTORS_PER_PAGE;
+        off = sector % SECTORS_PER_PAGE;
+        n = SECTORS_PER_PAGE - off;
+        if (n > count) {
+            n = count;
+        }
+
+        /* No need to read in a block that's about to be overwritten. */
+        whole = (off == 0 && (n == SECTORS_PER_PAGE
+            || sector + n == dev->nr_sectors));
+
+        pg = get(dev, block, !whole, NULL, 1);
+        if (pg == NULL) {
+            return -1;
+        }
+        memcpy((uint8_t *) pg->data + (off << SECTOR_SHIFT), p,
+            n << SECTOR_SHIFT);
+
+        cli_save(eflags);
+        pg->flags = (pg->flags | CP_VALID) & ~CP_ERROR;
+        restore_flags(eflags);
+        pcache_mark_dirty(pg);
+        pcache_put(pg);
+
+        p += n << SECTOR_SHIFT;
+        sector += n;
+        count -= n;
+    }
+
+    return 0;
+}
+
+int pcache_flush(void)
+{
+    return writeback(NULL, WRITEBACK_DELAY, FLUSH_BATCH);
+}
+
+int pcache_sync(struct blkdev *dev)
+{
+    struct cpage *pg;
+    int status;
+    int i;
+
+    writeback(dev, 0, PCACHE_PAGES);
+
+    status = 0;
+    for (i = 0; i < num_pages; i++) {
+        pg = pages[i];
+        if (pg->queue == Q_FREE || (dev != NULL && pg->dev != dev)) {
+            continue;
+        }
+
+        if (pg->flags & CP_BUSY) {
+            bio_wait(&pg->bio);
+        }
+        /* Either the write failed, or the page was pinned and skipped. */
+        if (pg->flags & CP_DIRTY) {
+            status = -1;
+        }
+    }
+
+    return status;
+}
+
+void pcache_print_stats(void)
+{
+    uint32_t lookups;
+    uint32_t dirty;
+    int i;
+
+    dirty = 0;
+    for (i = 0; i < num_pages; i++) {
+        if (pages[i]->queue != Q_FREE && (pages[i]->flags & CP_DIRTY)) {
+            dirty++;
+        }
+    }
+
+    lookups = stats.hits + stats.misses;
+    kprintf("page cache: %lu of %d pages in use (%lu A1in, %lu Am), "
+        "%lu dirty\n",
+        queues[Q_A1IN].count + queues[Q_AM].count, num_pages,
+        queues[Q_A1IN].count, queues[Q_AM].count, dirty);
+    kprintf("page cache: %lu hits, %lu misses (%lu%% hit rate), "
+        "%lu found on A1out\n",
+        stats.hits, stats.misses,
+        (lookups > 0) ? (stats.hits * 100) / lookups : 0,
+        stats.ghost_hits);
+    kprintf("read-ahead: %lu pages, %lu used, %lu evicted unused "
+        "(%lu%% used)\n",
+        stats.ra_issued, stats.ra_hits, stats.ra_wasted,
+        (stats.ra_issued > 0) ? (stats.ra_hits * 100) / stats.ra_issued : 0);
+    kprintf("evictions: %lu from A1in, %lu from Am; %lu written back, "
+        "%lu I/O errors\n",
+        stats.evict_a1in, stats.evict_am, stats.writebacks, stats.errors);
+}
+
+#ifdef __BENCH
+void pcache_bench(struct blkdev *dev)
+{
+    struct ra_state ra;
+    struct cpage *pg;
+    uint32_t nblocks;
+    uint32_t hot_hits;
+    uint32_t cursor;
+    uint64_t start;
+    uint64_t cycles;
+    int pass;
+    int r, i;
+
+    nblocks = dev_blocks(dev);
+    if (nblocks <= BENCH_HOT_PAGES) {
+        return;
+    }
+
+    /* Cold sequential reads, a block at a time: first without read-ahead,
+       then as a stream. */
+    for (pass = 0; pass < 2; pass++) {
+        drop(dev);
+        memset(&stats, 0, sizeof(stats));
+        pcache_ra_init(&ra);
+        start = rdtsc();
+        for (i = 0; i < (int) nblocks; i++) {
+            pg = (pass == 0) ? pcache_get(dev, i)
+                : pcache_get_ra(&ra, dev, i, 1);
+            if (pg != NULL) {
+                pcache_put(pg);
+            }
+        }
+        cycles = rdtsc() - start;
+        div64(&cycles, nblocks);
+        kprintf("pcache bench: %s sequential, %s read-ahead: "
+            "%lu cycles/page\n",
+            dev->name, (pass == 0) ? "no" : "with", (uint32_t) cycles);
+        pcache_print_stats();
+    }
+
+    /* A hot set, used over and over, against a scan that never comes back
+       to the same block (as long as the device is bigger than the cache). */
+    memset(&stats, 0, sizeof(stats));
+    hot_hits = 0;
+    cursor = 0;
+    for (r = 0; r < BENCH_ROUNDS; r++) {
+        for (i = 0; i < BENCH_HOT_PAGES; i++) {
+            uint32_t hits = stats.hits;
+
+            pg = pcache_get(dev, i);
+            if (pg != NULL) {
+                pcache_put(pg);
+            }
+            hot_hits += stats.hits - hits;
+        }
+
+        for (i = 0; i < BENCH_SCAN_PAGES; i++) {
+            pg = pcache_get(dev, BENCH_HOT_PAGES
+                + cursor++ % (nblocks - BENCH_HOT_PAGES));
+            if (pg != NULL) {
+                pcache_put(pg);
+            }
+        }
+    }
+    kprintf("pcache bench: %s hot set + scan: %lu%% hot set hit rate\n",
+        dev->name, (hot_hits * 100) / (BENCH_ROUNDS * BENCH_HOT_PAGES));
+    pcache_print_stats();
+
+    bench_writeback(dev);
+}
+
+/**
+ * Dirties the first few blocks of a device, syncs them and reads them back
+ * from the device to check that the data made it. Every byte is inverted, so
+ * a second round puts the original contents back.
+ */
+static void bench_writeback(struct blkdev *dev)
+{
+    uint32_t count;
+    uint32_t written;
+    uint32_t sum;
+    uint64_t start;
+    uint64_t cycles;
+    int round;
+    bool ok;
+
+    count = dev_blocks(dev);
+    if (count > BENCH_WRITE_PAGES) {
+        count = BENCH_WRITE_PAGES;
+    }
+
+    ok = true;
+    cycles = 0;
+    for (round = 0; round < 2; round++) {
+        if (bench_flip(dev, count, &written) != 0) {
+            ok = false;
+            break;
+        }
+
+        start = rdtsc();
+        if (pcache_sync(dev) != 0) {
+            ok = false;
+            break;
+        }
+        if (round == 0) {
+            cycles = rdtsc() - start;
+        }
+
+        /* Read it back from the device rather than from the cache. */
+        drop(dev);
+        if (bench_flip(dev, 0, &sum) != 0 || sum != written) {
+            ok = false;
+            break;
+        }
+    }
+
+    div64(&cycles, count);
+    kprintf("pcache bench: %s write-back: %lu pages, %lu cycles/page to "
+        "sync, %s\n", dev->name, count, (uint32_t) cycles,
+        (ok) ? "read back ok" : "FAILED");
+}
+
+/**
+ * Inverts the first 'count' blocks of a device in the cache, leaving them
+ * dirty, then checksums the first BENCH_WRITE_PAGES (or fewer) blocks.
+ *
+ * @return 0 on success, -1 on an I/O error
+ */
+static int bench_flip(struct blkdev *dev, uint32_t count, uint32_t *sum)
+{
+    struct cpage *pg;
+    uint32_t *p;
+    uint32_t nblocks;
+    uint32_t i, j;
+
+    nblocks = dev_blocks(dev);
+    if (nblocks > BENCH_WRITE_PAGES) {
+        nblocks = BENCH_WRITE_PAGES;
+    }
+
+    *sum = 0;
+    for (i = 0; i < nblocks; i++) {
+        pg = pcache_get(dev, i);
+        if (pg == NULL) {
+            return -1;
+        }
+        if (i < count) {
+            p = pg->data;
+            for (j = 0; j < PAGE_SIZE / sizeof(uint32_t); j++) {
+                p[j] = ~p[j];
+            }
+            pcache_mark_dirty(pg);
+        }
+        *sum += checksum(pg);
+        pcache_put(pg);
+    }
+
+    return 0;
+}
+
+static uint32_t checksum(const struct cpage *pg)
+{
+    const uint32_t *p;
+    uint32_t sum;
+    uint32_t i;
+
+    p = pg->data;
+    sum = 0;
+    for (i = 0; i < PAGE_SIZE / sizeof(uint32_t); i++) {
+        sum = (sum << 1 | sum >> 31) + p[i];
+    }
+
+    return sum;
+}
+
+/**
+ * Empties the cache of a device's clean pages, and forgets A1out.
+ */
+static void drop(struct blkdev *dev)
+{
+    struct cpage *pg;
+    uint32_t eflags;
+    int i;
+
+    cli_save(eflags);
+    for (i = 0; i < num_pages; i++) {
+        pg = pages[i];
+        if (pg->queue == Q_FREE || pg->dev != dev || pg->refcount > 0
+                || (pg->flags & (CP_DIRTY | CP_BUSY))) {
+            continue;
+        }
+        hash_remove(pg);
+        q_remove(pg);
+        q_push(Q_FREE, pg);
+    }
+
+    memset(ghosts, 0, sizeof(ghosts));
+    memset(ghost_hash, 0, sizeof(ghost_hash));
+    ghost_next = 0;
+    restore_flags(eflags);
+}
+#endif
+
+/**
+ * Finds a block in the cache, or brings it in.
+ *
+ * @param dev   - the device
+ * @param block - the block number
+ * @param fill  - read the block in if it's not cached; when false, the
+ *                caller is going to overwrite all of it
+ * @param ra    - the reader's read-ahead state; NULL for no read-ahead
+ * @param req   - number of blocks the reader is after, including this one
+ * @return the pinned page, or NULL on failure
+ */
+static struct cpage * get(struct blkdev *dev, uint32_t block, bool fill,
+                          struct ra_state *ra, uint32_t req)
+{
+    struct cpage *pg;
+    uint32_t eflags;
+    bool marker;
+    bool read;
+
+    if (block >= dev_blocks(dev)) {
+        return NULL;
+    }
+
+    marker = false;
+    cli_save(eflags);
+    pg = lookup(dev, block);
+    if (pg != NULL) {
+        stats.hits++;
+        if (pg->flags & CP_READAHEAD) {
+            pg->flags &= ~CP_READAHEAD;
+            stats.ra_hits++;
+        }
+        if (pg->flags & CP_RA_MARK) {
+            pg->flags &= ~CP_RA_MARK;
+            marker = true;
+        }
+        if (pg->queue == Q_AM) {
+            q_remove(pg);
+            q_push(Q_AM, pg);
+        }
+    }
+    else {
+        stats.misses++;
+        pg = alloc_page();
+        if (pg == NULL) {
+            restore_flags(eflags);
+            return NULL;
+        }
+
+        pg->dev = dev;
+        pg->block = block;
+        pg->flags = 0;
+        hash_insert(pg);
+        if (ghost_take(dev, block)) {
+            stats.ghost_hits++;
+            q_push(Q_AM, pg);
+        }
+        else {
+            q_push(Q_A1IN, pg);
+        }
+    }
+
+    pg->refcount++;
+    read = fill && !(pg->flags & (CP_VALID | CP_BUSY));
+    if (read) {
+        pg->flags |= CP_BUSY;
+    }
+    restore_flags(eflags);
+
+    if (read || (marker && ra != NULL)) {
+        /* Plugged, so that the window merges with the block itself. */
+        blk_plug(dev);
+        if (read) {
+            start_io(pg, BIO_READ);
+        }
+        if (ra != NULL) {
+            ra_advance(ra, dev, block, req, read);
+        }
+        blk_unplug(dev);
+    }
+    if (ra != NULL) {
+        ra->next = block + 1;
+    }
+
+    if (pg->flags & CP_BUSY) {
+        bio_wait(&pg->bio);
+    }
+
+    if (fill && !(pg->flags & CP_VALID)) {
+        pcache_put(pg);
+        return NULL;
+    }
+
+    return pg;
+}
+
+/**
+ * Moves a reader's read-ahead window along and starts reading it.
+ *
+ * @param ra    - the read-ahead state
+ * @param dev   - the device
+ * @param block - the block the reader is at
+ * @param req   - number of blocks the reader is after, including this one
+ * @param sync  - true if the block wasn't cached (and is being read in),
+ *                false if the reader got to a window's marker page
+ */
+static void ra_advance(struct ra_state *ra, struct blkdev *dev,
+                       uint32_t block, uint32_t req, bool sync)
+{
+    uint32_t start;
+
+    if (sync) {
+        if (block != ra->next) {
+            /* Random access; only read what was asked for. */
+            ra->size = (req < RA_MAX_PAGES) ? req : RA_MAX_PAGES;
+        }
+        else if (ra->size > 0 && block == ra->start + ra->size) {
+            /* The reader outran the previous window. */
+            ra->size = ra_next_size(ra->size);
+        }
+        else {
+            ra->size = ra_init_size(req);
+        }
+        ra->start = block;
+        ra->async_size = (ra->size > req) ? ra->size - req : 0;
+        start = block + 1;
+    }
+    else {
+        if (ra->async_size == 0
+                || block != ra->start + ra->size - ra->async_size) {
+            /* Someone else's marker. */
+            return;
+        }
+        ra->start += ra->size;
+        ra->size = ra_next_size(ra->size);
+        ra->async_size = ra->size;
+        start = ra->start;
+    }
+
+    readahead(dev, start, ra->start + ra->size,
+        ra->start + ra->size - ra->async_size);
+}
+
+/**
+ * Size of the first read-ahead window of a sequential stream: a couple of
+ * times the size of the read that started it.
+ */
+static uint32_t ra_init_size(uint32_t req)
+{
+    uint32_t size;
+
+    size = RA_MIN_PAGES;
+    while (size < req * 2 && size < RA_MAX_PAGES) {
+        size <<= 1;
+    }
+
+    return size;
+}
+
+static uint32_t ra_next_size(uint32_t size)
+{
+    return (size * 2 < RA_MAX_PAGES) ? size * 2 : RA_MAX_PAGES;
+}
+
+/**
+ * Starts reading a range of blocks, skipping the ones that are cached.
+ *
+ * @param dev   - the device
+ * @param start - first block
+ * @param end   - block after the last
+ * @param mark  - block to mark with CP_RA_MARK
+ */
+static void readahead(struct blkdev *dev, uint32_t start, uint32_t end,
+                      uint32_t mark)
+{
+    struct cpage *pg;
+    uint32_t eflags;
+    uint32_t block;
+
+    if (end > dev_blocks(dev)) {
+        end = dev_blocks(dev);
+    }
+
+    for (block = start; block < end; block++) {
+        cli_save(eflags);
+        pg = lookup(dev, block);
+        if (pg != NULL) {
+            if (block == mark) {
+                pg->flags |= CP_RA_MARK;
+            }
+            restore_flags(eflags);
+            continue;
+        }
+
+        pg = alloc_page();
+        if (pg == NULL) {
+            restore_flags(eflags);
+            break;
+        }
+
+        pg->dev = dev;
+        pg->block = block;
+        pg->flags = CP_BUSY | CP_READAHEAD;
+        if (block == mark) {
+            pg->flags |= CP_RA_MARK;
+        }
+        hash_insert(pg);
+        /* A block on A1out must not get a second entry when it's evicted
+           again. It was wanted recently enough to go on Am. */
+        q_push(ghost_take(dev, block) ? Q_AM : Q_A1IN, pg);
+        stats.ra_issued++;
+        restore_flags(eflags);
+
+        start_io(pg, BIO_READ);
+    }
+}
+
+/**
+ * Starts writing back dirty pages that nobody has pinned.
+ *
+ * @param dev - only pages of this device; NULL for all devices
+ * @param age - only pages that have been dirty for at least this many ticks
+ * @param max - the most pages to write
+ * @return the number of pages written
+ */
+static int writeback(struct blkdev *dev, uint32_t age, int max)
+{
+    struct blkdev *plugged[MAX_BLKDEVS];
+    struct cpage *pg;
+    uint32_t eflags;
+    int nplugged;
+    int count;
+    int i, j;
+
+    nplugged = 0;
+    count = 0;
+    for (i = 0; i < num_pages && count < max; i++) {
+        pg = pages[i];
+
+        cli_save(eflags);
+        if (pg->queue == Q_FREE || (pg->flags & (CP_DIRTY | CP_BUSY)) != CP_DIRTY
+                || pg->refcount > 0 || (dev != NULL && pg->dev != dev)
+                || timer_ticks - pg->dirtied < age) {
+            restore_flags(eflags);
+            continue;
+        }
+        pg->flags |= CP_BUSY;
+        restore_flags(eflags);
+
+        /* Plug each device as it comes up, so that writes to adjacent
+           blocks go out as one request. */
+        for (j = 0; j < nplugged && plugged[j] != pg->dev; j++) { }
+        if (j == nplugged && nplugged < MAX_BLKDEVS) {
+            blk_plug(pg->dev);
+            plugged[nplugged++] = pg->dev;
+        }
+
+        start_io(pg, BIO_WRITE);
+        stats.writebacks++;
+        count++;
+    }
+
+    for (j = 0; j < nplugged; j++) {
+        blk_unplug(plugged[j]);
+    }
+
+    return count;
+}
+
+/**
+ * Reads or writes a page. The caller sets CP_BUSY beforehand; end_io()
+ * clears it.
+ */
+static void start_io(struct cpage *pg, int dir)
+{
+    uint32_t sector;
+    uint32_t n;
+
+    sector = pg->block * SECTORS_PER_PAGE;
+    n = pg->dev->nr_sectors - sector;
+    if (n > SECTORS_PER_PAGE) {
+        n = SECTORS_PER_PAGE;
+    }
+
+    bio_init(&pg->bio, pg->dev, dir, sector);
+    bio_add_buf(&pg->bio, pg->data, n << SECTOR_SHIFT);
+    pg->bio.end_io = end_io;
+    pg->bio.private = pg;
+    submit_bio(&pg->bio);
+}
+
+/**
+ * Bio completion callback. Runs with interrupts disabled.
+ */
+static void end_io(struct bio *bio)
+{
+    struct cpage *pg;
+
+    pg = bio->private;
+    if (bio->status != 0) {
+        pg->flags |= CP_ERROR;
+        stats.errors++;
+    }
+    else if (bio->dir == BIO_READ) {
+        pg->flags = (pg->flags | CP_VALID) & ~CP_ERROR;
+    }
+    else {
+        pg->flags &= ~(CP_DIRTY | CP_ERROR);
+    }
+
+    /* A failed write leaves the page dirty; hold off on the retry for a
+       while, rather than hammering a device that just said no. */
+    if (bio->status != 0 && bio->dir == BIO_WRITE) {
+        pg->dirtied = timer_ticks;
+    }
+    pg->flags &= ~CP_BUSY;
+}
+
+/**
+ * Finds a page to hold a new block: a free one if there is one, otherwise
+ * one that's evicted.
+ * Interrupts must be disabled.
+ */
+static struct cpage * alloc_page(void)
+{
+    struct cpage *pg;
+    uint32_t frame;
+
+    pg = queues[Q_FREE].tail;
+    if (pg == NULL) {
+        return reclaim();
+    }
+
+    if (pg->data == NULL) {
+        frame = frame_alloc(0);
+        if (frame == 0) {
+            return reclaim();
+        }
+        pg->data = (void *) frame;
+    }
+
+    q_remove(pg);
+    return pg;
+}
+
+/**
+ * Evicts a page. A1in gives up its oldest page if it's grown past its
+ * share of the cache; otherwise Am gives up its least recently used one.
+ * Interrupts must be disabled.
+ */
+static struct cpage * reclaim(void)
+{
+    struct cpage *pg;
+
+    if (queues[Q_A1IN].count > KIN || queues[Q_AM].count == 0) {
+        pg = evict(&queues[Q_A1IN]);
+        if (pg == NULL) {
+            pg = evict(&queues[Q_AM]);
+        }
+    }
+    else {
+        pg = evict(&queues[Q_AM]);
+        if (pg == NULL) {
+            pg = evict(&queues[Q_A1IN]);
+        }
+    }
+
+    if (pg == NULL) {
+        return NULL;
+    }
+
+    if (pg->queue == Q_A1IN) {
+        ghost_add(pg->dev, pg->block);
+        stats.evict_a1in++;
+    }
+    else {
+        stats.evict_am++;
+    }
+    if (pg->flags & CP_READAHEAD) {
+        stats.ra_wasted++;
+    }
+
+    hash_remove(pg);
+    q_remove(pg);
+    return pg;
+}
+
+/**
+ * Finds the oldest page in a queue that can be evicted, i.e. one that's not
+ * pinned, dirty or under I/O.
+ */
+static struct cpage * evict(struct queue *q)
+{
+    struct cpage *pg;
+
+    for (pg = q->tail; pg != NULL; pg = pg->prev) {
+        if (pg->refcount == 0
+                && !(pg->flags & (CP_DIRTY | CP_BUSY))) {
+            return pg;
+        }
+    }
+
+    return NULL;
+}
+
+static struct cpage * lookup(struct blkdev *dev, uint32_t block)
+{
+    struct cpage *pg;
+
+    for (pg = page_hash[hash(dev, block)]; pg != NULL; pg = pg->hash_next) {
+        if (pg->dev == dev && pg->block == block) {
+            return pg;
+        }
+    }
+
+    return NULL;
+}
+
+static void hash_insert(struct cpage *pg)
+{
+    uint32_t h;
+
+    h = hash(pg->dev, pg->block);
+    pg->hash_next = page_hash[h];
+    page_hash[h] = pg;
+}
+
+static void hash_remove(struct cpage *pg)
+{
+    struct cpage **pos;
+
+    pos = &page_hash[hash(pg->dev, pg->block)];
+    while (*pos != NULL && *pos != pg) {
+        pos = &(*pos)->hash_next;
+    }
+    if (*pos != NULL) {
+        *pos = pg->hash_next;
+    }
+    pg->hash_next = NULL;
+}
+
+/**
+ * Removes a block from A1out if it's there.
+ *
+ * @return true if it was
+ */
+static bool ghost_take(struct blkdev *dev, uint32_t block)
+{
+    struct ghost *g;
+
+    for (g = ghost_hash[hash(dev, block)]; g != NULL; g = g->hash_next) {
+        if (g->dev == dev && g->block == block) {
+            ghost_remove(g);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Unlinks an A1out entry from its hash chain and frees its slot.
+ */
+static void ghost_remove(struct ghost *g)
+{
+    struct ghost **pos;
+
+    pos = &ghost_hash[hash(g->dev, g->block)];
+    while (*pos != NULL && *pos != g) {
+        pos = &(*pos)->hash_next;
+    }
+    if (*pos != NULL) {
+        *pos = g->hash_next;
+    }
+    g->hash_next = NULL;
+    g->used = false;
+}
+
+/**
+ * Adds a block to A1out, pushing out the oldest entry if it's full.
+ */
+static void ghost_add(struct blkdev *dev, uint32_t block)
+{
+    struct ghost *g;
+    uint32_t h;
+
+    g = &ghosts[ghost_next];
+    ghost_next = (ghost_next + 1) % KOUT;
+    if (g->used) {
+        ghost_remove(g);
+    }
+
+    g->dev = dev;
+    g->block = block;
+    g->used = true;
+    h = hash(dev, block);
+    g->hash_next = ghost_hash[h];
+    ghost_hash[h] = g;
+}
+
+static void q_push(int q, struct cpage *pg)
+{
+    struct queue *queue;
+
+    queue = &queues[q];
+    pg->queue = q;
+    pg->prev = NULL;
+    pg->next = queue->head;
+    if (queue->head != NULL) {
+        queue->head->prev = pg;
+    }
+    else {
+        queue->tail = pg;
+    }
+    queue->head = pg;
+    queue->count++;
+}
+
+static void q_remove(struct cpage *pg)
+{
+    struct queue *queue;
+
+    queue = &queues[pg->queue];
+    if (pg->prev != NULL) {
+        pg->prev->next = pg->next;
+    }
+    else {
+        queue->head = pg->next;
+    }
+    if (pg->next != NULL) {
+        pg->next->prev = pg->prev;
+    }
+    else {
+        queue->tail = pg->prev;
+    }
+    pg->prev = NULL;
+    pg->next = NULL;
+    queue->count--;
+}
@@ -21,15 +21,24 @@
 
 SECTOR_SIZE=512
 KERNEL_NUM_SECTORS_ADDR=502
+INITRD_NUM_SECTORS_ADDR=504
 
 if [ $# -lt 3 ]; then
-    echo "$0: usage: boot_img kernel_img out_img"
+    echo "$0: usage: boot_img kernel_img out_img [initrd_img]"
     exit 1
 fi
 
 boot_img=$1
 kernel_img=$2
 out_img=$3
+initrd_img=$4
+
+# Writes a 16-bit little-endian value into the disk image
+# $1: value, $2: offset
+write_short() {
+    printf "\x$(printf %02x $(($1 & 0xFF)))\x$(printf %02x $(($1 >> 8)))" |\
+        dd of=$out_img bs=1 seek=$2 conv=notrunc status=none
+}
 
 # Compute number of sectors needed to hold kernel image
 kernel_size=$(wc -c $kernel_img)
@@ -44,8 +53,38 @@ if [ $? -ne 0 ]; then
 fi
 
 # Update KERNEL_NUM_SECTORS value in disk image
-printf "\x$(printf %02x $num_sectors)" |\
-    dd of=$out_img bs=1 seek=$KERNEL_NUM_SECTORS_ADDR conv=notrunc status=none
+write_short $num_sectors $KERNEL_NUM_SECTORS_ADDR
+if [ $? -ne 0 ]; then
+    exit 1
+fi
+
+if [ -z "$initrd_img" ]; then
+    exit 0
+fi
+
+# The bootloader expects the initrd to start right after the last kernel
+# sector, so pad the kernel out first
+boot_size=$(wc -c $boot_img)
+boot_size=${boot_size/%\ */}
+truncate -s $((boot_size + num_sectors * SECTOR_SIZE)) $out_img
+
+initrd_size=$(wc -c $initrd_img)
+initrd_size=${initrd_size/%\ */}
+initrd_sectors=$(((initrd_size + SECTOR_SIZE - 1) / SECTOR_SIZE))
+if [ $initrd_sectors -gt 65535 ]; then
+    echo "$0: $initrd_img: initrd too large for the bootloader"
+    exit 1
+fi
+
+cat $initrd_img >> $out_img
+if [ $? -ne 0 ]; then
+    exit 1
+fi
+truncate -s $((boot_size + (num_sectors + initrd_sectors) * SECTOR_SIZE)) \
+    $out_img
+
+# Update INITRD_NUM_SECTORS value in disk image
+write_short $initrd_sectors $INITRD_NUM_SECTORS_ADDR
 if [ $? -ne 0 ]; then
     exit 1
 fi
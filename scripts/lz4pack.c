@@ -0,0 +1,181 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * Copyright (C) 2018 Wes Hampson. All Rights Reserved.                       *
+ *                                                                            *
+ * This file is part of the Lyra operating system.                            *
+ *                                                                            *
+ * Lyra is free software: you can redistribute it and/or modify               *
+ * it under the terms of version 2 of the GNU General Public License          *
+ * as published by the Free Software Foundation.                              *
+ *                                                                            *
+ * See LICENSE in the top-level directory for a copy of the license.          *
+ * You may also visit <https://www.gnu.org/licenses/gpl-2.0.txt>.             *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+/*-----------------------------------------------------------------------------
+ *   File: scripts/lz4pack.c
+ * Author: Wes Hampson
+ *   Desc: Compresses the kernel image for the bootloader. Built and run on
+ *         the host.
+ *
+ * The output is an 8-byte header (the uncompressed and compressed sizes, as
+ * 32-bit little-endian values) followed by a single raw LZ4 block; see
+ * lz4_decompress in boot/pm.S. Matches are found greedily through a hash of
+ * the next four bytes, which is plenty for an image that's mostly code and
+ * zeros.
+ *----------------------------------------------------------------------------*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN_MATCH       4
+#define MFLIMIT         12      /* no match may start this close to the end */
+#define LAST_LITERALS   5       /* the last bytes are always literals */
+#define MAX_OFFSET      65535
+#define HASH_BITS       16
+
+static long table[1 << HASH_BITS];
+
+static uint32_t read32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static void write32(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static uint32_t hash(uint32_t v)
+{
+    return (v * 2654435761U) >> (32 - HASH_BITS);
+}
+
+static uint8_t * put_length(uint8_t *out, size_t len)
+{
+    while (len >= 255) {
+        *out++ = 255;
+        len -= 255;
+    }
+    *out++ = len;
+
+    return out;
+}
+
+/**
+ * Writes a sequence: literals, then a match. The last sequence of a block
+ * has no match (match_len is 0).
+ */
+static uint8_t * put_sequence(uint8_t *out, const uint8_t *lit, size_t nlit,
+                              size_t offset, size_t match_len)
+{
+    size_t mlen;
+
+    mlen = (match_len > 0) ? match_len - MIN_MATCH : 0;
+    *out++ = ((nlit >= 15) ? 15 : nlit) << 4 | ((mlen >= 15) ? 15 : mlen);
+    if (nlit >= 15) {
+        out = put_length(out, nlit - 15);
+    }
+    memcpy(out, lit, nlit);
+    out += nlit;
+
+    if (match_len == 0) {
+        return out;
+    }
+
+    *out++ = offset & 0xFF;
+    *out++ = offset >> 8;
+    if (mlen >= 15) {
+        out = put_length(out, mlen - 15);
+    }
+
+    return out;
+}
+
+static size_t compress(const uint8_t *in, size_t n, uint8_t *out)
+{
+    uint8_t *start;
+    size_t anchor;
+    size_t len;
+    size_t i;
+    long cand;
+    uint32_t h;
+
+    memset(table, 0xFF, sizeof(table));
+    start = out;
+    anchor = 0;
+    i = 0;
+
+    while (n > MFLIMIT && i < n - MFLIMIT) {
+        h = hash(read32(in + i));
+        cand = table[h];
+        table[h] = i;
+
+        if (cand < 0 || i - cand > MAX_OFFSET
+                || read32(in + cand) != read32(in + i)) {
+            i++;
+            continue;
+        }
+
+        len = MIN_MATCH;
+        while (i + len < n - LAST_LITERALS && in[cand + len] == in[i + len]) {
+            len++;
+        }
+
+        out = put_sequence(out, in + anchor, i - anchor, i - cand, len);
+        i += len;
+        anchor = i;
+    }
+
+    out = put_sequence(out, in + anchor, n - anchor, 0, 0);
+    return out - start;
+}
+
+int main(int argc, char *argv[])
+{
+    FILE *f;
+    uint8_t *in;
+    uint8_t *out;
+    size_t n;
+    size_t size;
+
+    if (argc < 3) {
+        fprintf(stderr, "%s: usage: in_img out_img\n", argv[0]);
+        return 1;
+    }
+
+    f = fopen(argv[1], "rb");
+    if (f == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    n = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    /* Worst case, everything's a literal. */
+    in = malloc(n + 1);
+    out = malloc(8 + n + n / 255 + 16);
+    if (in == NULL || out == NULL || fread(in, 1, n, f) != n) {
+        fprintf(stderr, "%s: %s: read error\n", argv[0], argv[1]);
+        return 1;
+    }
+    fclose(f);
+
+    size = compress(in, n, out + 8);
+    write32(out, n);
+    write32(out + 4, size);
+
+    f = fopen(argv[2], "wb");
+    if (f == NULL || fwrite(out, 1, size + 8, f) != size + 8) {
+        perror(argv[2]);
+        return 1;
+    }
+    fclose(f);
+
+    return 0;
+}
@@ -0,0 +1,117 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * Copyright (C) 2018 Wes Hampson. All Rights Reserved.                       *
+ *                                                                            *
+ * This file is part of the Lyra operating system.                            *
+ *                                                                            *
+ * Lyra is free software: you can redistribute it and/or modify               *
+ * it under the terms of version 2 of the GNU General Public License          *
+ * as published by the Free Software Foundation.                              *
+ *                                                                            *
+ * See LICENSE in the top-level directory for a copy of the license.          *
+ * You may also visit <https://www.gnu.org/licenses/gpl-2.0.txt>.             *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+/*-----------------------------------------------------------------------------
+ *   File: user/init.c
+ * Author: Wes Hampson
+ *   Desc: The first user program.
+ *----------------------------------------------------------------------------*/
+
+#include "ulib.h"
+
+#define PAGE_SIZE       4096
+#define BENCH_ITERS     10000
+#define CPU_FEAT_SEP    (1 << 11)
+
+/* Plenty of zeros; only the pages that get touched cost any memory. */
+static char scratch[1024 * 1024];
+
+#ifdef __BENCH
+/**
+ * Times a null system call through 'int $0x80' and SYSENTER.
+ */
+static void syscall_bench(void)
+{
+    uint64_t start;
+    uint32_t cycles;
+    int i;
+
+    start = rdtsc();
+    for (i = 0; i < BENCH_ITERS; i++) {
+        syscall0(SYS_GETPID);
+    }
+    cycles = (uint32_t) (rdtsc() - start);
+    puts("int 0x80: ");
+    putnum(cycles / BENCH_ITERS);
+    puts(" cycles/call\n");
+
+    if (!cpu_has(CPU_FEAT_SEP)) {
+        return;
+    }
+
+    start = rdtsc();
+    for (i = 0; i < BENCH_ITERS; i++) {
+        sysenter0(SYS_GETPID);
+    }
+    cycles = (uint32_t) (rdtsc() - start);
+    puts("sysenter: ");
+    putnum(cycles / BENCH_ITERS);
+    puts(" cycles/call\n");
+}
+
+/**
+ * Times fork() as the parent's address space grows. Fork only copies page
+ * tables, so its cost should grow with the number of mapped pages, but much
+ * more slowly than copying the pages themselves would.
+ */
+static void fork_bench(void)
+{
+    static const int SIZES[] = { 0, 16, 64, 256 };
+    uint64_t start;
+    uint32_t cycles;
+    int pid;
+    int i, j;
+
+    for (i = 0; i < (int) (sizeof(SIZES) / sizeof(SIZES[0])); i++) {
+        for (j = 0; j < SIZES[i]; j++) {
+            scratch[j * PAGE_SIZE] = 1;
+        }
+
+        start = rdtsc();
+        pid = fork();
+        if (pid == 0) {
+            exit(0);
+        }
+        cycles = (uint32_t) (rdtsc() - start);
+
+        puts("fork, ");
+        putnum(SIZES[i]);
+        puts(" scratch pages: ");
+        putnum(cycles);
+        puts(" cycles\n");
+
+        /* Let the child run and exit. */
+        yield();
+    }
+}
+#endif
+
+int main(void)
+{
+    int i;
+
+    puts("init: running in ring 3 as pid ");
+    putnum(getpid());
+    puts("\n");
+
+    for (i = 0; i < 4; i++) {
+        scratch[i * PAGE_SIZE] = i;
+    }
+
+#ifdef __BENCH
+    syscall_bench();
+    fork_bench();
+#endif
+
+    return 0;
+}
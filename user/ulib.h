@@ -0,0 +1,178 @@
+/*~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*
+ * Copyright (C) 2018 Wes Hampson. All Rights Reserved.                       *
+ *                                                                            *
+ * This file is part of the Lyra operating system.                            *
+ *                                                                            *
+ * Lyra is free software: you can redistribute it and/or modify               *
+ * it under the terms of version 2 of the GNU General Public License          *
+ * as published by the Free Software Foundation.                              *
+ *                                                                            *
+ * See LICENSE in the top-level directory for a copy of the license.          *
+ * You may also visit <https://www.gnu.org/licenses/gpl-2.0.txt>.             *
+ *~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~*/
+
+/*-----------------------------------------------------------------------------
+ *   File: user/ulib.h
+ * Author: Wes Hampson
+ *   Desc: System call wrappers and helpers for user programs.
+ *----------------------------------------------------------------------------*/
+
+#ifndef __ULIB_H
+#define __ULIB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <lyra/syscall.h>
+
+static inline int syscall0(int nr)
+{
+    int ret;
+
+    __asm__ volatile (
+        "int    $0x80"
+        : "=a"(ret)
+        : "a"(nr)
+        : "memory"
+    );
+    return ret;
+}
+
+static inline int syscall1(int nr, uint32_t a)
+{
+    int ret;
+
+    __asm__ volatile (
+        "int    $0x80"
+        : "=a"(ret)
+        : "a"(nr), "b"(a)
+        : "memory"
+    );
+    return ret;
+}
+
+static inline int syscall3(int nr, uint32_t a, uint32_t b, uint32_t c)
+{
+    int ret;
+
+    __asm__ volatile (
+        "int    $0x80"
+        : "=a"(ret)
+        : "a"(nr), "b"(a), "c"(b), "d"(c)
+        : "memory"
+    );
+    return ret;
+}
+
+/**
+ * Makes a system call with no arguments through SYSENTER.
+ * See lyra/syscall.h for the calling sequence.
+ */
+static inline int sysenter0(int nr)
+{
+    int ret;
+
+    __asm__ volatile (
+        "                           \n\
+        pushl   %%ebp               \n\
+        pushl   $1f                 \n\
+        movl    %%esp, %%ebp        \n\
+        sysenter                    \n\
+    1:  popl    %%ebp               \n\
+        "
+        : "=a"(ret)
+        : "a"(nr)
+        : "ecx", "edx", "memory"
+    );
+    return ret;
+}
+
+static inline int write(int fd, const void *buf, size_t n)
+{
+    return syscall3(SYS_WRITE, fd, (uint32_t) buf, n);
+}
+
+static inline uint32_t time(void)
+{
+    return (uint32_t) syscall1(SYS_TIME, 0);
+}
+
+static inline void yield(void)
+{
+    syscall0(SYS_YIELD);
+}
+
+static inline int getpid(void)
+{
+    return syscall0(SYS_GETPID);
+}
+
+static inline int fork(void)
+{
+    return syscall0(SYS_FORK);
+}
+
+__attribute__((noreturn))
+static inline void exit(int status)
+{
+    syscall1(SYS_EXIT, status);
+    for (;;);
+}
+
+static inline size_t strlen(const char *s)
+{
+    size_t n;
+
+    for (n = 0; s[n] != '\0'; n++);
+    return n;
+}
+
+static inline int puts(const char *s)
+{
+    return write(FD_STDOUT, s, strlen(s));
+}
+
+/**
+ * Writes an unsigned integer in decimal.
+ */
+static inline int putnum(uint32_t n)
+{
+    char buf[10];
+    int i;
+
+    i = sizeof(buf);
+    do {
+        buf[--i] = '0' + (n % 10);
+        n /= 10;
+    } while (n != 0);
+
+    return write(FD_STDOUT, &buf[i], sizeof(buf) - i);
+}
+
+static inline uint64_t rdtsc(void)
+{
+    uint64_t tsc;
+
+    __asm__ volatile (
+        "rdtsc"
+        : "=A"(tsc)
+    );
+    return tsc;
+}
+
+/**
+ * Checks a CPUID leaf 1 EDX feature flag.
+ */
+static inline bool cpu_has(uint32_t feat)
+{
+    uint32_t a, b, c, d;
+
+    __asm__ volatile (
+        "cpuid"
+        : "=a"(a), "=b"(b), "=c"(c), "=d"(d)
+        : "a"(1), "c"(0)
+    );
+    return (d & feat) == feat;
+}
+
+#endif /* __ULIB_H */